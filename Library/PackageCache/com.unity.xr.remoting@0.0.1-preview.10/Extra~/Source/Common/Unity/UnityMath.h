@@ -101,6 +101,16 @@ static inline float Dot(const UnityXRVector3& a, const UnityXRVector3& b)
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
+static inline UnityXRVector3 Cross(const UnityXRVector3& a, const UnityXRVector3& b)
+{
+    return UnityXRVector3
+    {
+        a.y * b.z - a.z * b.y,
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x
+    };
+}
+
 static inline float LengthSquared(const UnityXRVector3& v)
 {
     return Dot(v, v);
@@ -164,3 +174,105 @@ static inline UnityXRVector3 Mul(const UnityXRVector4& q, const UnityXRVector3&
 
     return Add(Add(u, Mul(m0, u.x)), Add(Mul(m1, u.y), Mul(m2, u.z)));
 }
+
+// Rotates by b, then by a.
+static inline UnityXRVector4 Mul(const UnityXRVector4& a, const UnityXRVector4& b)
+{
+    return UnityXRVector4
+    {
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+    };
+}
+
+// A pose given relative to parent, in the space parent is in.
+static inline UnityXRPose TransformPose(const UnityXRPose& parent, const UnityXRPose& localPose)
+{
+    return UnityXRPose
+    {
+        Add(parent.position, Mul(parent.rotation, localPose.position)),
+        Mul(parent.rotation, localPose.rotation)
+    };
+}
+
+// A pose relative to parent, both given in the same space.
+static inline UnityXRPose InverseTransformPose(const UnityXRPose& parent, const UnityXRPose& pose)
+{
+    const auto inverseRotation = Inverse(parent.rotation);
+    return UnityXRPose
+    {
+        Mul(inverseRotation, Sub(pose.position, parent.position)),
+        Mul(inverseRotation, pose.rotation)
+    };
+}
+
+// Rotation that takes kUp to the unit vector direction.
+static inline UnityXRVector4 RotationFromUp(const UnityXRVector3& direction)
+{
+    const float d = Dot(kUp, direction);
+    if (d < -.9999f)
+        return UnityXRVector4{ 1, 0, 0, 0 };
+
+    const UnityXRVector3 axis = Cross(kUp, direction);
+    UnityXRVector4 q = { axis.x, axis.y, axis.z, 1.f + d };
+    const float invLength = 1.f / std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    q.x *= invLength;
+    q.y *= invLength;
+    q.z *= invLength;
+    q.w *= invLength;
+    return q;
+}
+
+// Point of the segment from a to b nearest to p.
+static inline UnityXRVector3 ClosestPointOnSegment(const UnityXRVector3& p, const UnityXRVector3& a, const UnityXRVector3& b)
+{
+    const UnityXRVector3 ab = Sub(b, a);
+    const float lengthSquared = Dot(ab, ab);
+    if (lengthSquared == 0.f)
+        return a;
+
+    const float t = Dot(Sub(p, a), ab) / lengthSquared;
+    return Add(a, Mul(ab, t < 0.f ? 0.f : (t > 1.f ? 1.f : t)));
+}
+
+static inline UnityXRVector3 Lerp(const UnityXRVector3& a, const UnityXRVector3& b, float t)
+{
+    return Add(a, Mul(Sub(b, a), t));
+}
+
+// Spherical interpolation between unit quaternions along the shorter arc.
+static inline UnityXRVector4 Slerp(const UnityXRVector4& a, const UnityXRVector4& b, float t)
+{
+    float d = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    const float sign = d < 0.f ? -1.f : 1.f;
+    d *= sign;
+
+    float wa = 1.f - t;
+    float wb = t * sign;
+
+    // Nearly equal rotations are lerped, since sin(angle) vanishes.
+    if (d < .9995f)
+    {
+        const float angle = std::acos(d);
+        const float invSin = 1.f / std::sin(angle);
+        wa = std::sin(wa * angle) * invSin;
+        wb = std::sin(t * angle) * invSin * sign;
+    }
+
+    UnityXRVector4 q =
+    {
+        wa * a.x + wb * b.x,
+        wa * a.y + wb * b.y,
+        wa * a.z + wb * b.z,
+        wa * a.w + wb * b.w
+    };
+
+    const float invLength = 1.f / std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    q.x *= invLength;
+    q.y *= invLength;
+    q.z *= invLength;
+    q.w *= invLength;
+    return q;
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+
+#include "AsyncRaycastQueue.h"
+
+// Screen points closer than this are the same query.
+static const float kScreenPointResolution = 1.f / 4096.f;
+
+static const size_t kMaxQueries = 64;
+
+// A request unanswered for this long is sent again.
+static const std::chrono::milliseconds kRequestTimeout(1000);
+
+extern "C"
+{
+    // Passing nullptr goes back to native or synchronous managed raycasts.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setAsyncRaycastHandler(AsyncRaycaster raycaster)
+    {
+        if (AsyncRaycastQueue* queue = AsyncRaycastQueue::GetInstance())
+            queue->SetRaycaster(raycaster);
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_completeRaycastRequest(
+        int requestId, const UnityXRRaycastHit* hits, int count)
+    {
+        if (AsyncRaycastQueue* queue = AsyncRaycastQueue::GetInstance())
+            return queue->Complete(requestId, hits, count);
+
+        return false;
+    }
+}
+
+void AsyncRaycastQueue::SetRaycaster(AsyncRaycaster raycaster)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Raycaster = raycaster;
+    m_Queries.clear();
+    m_Requests.clear();
+}
+
+uint64_t AsyncRaycastQueue::QueryKey(float screenX, float screenY, uint32_t hitFlags)
+{
+    const uint64_t x = static_cast<uint16_t>(static_cast<int32_t>(std::lround(screenX / kScreenPointResolution)));
+    const uint64_t y = static_cast<uint16_t>(static_cast<int32_t>(std::lround(screenY / kScreenPointResolution)));
+    return x | (y << 16) | (static_cast<uint64_t>(static_cast<uint32_t>(hitFlags)) << 32);
+}
+
+bool AsyncRaycastQueue::TryGetHits(float screenX, float screenY, uint32_t hitFlags, RaycastHitCollector& hitsOut)
+{
+    if (!std::isfinite(screenX) || !std::isfinite(screenY))
+        return false;
+
+    const uint64_t key = QueryKey(screenX, screenY, hitFlags);
+    AsyncRaycaster raycaster;
+    int requestId = 0;
+    bool hasAnswer = false;
+    {
+        // The raycaster is read under the lock, so a request is never sent
+        // to a raycaster other than the one it is recorded for.
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        raycaster = m_Raycaster;
+        if (raycaster == nullptr)
+            return false;
+
+        auto iter = m_Queries.find(key);
+        if (iter == m_Queries.end())
+        {
+            if (m_Queries.size() >= kMaxQueries)
+                EvictLeastRecentlyUsed();
+
+            iter = m_Queries.emplace(key, Query()).first;
+        }
+
+        Query& query = iter->second;
+        query.lastUsed = ++m_NumLookups;
+
+        const Clock::time_point now = Clock::now();
+        if (query.requestId != 0 && now - query.requestTime > kRequestTimeout)
+        {
+            m_Requests.erase(query.requestId);
+            query.requestId = 0;
+        }
+
+        if (query.requestId == 0)
+        {
+            requestId = m_NextRequestId++;
+            if (m_NextRequestId <= 0)
+                m_NextRequestId = 1;
+
+            query.requestId = requestId;
+            query.requestTime = now;
+            m_Requests[requestId] = key;
+        }
+
+        hasAnswer = query.hasAnswer;
+        for (const auto& hit : query.hits)
+            hitsOut.Add(hit);
+    }
+
+    // Managed code may complete the request before returning, which takes the lock.
+    if (requestId != 0)
+        raycaster(requestId, screenX, screenY, hitFlags);
+
+    return hasAnswer;
+}
+
+bool AsyncRaycastQueue::Complete(int requestId, const UnityXRRaycastHit* hits, int count)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    const auto requestIter = m_Requests.find(requestId);
+    if (requestIter == m_Requests.end())
+        return false;
+
+    const auto queryIter = m_Queries.find(requestIter->second);
+    m_Requests.erase(requestIter);
+    if (queryIter == m_Queries.end())
+        return false;
+
+    Query& query = queryIter->second;
+    if (hits != nullptr && count > 0)
+        query.hits.assign(hits, hits + count);
+    else
+        query.hits.clear();
+
+    query.hasAnswer = true;
+    query.requestId = 0;
+    return true;
+}
+
+void AsyncRaycastQueue::EvictLeastRecentlyUsed()
+{
+    const auto oldest = std::min_element(m_Queries.begin(), m_Queries.end(),
+        [](const std::pair<const uint64_t, Query>& a, const std::pair<const uint64_t, Query>& b)
+    {
+        return a.second.lastUsed < b.second.lastUsed;
+    });
+
+    if (oldest == m_Queries.end())
+        return;
+
+    if (oldest->second.requestId != 0)
+        m_Requests.erase(oldest->second.requestId);
+
+    m_Queries.erase(oldest);
+}
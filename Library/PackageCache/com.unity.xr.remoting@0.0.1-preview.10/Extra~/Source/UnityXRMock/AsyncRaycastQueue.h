@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+#include "RaycastHitCollector.h"
+#include "Singleton.h"
+
+// Sends a raycast to managed code, which answers later through
+// UnityXRMock_completeRaycastRequest. Must not block.
+typedef void(UNITY_INTERFACE_API * AsyncRaycaster)(int requestId, float x, float y, int hitFlags);
+
+// Answers raycasts from the latest managed answer to the same query, so that
+// a raycast never waits for a round trip over the remoting link. A query is a
+// screen point and hit flags; repeating it keeps one request in flight and
+// picks up each new answer as it arrives. The queue lives as long as the
+// plugin and is idle while no raycaster is set.
+class AsyncRaycastQueue : public Singleton<AsyncRaycastQueue>
+{
+public:
+
+    // Replaces the raycaster, nullptr to go back to native or synchronous
+    // managed raycasts. Answers from the previous raycaster are dropped, and
+    // completing its requests in flight fails.
+    void SetRaycaster(AsyncRaycaster raycaster);
+
+    bool IsEnabled() const { return m_Raycaster.load() != nullptr; }
+
+    // Adds the latest answer to this query to hitsOut and returns true, or
+    // returns false if there is none yet and the caller should fall back to
+    // a native raycast. Sends a request if none is in flight for the query.
+    bool TryGetHits(float screenX, float screenY, uint32_t hitFlags, RaycastHitCollector& hitsOut);
+
+    // Stores the answer to requestId. Returns false if the request is unknown,
+    // timed out or its query was evicted.
+    bool Complete(int requestId, const UnityXRRaycastHit* hits, int count);
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Query
+    {
+        std::vector<UnityXRRaycastHit> hits;
+        bool hasAnswer = false;
+
+        // 0 if no request is in flight.
+        int requestId = 0;
+        Clock::time_point requestTime;
+
+        uint64_t lastUsed = 0;
+    };
+
+    static uint64_t QueryKey(float screenX, float screenY, uint32_t hitFlags);
+
+    void EvictLeastRecentlyUsed();
+
+    std::unordered_map<uint64_t, Query> m_Queries;
+
+    // Query key by request id, for requests in flight.
+    std::unordered_map<int, uint64_t> m_Requests;
+
+    int m_NextRequestId = 1;
+
+    uint64_t m_NumLookups = 0;
+
+    std::atomic<AsyncRaycaster> m_Raycaster{nullptr};
+
+    std::mutex m_Mutex;
+};
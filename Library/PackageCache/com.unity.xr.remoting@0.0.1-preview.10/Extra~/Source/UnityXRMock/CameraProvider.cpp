@@ -7,6 +7,7 @@
 #include "UnityMath.h"
 #include "Flags.h"
 #include "InputProvider.h"
+#include "OcclusionRenderer.h"
 
 typedef int(UNITY_INTERFACE_API *UnitySetLightEstimationCallback)(bool);
 static UnitySetLightEstimationCallback gSetLightEstimationCallback;
@@ -100,6 +101,14 @@ extern "C"
         {
             auto params = reinterpret_cast<UnityRenderingExtTextureUpdateParams*>(data);
 
+            if (params->userData == kOcclusionTextureUserData)
+            {
+                // Left without data, and so not updated, while occlusion is off.
+                if (OcclusionRenderer* occlusionRenderer = OcclusionRenderer::GetInstance())
+                    occlusionRenderer->BeginTextureUpdate(*params);
+                return;
+            }
+
             params->texData = imageData;
         }
         else if (event == kUnityRenderingExtEventUpdateTextureEnd)
@@ -124,36 +133,43 @@ struct LightEstimationPayload
 void CameraProvider::SetProjectionMatrix(
     const UnityXRMatrix4x4& projectionMatrix, const UnityXRMatrix4x4& inverseProjectionMatrix, bool hasValue)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LatestFrameData.projectionMatrix = projectionMatrix;
     m_LatestFrameData.providedFields = SetFlag(m_LatestFrameData.providedFields, kUnityXRCameraFramePropertiesProjectionMatrix, hasValue);
 
     m_InverseProjectionMatrix = inverseProjectionMatrix;
     m_HasInverseProjectionMatrix = true;
+    ++m_Version;
 }
 
 void CameraProvider::SetDisplayMatrix(
     const UnityXRMatrix4x4& displayMatrix,
     bool hasValue)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LatestFrameData.displayMatrix = displayMatrix;
     m_LatestFrameData.providedFields = SetFlag(m_LatestFrameData.providedFields, kUnityXRCameraFramePropertiesDisplayMatrix, hasValue);
 }
 
 void CameraProvider::SetAverageBrightness(float averageBrightness, bool hasValue)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LatestFrameData.averageBrightness = averageBrightness;
     m_LatestFrameData.providedFields = SetFlag(m_LatestFrameData.providedFields, kUnityXRCameraFramePropertiesAverageBrightness, hasValue);
 }
 
 void CameraProvider::SetAverageColorTemperature(float averageColorTemperature, bool hasValue)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LatestFrameData.averageColorTemperature = averageColorTemperature;
     m_LatestFrameData.providedFields = SetFlag(m_LatestFrameData.providedFields, kUnityXRCameraFramePropertiesAverageColorTemperature, hasValue);
 }
 
 void CameraProvider::UpdateFrameData(UnityXRCameraFrame frame)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LatestFrameData = frame;
+    ++m_Version;
 }
 
 void UNITY_INTERFACE_API CameraProvider::SetLightEstimationRequested(bool enable)
@@ -161,11 +177,16 @@ void UNITY_INTERFACE_API CameraProvider::SetLightEstimationRequested(bool enable
     if (gSetLightEstimationCallback != nullptr)
         gSetLightEstimationCallback(enable);
 
+    std::lock_guard<std::mutex> lock(m_Mutex);
     m_LightEstimationRequested = enable;
 }
 
 bool UNITY_INTERFACE_API CameraProvider::GetFrame(const UnityXRCameraParams& paramsIn, UnityXRCameraFrame* frameOut)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_HasCameraParameters || std::memcmp(&m_CameraParams, &paramsIn, sizeof(paramsIn)) != 0)
+        ++m_Version;
+
     m_CameraParams = paramsIn;
     m_HasCameraParameters = true;
     *frameOut = m_LatestFrameData;
@@ -250,15 +271,33 @@ UnitySubsystemErrorCode UNITY_INTERFACE_API CameraProvider::StaticGetShaderName(
     return kUnitySubsystemErrorCodeFailure;
 }
 
-bool CameraProvider::TryGetRay(float screenX, float screenY, Ray* rayOut) const
+bool CameraProvider::TryGetProjection(UnityXRMatrix4x4* projectionOut, float* zNearOut, float* zFarOut) const
 {
-    if (!m_HasInverseProjectionMatrix || !m_HasCameraParameters)
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_HasCameraParameters || (m_LatestFrameData.providedFields & kUnityXRCameraFramePropertiesProjectionMatrix) == 0)
         return false;
 
-    UnityXRMatrix4x4 transform;
-    if (!InputProvider::TryGetTransform(&transform))
+    *projectionOut = m_LatestFrameData.projectionMatrix;
+    *zNearOut = m_CameraParams.zNear;
+    *zFarOut = m_CameraParams.zFar;
+    return true;
+}
+
+bool CameraProvider::TryGetInverseProjection(UnityXRMatrix4x4* inverseProjectionOut, float* zNearOut) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_HasInverseProjectionMatrix || !m_HasCameraParameters)
         return false;
 
+    *inverseProjectionOut = m_InverseProjectionMatrix;
+    *zNearOut = m_CameraParams.zNear;
+    return true;
+}
+
+static bool ScreenPointToRay(
+    const UnityXRMatrix4x4& transform, const UnityXRMatrix4x4& clipToWorld, float zNear,
+    float screenX, float screenY, Ray* rayOut)
+{
     const UnityXRVector3 screenPoint = {1.f - screenX * 2.f, 1.f - screenY * 2.f, .95f};
     UnityXRVector3 pointOnPlane = {};
     const UnityXRVector3 cameraPosition =
@@ -268,7 +307,6 @@ bool CameraProvider::TryGetRay(float screenX, float screenY, Ray* rayOut) const
         transform.columns[3].z
     };
 
-    auto clipToWorld = Mul(transform, m_InverseProjectionMatrix);
     if (!Mul(clipToWorld, screenPoint, &pointOnPlane))
         return false;
 
@@ -293,14 +331,50 @@ bool CameraProvider::TryGetRay(float screenX, float screenY, Ray* rayOut) const
 
     if (isPerspective)
     {
-        rayDirection = Mul(rayDirection, m_CameraParams.zNear / distToPlane);
+        rayDirection = Mul(rayDirection, zNear / distToPlane);
         rayOut->direction = Normalize(rayDirection);
         rayOut->origin = Add(cameraPosition, rayDirection);
     }
     else
     {
         rayOut->direction = cameraForward;
-        rayOut->origin = Sub(pointOnPlane, Mul(cameraForward, (distToPlane - m_CameraParams.zNear)));
+        rayOut->origin = Sub(pointOnPlane, Mul(cameraForward, (distToPlane - zNear)));
+    }
+
+    return true;
+}
+
+bool CameraProvider::TryGetRay(float screenX, float screenY, Ray* rayOut) const
+{
+    UnityXRMatrix4x4 inverseProjection;
+    float zNear;
+    if (!TryGetInverseProjection(&inverseProjection, &zNear))
+        return false;
+
+    UnityXRMatrix4x4 transform;
+    if (!InputProvider::TryGetTransform(&transform))
+        return false;
+
+    const auto clipToWorld = Mul(transform, inverseProjection);
+    return ScreenPointToRay(transform, clipToWorld, zNear, screenX, screenY, rayOut);
+}
+
+bool CameraProvider::TryGetRays(const UnityXRVector2* screenPoints, size_t count, Ray* raysOut, bool* isValidOut) const
+{
+    UnityXRMatrix4x4 inverseProjection;
+    float zNear;
+    if (!TryGetInverseProjection(&inverseProjection, &zNear))
+        return false;
+
+    UnityXRMatrix4x4 transform;
+    if (!InputProvider::TryGetTransform(&transform))
+        return false;
+
+    const auto clipToWorld = Mul(transform, inverseProjection);
+    for (size_t i = 0; i < count; ++i)
+    {
+        isValidOut[i] = ScreenPointToRay(
+            transform, clipToWorld, zNear, screenPoints[i].x, screenPoints[i].y, &raysOut[i]);
     }
 
     return true;
@@ -1,4 +1,8 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
 #include "IUnityXRCamera.h"
 #include "IUnityXRCamera.deprecated.h"
 #include "XRProvider.h"
@@ -14,6 +18,16 @@ public:
 
 	bool TryGetRay(float screenX, float screenY, Ray* rayOut) const;
 
+    // Generates the rays of many screen points from one camera state. Returns
+    // false if there is no camera; otherwise isValidOut tells which of raysOut
+    // were generated.
+    bool TryGetRays(const UnityXRVector2* screenPoints, size_t count, Ray* raysOut, bool* isValidOut) const;
+
+    bool TryGetProjection(UnityXRMatrix4x4* projectionOut, float* zNearOut, float* zFarOut) const;
+
+    // Incremented whenever the projection or camera parameters change.
+    uint64_t GetVersion() const { return m_Version.load(); }
+
 	void SetDisplayMatrix(
         const UnityXRMatrix4x4& displayMatrix,
 		bool hasValue);
@@ -40,6 +54,9 @@ private:
 	static void UNITY_INTERFACE_API StaticSetLightEstimationRequested(UnitySubsystemHandle handle, void* userData, bool requested);
 	static UnitySubsystemErrorCode UNITY_INTERFACE_API StaticGetShaderName(UnitySubsystemHandle handle, void* userData, char shaderName[kUnityXRStringSize]);
 
+    // Reads the inverse projection and near plane together, for rays.
+    bool TryGetInverseProjection(UnityXRMatrix4x4* inverseProjectionOut, float* zNearOut) const;
+
 	UnityXRCameraFrame m_LatestFrameData;
 
 	IUnityXRCameraInterface* m_CInterface = nullptr;
@@ -54,4 +71,10 @@ private:
 
     bool m_HasInverseProjectionMatrix = false;
 
+    std::atomic<uint64_t> m_Version{0};
+
+    // Guards the frame data and camera parameters, which are set on the main
+    // and render threads and read by raycasts and renders on worker threads.
+    mutable std::mutex m_Mutex;
+
 };
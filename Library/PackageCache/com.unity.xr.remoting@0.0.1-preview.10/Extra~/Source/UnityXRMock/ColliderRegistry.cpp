@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "ColliderRegistry.h"
+#include "MockTrackableTypes.h"
+#include "UnityMath.h"
+#include "WorkerPool.h"
+
+extern "C"
+{
+    UnityXRTrackableId UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_addSphereCollider(
+        UnityXRVector3 center, float radius)
+    {
+        if (ColliderRegistry::GetInstance())
+            return ColliderRegistry::GetInstance()->AddCapsule(center, center, radius);
+
+        return kInvalidId;
+    }
+
+    UnityXRTrackableId UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_addCapsuleCollider(
+        UnityXRVector3 start, UnityXRVector3 end, float radius)
+    {
+        if (ColliderRegistry::GetInstance())
+            return ColliderRegistry::GetInstance()->AddCapsule(start, end, radius);
+
+        return kInvalidId;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setSphereCollider(
+        UnityXRTrackableId id, UnityXRVector3 center, float radius)
+    {
+        if (ColliderRegistry::GetInstance())
+            return ColliderRegistry::GetInstance()->SetCapsule(id, center, center, radius);
+
+        return false;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setCapsuleCollider(
+        UnityXRTrackableId id, UnityXRVector3 start, UnityXRVector3 end, float radius)
+    {
+        if (ColliderRegistry::GetInstance())
+            return ColliderRegistry::GetInstance()->SetCapsule(id, start, end, radius);
+
+        return false;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_removeCollider(UnityXRTrackableId id)
+    {
+        if (ColliderRegistry::GetInstance())
+            return ColliderRegistry::GetInstance()->Remove(id);
+
+        return false;
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_clearColliders()
+    {
+        if (ColliderRegistry::GetInstance())
+            ColliderRegistry::GetInstance()->Clear();
+    }
+}
+
+UnityXRTrackableId ColliderRegistry::AddCapsule(const UnityXRVector3& start, const UnityXRVector3& end, float radius)
+{
+    if (!(radius > 0.f))
+        return kInvalidId;
+
+    const auto id = GenerateTrackableId();
+    if (id == kInvalidId)
+        return kInvalidId;
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    m_Indices[id] = m_Capsules.size();
+    m_Capsules.push_back(Capsule{id, start, end, radius});
+    m_CenterX.push_back(0.f);
+    m_CenterY.push_back(0.f);
+    m_CenterZ.push_back(0.f);
+    m_BoundingRadius.push_back(0.f);
+    SetBounds(m_Capsules.size() - 1);
+    ++m_Version;
+    return id;
+}
+
+bool ColliderRegistry::SetCapsule(
+    const UnityXRTrackableId& id, const UnityXRVector3& start, const UnityXRVector3& end, float radius)
+{
+    if (!(radius > 0.f))
+        return false;
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    const auto iter = m_Indices.find(id);
+    if (iter == m_Indices.end())
+        return false;
+
+    Capsule& capsule = m_Capsules[iter->second];
+    capsule.start = start;
+    capsule.end = end;
+    capsule.radius = radius;
+    SetBounds(iter->second);
+    ++m_Version;
+    return true;
+}
+
+bool ColliderRegistry::Remove(const UnityXRTrackableId& id)
+{
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    const auto iter = m_Indices.find(id);
+    if (iter == m_Indices.end())
+        return false;
+
+    // Move the last collider into the hole so the arrays stay packed.
+    const size_t index = iter->second;
+    const size_t last = m_Capsules.size() - 1;
+    m_Indices.erase(iter);
+    if (index != last)
+    {
+        m_Capsules[index] = m_Capsules[last];
+        m_CenterX[index] = m_CenterX[last];
+        m_CenterY[index] = m_CenterY[last];
+        m_CenterZ[index] = m_CenterZ[last];
+        m_BoundingRadius[index] = m_BoundingRadius[last];
+        m_Indices[m_Capsules[index].id] = index;
+    }
+
+    m_Capsules.pop_back();
+    m_CenterX.pop_back();
+    m_CenterY.pop_back();
+    m_CenterZ.pop_back();
+    m_BoundingRadius.pop_back();
+    ++m_Version;
+    return true;
+}
+
+void ColliderRegistry::Clear()
+{
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    m_Capsules.clear();
+    m_CenterX.clear();
+    m_CenterY.clear();
+    m_CenterZ.clear();
+    m_BoundingRadius.clear();
+    m_Indices.clear();
+    ++m_Version;
+}
+
+uint64_t ColliderRegistry::GetVersion() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    return m_Version;
+}
+
+void ColliderRegistry::SetBounds(size_t index)
+{
+    const Capsule& capsule = m_Capsules[index];
+    const auto center = Mul(Add(capsule.start, capsule.end), .5f);
+    m_CenterX[index] = center.x;
+    m_CenterY[index] = center.y;
+    m_CenterZ[index] = center.z;
+    m_BoundingRadius[index] = .5f * Length(Sub(capsule.end, capsule.start)) + capsule.radius;
+}
+
+// Distance along ray to where it enters the sphere, if it does so in front of its origin.
+static bool IntersectSphere(const Ray& ray, const UnityXRVector3& center, float radiusSquared, float* distanceOut)
+{
+    const auto fromCenter = Sub(ray.origin, center);
+    const float b = Dot(ray.direction, fromCenter);
+    const float c = Dot(fromCenter, fromCenter) - radiusSquared;
+    const float discriminant = b * b - c;
+    if (discriminant < 0.f)
+        return false;
+
+    *distanceOut = -b - std::sqrt(discriminant);
+    return *distanceOut >= 0.f;
+}
+
+bool ColliderRegistry::IntersectCapsule(
+    const Ray& ray, const UnityXRVector3& start, const UnityXRVector3& end, float radius, float* distanceOut)
+{
+    const auto axis = Sub(end, start);
+    const auto fromStart = Sub(ray.origin, start);
+    const float axisLengthSquared = Dot(axis, axis);
+    const float radiusSquared = radius * radius;
+
+    // A ray starting inside never enters.
+    if (LengthSquared(Sub(ray.origin, ClosestPointOnSegment(ray.origin, start, end))) <= radiusSquared)
+        return false;
+
+    // The capsule is the union of a cylinder and two spheres, so the ray
+    // enters it where it first enters any of them.
+    float nearest = std::numeric_limits<float>::max();
+    float distance;
+    if (IntersectSphere(ray, start, radiusSquared, &distance))
+        nearest = std::min(nearest, distance);
+
+    if (axisLengthSquared > 0.f)
+    {
+        if (IntersectSphere(ray, end, radiusSquared, &distance))
+            nearest = std::min(nearest, distance);
+
+        const float axisDotOrigin = Dot(axis, fromStart);
+        const float axisDotDirection = Dot(axis, ray.direction);
+        const float a = axisLengthSquared - axisDotDirection * axisDotDirection;
+        const float b = axisLengthSquared * Dot(ray.direction, fromStart) - axisDotOrigin * axisDotDirection;
+        const float c = axisLengthSquared * Dot(fromStart, fromStart) - axisDotOrigin * axisDotOrigin -
+            radiusSquared * axisLengthSquared;
+        const float discriminant = b * b - a * c;
+        if (a > 0.f && discriminant >= 0.f)
+        {
+            distance = (-b - std::sqrt(discriminant)) / a;
+            const float alongAxis = axisDotOrigin + distance * axisDotDirection;
+            if (distance >= 0.f && alongAxis > 0.f && alongAxis < axisLengthSquared)
+                nearest = std::min(nearest, distance);
+        }
+    }
+
+    if (nearest == std::numeric_limits<float>::max())
+        return false;
+
+    *distanceOut = nearest;
+    return true;
+}
+
+void ColliderRegistry::Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeCollider) == 0)
+        return;
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RaycastLocked(ray, 0.f, hitsOut);
+}
+
+void ColliderRegistry::SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeCollider) == 0)
+        return;
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RaycastLocked(ray, radius, hitsOut);
+}
+
+void ColliderRegistry::Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeCollider) == 0)
+        return;
+
+    // Workers only read the colliders, which stay locked until every range is done.
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RunParallelFor(count, kRaycastBatchGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            RaycastLocked(rays[i], 0.f, hitsOut[i]);
+    });
+}
+
+void ColliderRegistry::RaycastLocked(const Ray& ray, float sweepRadius, RaycastHitCollector& hitsOut) const
+{
+    const size_t count = m_Capsules.size();
+    if (count == 0)
+        return;
+
+    // Broad phase: a branchless pass over all bounding spheres, keeping those
+    // the ray passes through in front of its origin and within range.
+    static thread_local std::vector<uint8_t> s_IsCandidate;
+    s_IsCandidate.resize(count);
+
+    const float originX = ray.origin.x;
+    const float originY = ray.origin.y;
+    const float originZ = ray.origin.z;
+    const float directionX = ray.direction.x;
+    const float directionY = ray.direction.y;
+    const float directionZ = ray.direction.z;
+    const float maxDistance = hitsOut.GetMaxDistance();
+    const float* centerX = m_CenterX.data();
+    const float* centerY = m_CenterY.data();
+    const float* centerZ = m_CenterZ.data();
+    const float* boundingRadius = m_BoundingRadius.data();
+    uint8_t* isCandidate = s_IsCandidate.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float toCenterX = centerX[i] - originX;
+        const float toCenterY = centerY[i] - originY;
+        const float toCenterZ = centerZ[i] - originZ;
+        const float along = toCenterX * directionX + toCenterY * directionY + toCenterZ * directionZ;
+        const float distanceSquared = toCenterX * toCenterX + toCenterY * toCenterY + toCenterZ * toCenterZ;
+        const float radius = boundingRadius[i] + sweepRadius;
+        const float offRaySquared = distanceSquared - along * along;
+        isCandidate[i] = static_cast<uint8_t>(
+            (offRaySquared <= radius * radius) & (along + radius >= 0.f) & (along - radius <= maxDistance));
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!isCandidate[i])
+            continue;
+
+        const Capsule& capsule = m_Capsules[i];
+        float distance;
+        if (!IntersectCapsule(ray, capsule.start, capsule.end, capsule.radius + sweepRadius, &distance) ||
+            distance > hitsOut.GetMaxDistance())
+            continue;
+
+        // Face the hit pose out of the surface, away from the capsule's axis.
+        // A swept sphere touches it sweepRadius short of where its center is.
+        const auto center = Add(ray.origin, Mul(ray.direction, distance));
+        const auto normal = Normalize(Sub(center, ClosestPointOnSegment(center, capsule.start, capsule.end)));
+        const auto position = Sub(center, Mul(normal, sweepRadius));
+
+        UnityXRRaycastHit hit;
+        hit.trackableId = capsule.id;
+        hit.pose.position = position;
+        hit.pose.rotation = RotationFromUp(normal);
+        hit.distance = distance;
+        SetMockHitType(hit, kUnityXRMockTrackableTypeCollider);
+        hitsOut.Add(hit);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+#include "TrackableIdHelpers.h"
+#include "Singleton.h"
+#include "Ray.h"
+#include "RaycastHitCollector.h"
+
+// Spheres and capsules registered by the game, hit by raycasts together with
+// the tracked geometry. Bounding spheres are kept as separate arrays of
+// components, so the broad phase tests a ray against every collider in one
+// loop the compiler can vectorize; only the colliders it keeps get the exact
+// capsule test.
+class ColliderRegistry : public Singleton<ColliderRegistry>
+{
+public:
+
+    // A sphere is a capsule whose ends are the same point.
+    UnityXRTrackableId AddCapsule(const UnityXRVector3& start, const UnityXRVector3& end, float radius);
+
+    bool SetCapsule(const UnityXRTrackableId& id, const UnityXRVector3& start, const UnityXRVector3& end, float radius);
+
+    bool Remove(const UnityXRTrackableId& id);
+
+    void Clear();
+
+    // Incremented whenever a collider is added, moved or removed.
+    uint64_t GetVersion() const;
+
+    // Adds the nearest hit on each collider along ray.
+    void Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Raycasts all rays under one lock, adding the hits of rays[i] to hitsOut[i].
+    void Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const;
+
+    // Like Raycast, for a sphere of the given radius moving along ray.
+    // Colliders it overlaps at the origin are not hit.
+    void SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Distance along ray, which has a unit direction, to where it enters the
+    // capsule. False if it misses, or starts inside.
+    static bool IntersectCapsule(
+        const Ray& ray, const UnityXRVector3& start, const UnityXRVector3& end, float radius, float* distanceOut);
+
+private:
+
+    struct Capsule
+    {
+        UnityXRTrackableId id;
+        UnityXRVector3 start;
+        UnityXRVector3 end;
+        float radius;
+    };
+
+    void SetBounds(size_t index);
+
+    // Casts a sphere of sweepRadius, 0 for a ray.
+    void RaycastLocked(const Ray& ray, float sweepRadius, RaycastHitCollector& hitsOut) const;
+
+    std::vector<Capsule> m_Capsules;
+
+    // Bounding spheres, indexed like m_Capsules.
+    std::vector<float> m_CenterX;
+
+    std::vector<float> m_CenterY;
+
+    std::vector<float> m_CenterZ;
+
+    std::vector<float> m_BoundingRadius;
+
+    std::unordered_map<UnityXRTrackableId, size_t> m_Indices;
+
+    uint64_t m_Version = 0;
+
+    mutable std::shared_timed_mutex m_Mutex;
+};
@@ -1,12 +1,45 @@
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include "DepthProvider.h"
+#include "InputProvider.h"
+#include "TrackableIdHelpers.h"
 #include "UnityMath.h"
+#include "WorkerPool.h"
 
 static const float kAngleThresholdInDegrees = 5.f;
 
 static const float kCosHalfAngleThreshold =
     std::cos(kAngleThresholdInDegrees * 3.1415926f / 180.f * .5f);
 
+static const size_t kDepthImageRowsPerJob = 16;
+
+// Clouds are only split for a single ray if each thread gets at least this many points.
+static const size_t kMinPointsPerRaycastJob = 16384;
+
+// Pixels a raycast into the depth image visits before settling on one.
+static const int kMaxDepthImageRaycastSteps = 4;
+
+static UnityXRMatrix4x4 GetCameraToWorld()
+{
+    UnityXRMatrix4x4 cameraToWorld;
+    if (!InputProvider::TryGetTransform(&cameraToWorld))
+        cameraToWorld = Identity();
+
+    return cameraToWorld;
+}
+
+// Assumes cameraToWorld is a rigid transform.
+static inline UnityXRVector3 RotateToCamera(const UnityXRMatrix4x4& cameraToWorld, const UnityXRVector3& v)
+{
+    return UnityXRVector3
+    {
+        cameraToWorld.columns[0].x * v.x + cameraToWorld.columns[0].y * v.y + cameraToWorld.columns[0].z * v.z,
+        cameraToWorld.columns[1].x * v.x + cameraToWorld.columns[1].y * v.y + cameraToWorld.columns[1].z * v.z,
+        cameraToWorld.columns[2].x * v.x + cameraToWorld.columns[2].y * v.y + cameraToWorld.columns[2].z * v.z
+    };
+}
+
 extern "C"
 {
     void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setDepthData(
@@ -15,6 +48,55 @@ extern "C"
         if (DepthProvider::GetInstance())
             DepthProvider::GetInstance()->SetDepthData(positions, confidences, count);
     }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setDepthImage(
+        const void* data, int width, int height, int format,
+        float focalLengthX, float focalLengthY, float principalPointX, float principalPointY,
+        int stride)
+    {
+        DepthProvider* depthProvider = DepthProvider::GetInstance();
+        if (depthProvider == nullptr)
+            return;
+
+        if (data == nullptr || width <= 0 || height <= 0 || focalLengthX == 0.f || focalLengthY == 0.f)
+        {
+            depthProvider->ClearPoints();
+            return;
+        }
+
+        // Anything else would be read as the wrong number of bytes per pixel.
+        if (format != kDepthImageFormatUInt16Millimeters && format != kDepthImageFormatFloat32Meters)
+            return;
+
+        const DepthImageIntrinsics intrinsics = { focalLengthX, focalLengthY, principalPointX, principalPointY };
+        depthProvider->SetDepthImage(
+            data, width, height, static_cast<DepthImageFormat>(format), intrinsics, stride < 1 ? 1 : stride);
+    }
+
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_beginDepthFrame(int expectedCount)
+    {
+        if (DepthProvider::GetInstance())
+            return DepthProvider::GetInstance()->BeginDepthFrame(expectedCount);
+
+        return 0;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_appendDepthPoints(
+        int frameId, const UnityXRVector3* positions, const float* confidences, int count)
+    {
+        if (DepthProvider::GetInstance())
+            return DepthProvider::GetInstance()->AppendDepthPoints(frameId, positions, confidences, count);
+
+        return false;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_commitDepthFrame(int frameId)
+    {
+        if (DepthProvider::GetInstance())
+            return DepthProvider::GetInstance()->CommitDepthFrame(frameId);
+
+        return false;
+    }
 }
 
 struct DepthDataAllocatorWrapper : public IUnityXRDepthDataAllocator
@@ -45,24 +127,86 @@ private:
     IUnityXRDepthInterface* m_UnityInterface;
 };
 
+DepthProvider::~DepthProvider()
+{
+    // A back-projection job may still be running on a worker thread.
+    std::unique_lock<std::mutex> lock(m_PendingMutex);
+    m_HasPendingImage = false;
+    m_BackProjectionDone.wait(lock, [this] { return !m_IsBackProjecting; });
+}
+
 void DepthProvider::ClearPoints()
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    DiscardDepthImage();
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
     m_Positions.clear();
+    m_Confidences.clear();
+    ++m_CloudFrame;
+    ++m_Version;
 }
 
 void DepthProvider::AddDepthPoint(float x, float y, float z)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    const UnityXRMatrix4x4 cameraToWorld = GetCameraToWorld();
+
+    // A cloud built up point by point is seen from where its first point was.
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    if (m_Positions.empty())
+        m_CloudCameraToWorld = cameraToWorld;
+
     m_Positions.push_back(UnityXRVector3{x, y, z});
+    ++m_Version;
+}
+
+size_t DepthProvider::GetNumPoints() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    return m_Positions.size();
+}
+
+uint64_t DepthProvider::CopyPositions(std::vector<UnityXRVector3>& positionsOut) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    positionsOut = m_Positions;
+    return m_Version.load();
+}
+
+uint64_t DepthProvider::CopyNewPositions(
+    DepthCloudCursor& cursor, std::vector<UnityXRVector3>& positionsOut, UnityXRMatrix4x4* cameraToWorldOut) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    const size_t begin = cursor.frame == m_CloudFrame ? std::min(cursor.numPoints, m_Positions.size()) : 0;
+    positionsOut.assign(m_Positions.begin() + begin, m_Positions.end());
+    *cameraToWorldOut = m_CloudCameraToWorld;
+
+    cursor.frame = m_CloudFrame;
+    cursor.numPoints = m_Positions.size();
+    return m_Version.load();
+}
+
+DepthCloudCursor DepthProvider::GetEndCursor() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    DepthCloudCursor cursor;
+    cursor.frame = m_CloudFrame;
+    cursor.numPoints = m_Positions.size();
+    return cursor;
 }
 
 void DepthProvider::SetDepthData(const UnityXRVector3* positions, const float* confidences, int count)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    DiscardDepthImage();
+
+    const UnityXRMatrix4x4 cameraToWorld = GetCameraToWorld();
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
 
     m_Positions.clear();
     m_Confidences.clear();
+    m_CloudCameraToWorld = cameraToWorld;
+    ++m_CloudFrame;
+    ++m_Version;
 
     if (positions == nullptr)
         return;
@@ -77,19 +221,496 @@ void DepthProvider::SetDepthData(const UnityXRVector3* positions, const float* c
     }
 }
 
-std::vector<UnityXRRaycastHit> DepthProvider::Raycast(const Ray& ray, UnityXRTrackableType hitFlags) const
+int DepthProvider::BeginDepthFrame(int expectedCount)
 {
-    std::vector<UnityXRRaycastHit> hits;
+    if (expectedCount < 0)
+        return 0;
 
+    auto frame = std::make_shared<DepthFrame>();
+
+    std::lock_guard<std::mutex> lock(m_FrameMutex);
+
+    // Writers still appending to an abandoned frame keep it alive until they
+    // are done; it is never committed.
+    frame->id = m_NextFrameId;
+    m_NextFrameId = m_NextFrameId == INT_MAX ? 1 : m_NextFrameId + 1;
+
+    frame->cameraToWorld = GetCameraToWorld();
+    std::swap(frame->positions, m_SparePositions);
+    std::swap(frame->confidences, m_SpareConfidences);
+    frame->positions.resize(expectedCount);
+    frame->confidences.resize(expectedCount);
+
+    m_Frame = std::move(frame);
+    return m_Frame->id;
+}
+
+bool DepthProvider::AppendDepthPoints(int frameId, const UnityXRVector3* positions, const float* confidences, int count)
+{
+    if (positions == nullptr || count < 0)
+        return false;
+
+    std::shared_ptr<DepthFrame> frame;
+    {
+        std::lock_guard<std::mutex> lock(m_FrameMutex);
+        if (!m_Frame || m_Frame->id != frameId)
+            return false;
+
+        // Registered under the lock, so a commit either waits for this writer
+        // or has already taken the frame and made the check above fail.
+        frame = m_Frame;
+        ++frame->numWriters;
+    }
+
+    if (confidences)
+        frame->hasConfidences = true;
+
+    const size_t capacity = frame->positions.size();
+    const size_t begin = frame->cursor.fetch_add(count);
+    const size_t numInPlace = begin < capacity ? std::min<size_t>(capacity - begin, count) : 0;
+
+    if (numInPlace > 0)
+    {
+        std::copy(positions, positions + numInPlace, frame->positions.data() + begin);
+        if (confidences)
+            std::copy(confidences, confidences + numInPlace, frame->confidences.data() + begin);
+        else
+            std::fill_n(frame->confidences.data() + begin, numInPlace, 1.f);
+    }
+
+    if (numInPlace < static_cast<size_t>(count))
+    {
+        std::lock_guard<std::mutex> lock(frame->spillMutex);
+        frame->spillPositions.insert(frame->spillPositions.end(), positions + numInPlace, positions + count);
+        if (confidences)
+            frame->spillConfidences.insert(frame->spillConfidences.end(), confidences + numInPlace, confidences + count);
+        else
+            frame->spillConfidences.insert(frame->spillConfidences.end(), count - numInPlace, 1.f);
+    }
+
+    if (--frame->numWriters == 0)
+    {
+        std::lock_guard<std::mutex> lock(frame->spillMutex);
+        frame->writersDone.notify_all();
+    }
+
+    return true;
+}
+
+bool DepthProvider::CommitDepthFrame(int frameId)
+{
+    std::shared_ptr<DepthFrame> frame;
+    {
+        std::lock_guard<std::mutex> lock(m_FrameMutex);
+        if (!m_Frame || m_Frame->id != frameId)
+            return false;
+
+        frame = std::move(m_Frame);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(frame->spillMutex);
+        frame->writersDone.wait(lock, [&frame] { return frame->numWriters.load() == 0; });
+    }
+
+    // Slots reserved past the expected count went to the spill buffers.
+    const size_t numInPlace = std::min(frame->cursor.load(), frame->positions.size());
+    frame->positions.resize(numInPlace);
+    frame->positions.insert(frame->positions.end(), frame->spillPositions.begin(), frame->spillPositions.end());
+    frame->confidences.resize(numInPlace);
+    if (frame->hasConfidences)
+        frame->confidences.insert(frame->confidences.end(), frame->spillConfidences.begin(), frame->spillConfidences.end());
+    else
+        frame->confidences.clear();
+
+    DiscardDepthImage();
+
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+        std::swap(m_Positions, frame->positions);
+        std::swap(m_Confidences, frame->confidences);
+        m_CloudCameraToWorld = frame->cameraToWorld;
+        ++m_CloudFrame;
+        ++m_Version;
+    }
+
+    std::lock_guard<std::mutex> lock(m_FrameMutex);
+    m_SparePositions = std::move(frame->positions);
+    m_SpareConfidences = std::move(frame->confidences);
+    return true;
+}
+
+void DepthProvider::DiscardDepthImage()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        m_HasPendingImage = false;
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+    ++m_DepthImageGeneration;
+    m_HasDepthImage = false;
+}
+
+void DepthProvider::SetDepthImage(
+    const void* data, int width, int height, DepthImageFormat format,
+    const DepthImageIntrinsics& intrinsics, int stride)
+{
+    const size_t bytesPerPixel = format == kDepthImageFormatUInt16Millimeters ? sizeof(uint16_t) : sizeof(float);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    const UnityXRMatrix4x4 cameraToWorld = GetCameraToWorld();
+
+    bool scheduleBackProjection = false;
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+
+        // Reuses the buffer of the image processed before the last one.
+        m_PendingImage.data.assign(bytes, bytes + static_cast<size_t>(width) * height * bytesPerPixel);
+        m_PendingImage.width = width;
+        m_PendingImage.height = height;
+        m_PendingImage.format = format;
+        m_PendingImage.intrinsics = intrinsics;
+        m_PendingImage.stride = stride;
+        m_PendingImage.cameraToWorld = cameraToWorld;
+        {
+            std::shared_lock<std::shared_timed_mutex> imageLock(m_Mutex);
+            m_PendingImage.generation = m_DepthImageGeneration;
+        }
+        m_HasPendingImage = true;
+
+        if (!m_IsBackProjecting)
+        {
+            m_IsBackProjecting = true;
+            scheduleBackProjection = true;
+        }
+    }
+
+    // Without a worker pool this runs inline, so no lock may be held here.
+    if (scheduleBackProjection)
+        RunAsync([this] { ProcessPendingDepthImages(); });
+}
+
+void DepthProvider::ProcessPendingDepthImages()
+{
+    PendingDepthImage pending;
+    DepthImage image;
+    std::vector<UnityXRVector3> positions;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_PendingMutex);
+            if (!m_HasPendingImage)
+            {
+                m_IsBackProjecting = false;
+                m_BackProjectionDone.notify_all();
+                return;
+            }
+
+            std::swap(pending, m_PendingImage);
+            m_HasPendingImage = false;
+        }
+
+        BackProject(pending, image, positions);
+
+        std::lock_guard<std::shared_timed_mutex> lock(m_Mutex);
+
+        // Sparse data set while this image was in flight wins.
+        if (pending.generation != m_DepthImageGeneration)
+            continue;
+
+        std::swap(m_DepthImage, image);
+        std::swap(m_Positions, positions);
+        m_Confidences.clear();
+        m_CloudCameraToWorld = m_DepthImage.cameraToWorld;
+        ++m_CloudFrame;
+        m_HasDepthImage = true;
+        ++m_Version;
+    }
+}
+
+void DepthProvider::BackProject(
+    const PendingDepthImage& pending, DepthImage& imageOut, std::vector<UnityXRVector3>& positionsOut) const
+{
+    const int width = pending.width;
+    const int height = pending.height;
+    const int stride = pending.stride;
+    const DepthImageIntrinsics& intrinsics = pending.intrinsics;
+    const UnityXRMatrix4x4& m = pending.cameraToWorld;
+
+    imageOut.width = width;
+    imageOut.height = height;
+    imageOut.intrinsics = intrinsics;
+    imageOut.cameraToWorld = m;
+    imageOut.depths.resize(static_cast<size_t>(width) * height);
+
+    const int numColumns = (width + stride - 1) / stride;
+    const int numRows = (height + stride - 1) / stride;
+
+    // The x scale only depends on the column, so it is shared by every row.
+    std::vector<float> columnScales(numColumns);
+    for (int column = 0; column < numColumns; ++column)
+        columnScales[column] = (column * stride - intrinsics.principalPointX) / intrinsics.focalLengthX;
+
+    positionsOut.resize(static_cast<size_t>(numRows) * numColumns);
+    std::vector<int> numValidPerRow(numRows);
+
+    RunParallelFor(height, kDepthImageRowsPerJob, [&](size_t begin, size_t end)
+    {
+        for (size_t y = begin; y < end; ++y)
+        {
+            float* depthRow = &imageOut.depths[y * width];
+            if (pending.format == kDepthImageFormatUInt16Millimeters)
+            {
+                const uint16_t* millimeters = reinterpret_cast<const uint16_t*>(pending.data.data()) + y * width;
+                for (int x = 0; x < width; ++x)
+                    depthRow[x] = millimeters[x] * .001f;
+            }
+            else
+            {
+                std::memcpy(depthRow, pending.data.data() + y * width * sizeof(float), width * sizeof(float));
+            }
+
+            if (y % stride != 0)
+                continue;
+
+            const size_t row = y / stride;
+            const float rowScale = -(static_cast<float>(y) - intrinsics.principalPointY) / intrinsics.focalLengthY;
+            UnityXRVector3* rowOut = &positionsOut[row * numColumns];
+
+            // Transform every sample first; this loop has no branches and
+            // vectorizes. Invalid depths (zero or NaN) are compacted away below.
+            for (int column = 0; column < numColumns; ++column)
+            {
+                const float depth = depthRow[column * stride];
+                const float cx = columnScales[column] * depth;
+                const float cy = rowScale * depth;
+                rowOut[column].x = m.columns[0].x * cx + m.columns[1].x * cy + m.columns[2].x * depth + m.columns[3].x;
+                rowOut[column].y = m.columns[0].y * cx + m.columns[1].y * cy + m.columns[2].y * depth + m.columns[3].y;
+                rowOut[column].z = m.columns[0].z * cx + m.columns[1].z * cy + m.columns[2].z * depth + m.columns[3].z;
+            }
+
+            int numValid = 0;
+            for (int column = 0; column < numColumns; ++column)
+            {
+                rowOut[numValid] = rowOut[column];
+                numValid += depthRow[column * stride] > 0.f ? 1 : 0;
+            }
+
+            numValidPerRow[row] = numValid;
+        }
+    });
+
+    size_t numPositions = 0;
+    for (int row = 0; row < numRows; ++row)
+    {
+        const UnityXRVector3* rowBegin = &positionsOut[static_cast<size_t>(row) * numColumns];
+        std::copy(rowBegin, rowBegin + numValidPerRow[row], &positionsOut[numPositions]);
+        numPositions += numValidPerRow[row];
+    }
+
+    positionsOut.resize(numPositions);
+}
+
+void DepthProvider::RaycastScreenPoint(
+    float screenX, float screenY, const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRTrackableTypePoint) == kUnityXRTrackableTypeNone)
+        return;
+
+    const UnityXRVector2 screenPoint = {screenX, screenY};
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RaycastLocked(&screenPoint, ray, hitsOut, true);
+}
+
+void DepthProvider::Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRTrackableTypePoint) == kUnityXRTrackableTypeNone)
+        return;
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RaycastLocked(nullptr, ray, hitsOut, true);
+}
+
+void DepthProvider::Raycast(
+    const UnityXRVector2* screenPoints, const Ray* rays, size_t count,
+    uint32_t hitFlags, RaycastHitCollector* hitsOut) const
+{
+    if ((hitFlags & kUnityXRTrackableTypePoint) == kUnityXRTrackableTypeNone)
+        return;
+
+    // Workers only read the point cloud, which stays locked until every range is done.
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    RunParallelFor(count, kRaycastBatchGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            RaycastLocked(screenPoints ? &screenPoints[i] : nullptr, rays[i], hitsOut[i], false);
+    });
+}
+
+void DepthProvider::RaycastLocked(
+    const UnityXRVector2* screenPoint, const Ray& ray, RaycastHitCollector& hitsOut, bool splitSearch) const
+{
+    if (screenPoint != nullptr && m_HasDepthImage && TryRaycastDepthImageLocked(ray, hitsOut))
+        return;
+
+    SearchPointsLocked(hitsOut, splitSearch, [&](size_t begin, size_t end, RaycastHitCollector& jobHitsOut)
+    {
+        RaycastPoints(ray, begin, end, jobHitsOut);
+    });
+}
+
+bool DepthProvider::TryRaycastDepthImageLocked(const Ray& ray, RaycastHitCollector& hitsOut) const
+{
+    const DepthImage& image = m_DepthImage;
+    const DepthImageIntrinsics& intrinsics = image.intrinsics;
+    const UnityXRMatrix4x4& m = image.cameraToWorld;
+    const UnityXRVector3 cameraPosition = { m.columns[3].x, m.columns[3].y, m.columns[3].z };
+    const UnityXRVector3 origin = RotateToCamera(m, Sub(ray.origin, cameraPosition));
+    const UnityXRVector3 direction = RotateToCamera(m, ray.direction);
+
+    // Starts at the pixel the ray vanishes at, which is exact for a ray cast
+    // from where the image was taken, then moves to the pixel of the point on
+    // the ray nearest the sample until it settles.
+    UnityXRVector3 target = direction;
+    UnityXRVector3 sample = {};
+    int x = -1;
+    int y = -1;
+    for (int step = 0; step < kMaxDepthImageRaycastSteps; ++step)
+    {
+        if (!(target.z > 0.f))
+            return false;
+
+        // Pixel centers are at whole coordinates, and rows go down.
+        const float column = intrinsics.principalPointX + intrinsics.focalLengthX * target.x / target.z + .5f;
+        const float row = intrinsics.principalPointY - intrinsics.focalLengthY * target.y / target.z + .5f;
+        if (!(column >= 0.f && column < image.width && row >= 0.f && row < image.height))
+            return false;
+
+        if (static_cast<int>(column) == x && static_cast<int>(row) == y)
+            break;
+
+        x = static_cast<int>(column);
+        y = static_cast<int>(row);
+        const float depth = image.depths[static_cast<size_t>(y) * image.width + x];
+        if (!(depth > 0.f))
+            return false;
+
+        sample.x = (x - intrinsics.principalPointX) / intrinsics.focalLengthX * depth;
+        sample.y = -(y - intrinsics.principalPointY) / intrinsics.focalLengthY * depth;
+        sample.z = depth;
+        target = Add(origin, Mul(direction, std::max(Dot(Sub(sample, origin), direction), 0.f)));
+    }
+
+    // The sample must lie within the cone a point cloud raycast accepts.
+    const UnityXRVector3 toSample = Sub(sample, origin);
+    const float distance = Length(toSample);
+    if (!(Dot(toSample, direction) >= kCosHalfAngleThreshold * distance))
+        return false;
+
+    if (distance > hitsOut.GetMaxDistance())
+        return true;
+
+    UnityXRRaycastHit hit;
+    if (!Mul(m, sample, &hit.pose.position))
+        return false;
+
+    hit.pose.rotation = UnityXRVector4{0, 0, 0, 1};
+    hit.distance = distance;
+    hit.hitType = kUnityXRTrackableTypePoint;
+    hit.trackableId = kInvalidId;
+    hitsOut.Add(hit);
+    return true;
+}
+
+void DepthProvider::SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
     if ((hitFlags & kUnityXRTrackableTypePoint) == kUnityXRTrackableTypeNone)
-        return hits;
+        return;
 
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
+    SearchPointsLocked(hitsOut, true, [&](size_t begin, size_t end, RaycastHitCollector& jobHitsOut)
+    {
+        SphereCastPoints(ray, radius, begin, end, jobHitsOut);
+    });
+}
+
+template<typename Search>
+void DepthProvider::SearchPointsLocked(RaycastHitCollector& hitsOut, bool splitSearch, const Search& search) const
+{
+    const size_t numPoints = m_Positions.size();
+    const size_t numJobs = splitSearch ? std::min(GetParallelism(), numPoints / kMinPointsPerRaycastJob) : 1;
+    if (numJobs <= 1)
+    {
+        search(0, numPoints, hitsOut);
+        return;
+    }
 
-    for (const auto& position : m_Positions)
+    // Each job keeps its own nearest hits, merged once all are done. Workers
+    // reach the collectors through the pointer, not this thread's thread_local.
+    static thread_local std::vector<RaycastHitCollector> s_JobHits;
+    if (s_JobHits.size() < numJobs)
+        s_JobHits.resize(numJobs);
+
+    RaycastHitCollector* jobHits = s_JobHits.data();
+    for (size_t i = 0; i < numJobs; ++i)
+        jobHits[i].Reset(hitsOut.GetMaxHits(), hitsOut.GetMaxDistance());
+
+    RunParallelFor(numJobs, 1, [&](size_t begin, size_t end)
     {
+        for (size_t i = begin; i < end; ++i)
+        {
+            search(numPoints * i / numJobs, numPoints * (i + 1) / numJobs, jobHits[i]);
+            jobHits[i].Sort();
+        }
+    });
+
+    hitsOut.AddSorted(jobHits, numJobs);
+}
+
+void DepthProvider::SphereCastPoints(
+    const Ray& ray, float radius, size_t begin, size_t end, RaycastHitCollector& hitsOut) const
+{
+    const float radiusSquared = radius * radius;
+    for (size_t i = begin; i < end; ++i)
+    {
+        // Where the ray enters the sphere of the given radius around the point.
+        const auto& position = m_Positions[i];
+        const auto toPoint = Sub(position, ray.origin);
+        const float along = Dot(toPoint, ray.direction);
+        const float c = Dot(toPoint, toPoint) - radiusSquared;
+        if (c <= 0.f || along <= 0.f)
+            continue;
+
+        const float discriminant = along * along - c;
+        if (discriminant < 0.f)
+            continue;
+
+        const float distance = along - std::sqrt(discriminant);
+        if (distance > hitsOut.GetMaxDistance())
+            continue;
+
+        UnityXRRaycastHit hit;
+        hit.pose.position = position;
+        hit.pose.rotation = UnityXRVector4{0, 0, 0, 1};
+        hit.distance = distance;
+        hit.hitType = kUnityXRTrackableTypePoint;
+        hit.trackableId = kInvalidId;
+        hitsOut.Add(hit);
+    }
+}
+
+void DepthProvider::RaycastPoints(const Ray& ray, size_t begin, size_t end, RaycastHitCollector& hitsOut) const
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        const auto& position = m_Positions[i];
         const auto toPoint = Sub(position, ray.origin);
         const float length = Length(toPoint);
+        if (length > hitsOut.GetMaxDistance())
+            continue;
+
         const float cosAngle = Dot(toPoint, ray.direction) / length;
         if (kCosHalfAngleThreshold <= cosAngle)
         {
@@ -98,16 +719,15 @@ std::vector<UnityXRRaycastHit> DepthProvider::Raycast(const Ray& ray, UnityXRTra
             hit.pose.rotation = UnityXRVector4{0, 0, 0, 1};
             hit.distance = length;
             hit.hitType = kUnityXRTrackableTypePoint;
-            hits.push_back(hit);
+            hit.trackableId = kInvalidId;
+            hitsOut.Add(hit);
         }
     }
-
-    return hits;
 }
 
 bool UNITY_INTERFACE_API DepthProvider::GetPointCloud(IUnityXRDepthDataAllocator& allocator)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    std::shared_lock<std::shared_timed_mutex> lock(m_Mutex);
 
     allocator.SetNumberOfPoints(m_Positions.size());
     std::copy(m_Positions.begin(), m_Positions.end(), allocator.GetPointsBuffer());
@@ -1,40 +1,239 @@
 #pragma once
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <atomic>
+#include <memory>
 
 #include "IUnityXRDepth.deprecated.h"
 #include "IUnityXRRaycast.h"
 #include "XRProvider.h"
 #include "Ray.h"
+#include "RaycastHitCollector.h"
+
+enum DepthImageFormat
+{
+    kDepthImageFormatUInt16Millimeters = 0,
+    kDepthImageFormatFloat32Meters = 1
+};
+
+// Pinhole intrinsics of a depth image, in pixels. Pixel (0, 0) is the top left.
+struct DepthImageIntrinsics
+{
+    float focalLengthX;
+    float focalLengthY;
+    float principalPointX;
+    float principalPointY;
+};
+
+// A position in the stream of point clouds: the frame, which changes whenever
+// the cloud is replaced rather than added to, and how many of its points have
+// been seen.
+struct DepthCloudCursor
+{
+    uint64_t frame = 0;
+    size_t numPoints = 0;
+};
 
 class DepthProvider : public XRProvider<DepthProvider, IUnityXRDepthProvider>
 {
 public:
 
+    ~DepthProvider();
+
     UnitySubsystemErrorCode RegisterAsCProvider(
         UnitySubsystemHandle handle, IUnityXRDepthInterface* depthInterface);
 
     void SetDepthData(
         const UnityXRVector3* positions, const float* confidences, int count);
 
+    // Copies a dense depth image taken from the current camera pose. It is
+    // back-projected into the point cloud on a worker thread, keeping every
+    // stride-th pixel in each direction.
+    void SetDepthImage(
+        const void* data, int width, int height, DepthImageFormat format,
+        const DepthImageIntrinsics& intrinsics, int stride);
+
+    // Streams a point cloud in chunks. BeginDepthFrame returns a frame id, or 0
+    // on failure, and preallocates room for expectedCount points. Chunks may be
+    // appended from any thread; points past expectedCount are still kept but
+    // take a slower path. CommitDepthFrame replaces the point cloud with
+    // everything appended so far. Beginning a new frame abandons an open one.
+    int BeginDepthFrame(int expectedCount);
+
+    bool AppendDepthPoints(int frameId, const UnityXRVector3* positions, const float* confidences, int count);
+
+    bool CommitDepthFrame(int frameId);
+
     void ClearPoints();
 
     void AddDepthPoint(float x, float y, float z);
 
-    std::vector<UnityXRRaycastHit> Raycast(const Ray& ray, UnityXRTrackableType hitFlags) const;
+    // Incremented whenever the point cloud changes.
+    uint64_t GetVersion() const { return m_Version.load(); }
+
+    size_t GetNumPoints() const;
+
+    // Copies the current point cloud and returns its version.
+    uint64_t CopyPositions(std::vector<UnityXRVector3>& positionsOut) const;
+
+    // Copies the points added since cursor, moving it past them, and the
+    // camera pose of the frame they belong to. Every point is copied again
+    // once the cloud is replaced. Returns the version copied.
+    uint64_t CopyNewPositions(
+        DepthCloudCursor& cursor, std::vector<UnityXRVector3>& positionsOut, UnityXRMatrix4x4* cameraToWorldOut) const;
+
+    // A cursor past every point of the current cloud.
+    DepthCloudCursor GetEndCursor() const;
+
+    void Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Samples the latest depth image where ray lands in it if there is one,
+    // otherwise falls back to the cone search along ray.
+    void RaycastScreenPoint(
+        float screenX, float screenY, const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Raycasts all rays under one lock, adding the hits of rays[i] to
+    // hitsOut[i]. screenPoints, if not null, are the screen points the rays
+    // were generated from, as for RaycastScreenPoint.
+    void Raycast(
+        const UnityXRVector2* screenPoints, const Ray* rays, size_t count,
+        uint32_t hitFlags, RaycastHitCollector* hitsOut) const;
+
+    // Adds a hit for each point a sphere of the given radius moving along ray
+    // touches, unless the sphere overlaps it at the origin.
+    void SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
 
 private:
 
+    struct PendingDepthImage
+    {
+        std::vector<uint8_t> data;
+        int width = 0;
+        int height = 0;
+        DepthImageFormat format = kDepthImageFormatFloat32Meters;
+        DepthImageIntrinsics intrinsics = {};
+        int stride = 1;
+        UnityXRMatrix4x4 cameraToWorld;
+        uint64_t generation = 0;
+    };
+
+    struct DepthImage
+    {
+        std::vector<float> depths;
+        int width = 0;
+        int height = 0;
+        DepthImageIntrinsics intrinsics = {};
+        UnityXRMatrix4x4 cameraToWorld;
+    };
+
+    struct DepthFrame
+    {
+        int id = 0;
+
+        // Sized to the expected count up front so that appends never reallocate.
+        std::vector<UnityXRVector3> positions;
+        std::vector<float> confidences;
+
+        // Where the camera was when the frame began.
+        UnityXRMatrix4x4 cameraToWorld;
+
+        // Next free slot in positions. May run past its size.
+        std::atomic<size_t> cursor{0};
+
+        std::atomic<int> numWriters{0};
+
+        // Confidences are dropped on commit if no chunk supplied any.
+        std::atomic<bool> hasConfidences{false};
+
+        // Points that did not fit in positions, and the wait for numWriters.
+        std::mutex spillMutex;
+        std::condition_variable writersDone;
+        std::vector<UnityXRVector3> spillPositions;
+        std::vector<float> spillConfidences;
+    };
+
     static UnitySubsystemErrorCode UNITY_INTERFACE_API StaticGetPointCloud(
         UnitySubsystemHandle handle, void* userData, const UnityXRDepthDataAllocator * allocator);
 
     bool UNITY_INTERFACE_API GetPointCloud(IUnityXRDepthDataAllocator& allocator);
 
+    void ProcessPendingDepthImages();
+
+    void BackProject(const PendingDepthImage& pending, DepthImage& imageOut, std::vector<UnityXRVector3>& positionsOut) const;
+
+    void DiscardDepthImage();
+
+    // Samples the depth image if there is one and screenPoint is not null.
+    // Otherwise, or if the image has no sample along ray, searches the point
+    // cloud in a cone around ray. The search of a large cloud is split across
+    // the WorkerPool if splitSearch is set.
+    void RaycastLocked(
+        const UnityXRVector2* screenPoint, const Ray& ray, RaycastHitCollector& hitsOut, bool splitSearch) const;
+
+    // Projects ray into the depth image and adds the sample it lands on, if
+    // no farther than hitsOut allows. Returns false if the ray leaves the
+    // image, lands on no depth, or misses the sample by more than the point
+    // cloud cone.
+    bool TryRaycastDepthImageLocked(const Ray& ray, RaycastHitCollector& hitsOut) const;
+
+    // Runs search(begin, end, hitsOut) over ranges of m_Positions, split
+    // across the WorkerPool for a large cloud if splitSearch is set.
+    template<typename Search>
+    void SearchPointsLocked(RaycastHitCollector& hitsOut, bool splitSearch, const Search& search) const;
+
+    void RaycastPoints(const Ray& ray, size_t begin, size_t end, RaycastHitCollector& hitsOut) const;
+
+    void SphereCastPoints(const Ray& ray, float radius, size_t begin, size_t end, RaycastHitCollector& hitsOut) const;
+
     std::vector<UnityXRVector3> m_Positions;
 
     std::vector<float> m_Confidences;
 
-    mutable std::mutex m_Mutex;
+    // Bumped whenever m_Positions is replaced rather than added to, along
+    // with the camera pose the new cloud was captured from.
+    uint64_t m_CloudFrame = 1;
+
+    UnityXRMatrix4x4 m_CloudCameraToWorld = {};
+
+    // The depth image m_Positions was back-projected from, if any.
+    DepthImage m_DepthImage;
+
+    bool m_HasDepthImage = false;
+
+    // Bumped whenever sparse data replaces the depth image, so that images
+    // still being back-projected are dropped instead of published.
+    uint64_t m_DepthImageGeneration = 0;
+
+    std::atomic<uint64_t> m_Version{0};
+
+    mutable std::shared_timed_mutex m_Mutex;
+
+    // Only the latest image waiting for back-projection is kept.
+    PendingDepthImage m_PendingImage;
+
+    bool m_HasPendingImage = false;
+
+    bool m_IsBackProjecting = false;
+
+    std::mutex m_PendingMutex;
+
+    std::condition_variable m_BackProjectionDone;
+
+    // The frame being streamed, if any. m_FrameMutex only guards the pointer;
+    // appends write to the frame without holding it.
+    std::shared_ptr<DepthFrame> m_Frame;
+
+    int m_NextFrameId = 1;
+
+    // Storage of the cloud replaced by the last commit, reused by the next frame.
+    std::vector<UnityXRVector3> m_SparePositions;
+
+    std::vector<float> m_SpareConfidences;
+
+    std::mutex m_FrameMutex;
 
     IUnityXRDepthInterface* m_CInterface = nullptr;
 };
@@ -1,8 +1,19 @@
+#include <atomic>
 #include <cstring>
+#include <mutex>
 #include "InputProvider.h"
 #include "InputProviderV1.h"
 #include "InputProviderV2.h"
 
+static std::atomic<uint64_t> s_PoseVersion(0);
+
+// The transform last given to an input provider. Set on the main thread and
+// read by raycasts and background estimators, so it is copied under a lock
+// rather than read from the provider.
+static UnityXRMatrix4x4 s_Transform = Identity();
+
+static std::mutex s_TransformMutex;
+
 extern "C"
 {
 	UNITY_INTERFACE_EXPORT void UnityXRMock_connectDevice(int id)
@@ -56,6 +67,20 @@ extern "C"
 		{
 			inputProvider->SetPose(pose, transform);
 		}
+		else
+		{
+			++s_PoseVersion;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(s_TransformMutex);
+			s_Transform = transform;
+		}
+
+		// Bumped after the transform is stored, so a reader that sees the
+		// new version never caches a result for the old transform under it.
+		++s_PoseVersion;
 	}
 }
 
@@ -70,27 +95,21 @@ void InputProvider::SetPose(const UnityXRPose& pose, const UnityXRMatrix4x4& tra
 	m_Transform = transform;
 }
 
+uint64_t InputProvider::GetPoseVersion()
+{
+	return s_PoseVersion.load();
+}
+
 bool InputProvider::TryGetTransform(UnityXRMatrix4x4* transformOut)
 {
-    if (auto inputProvider = InputProviderV1::GetInstance())
-    {
-        *transformOut = inputProvider->GetTransform();
-        return true;
-    }
-    else if (auto inputProvider = InputProviderV2::GetInstance())
-    {
-        *transformOut = inputProvider->GetTransform();
-        return true;
-    }
-    else if (auto inputProvider = GetInstance())
-    {
-        *transformOut = inputProvider->GetTransform();
-        return true;
-    }
-    else
-    {
+    if (InputProviderV1::GetInstance() == nullptr &&
+        InputProviderV2::GetInstance() == nullptr &&
+        GetInstance() == nullptr)
         return false;
-    }
+
+    std::lock_guard<std::mutex> lock(s_TransformMutex);
+    *transformOut = s_Transform;
+    return true;
 }
 
 UnitySubsystemErrorCode UNITY_INTERFACE_API InputProvider::Initialize(UnitySubsystemHandle handle, void* xrInputInterfacePtr)
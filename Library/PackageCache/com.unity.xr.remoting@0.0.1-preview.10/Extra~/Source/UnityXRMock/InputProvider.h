@@ -14,6 +14,8 @@ public:
 	const UnityXRPose& GetPose() const { return m_LastPose; } 
 	const UnityXRMatrix4x4& GetTransform() const { return m_Transform; }
     static bool TryGetTransform(UnityXRMatrix4x4* transformOut);
+    // Incremented whenever UnityXRMock_setPose is called.
+    static uint64_t GetPoseVersion();
 	IUnityXRInputInterface* InputInterface() { return m_InputInterface;	}
 	UnitySubsystemHandle GetSubsystemHandle() const { return m_SubsystemHandle; }
 
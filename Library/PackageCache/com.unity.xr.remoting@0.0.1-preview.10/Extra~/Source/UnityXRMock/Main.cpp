@@ -13,8 +13,16 @@
 #include "InputProviderV1.h"
 #include "SessionProvider.h"
 #include "RaycastProvider.h"
+#include "RaycastCache.h"
+#include "ColliderRegistry.h"
+#include "AsyncRaycastQueue.h"
+#include "PlaneEstimator.h"
+#include "MeshingProvider.h"
+#include "OcclusionRenderer.h"
+#include "PersistentRaycasts.h"
 #include "DepthProvider.h"
 #include "ReferencePointProvider.h"
+#include "WorkerPool.h"
 
 #include "LifecycleProviderInput_V1.h"
 #include "LifecycleProviderInput_V2.h"
@@ -530,6 +538,15 @@ while (false)
 extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API
 UnityPluginLoad(IUnityInterfaces* unityInterfaces)
 {
+    WorkerPool::Construct();
+    RaycastCache::Construct(kDefaultRaycastCacheCapacity);
+    ColliderRegistry::Construct();
+    AsyncRaycastQueue::Construct();
+    PlaneEstimator::Construct();
+    MeshingProvider::Construct();
+    OcclusionRenderer::Construct();
+    PersistentRaycasts::Construct();
+
     REGISTER_LIFECYCLE_PROVIDER(Camera);
     REGISTER_LIFECYCLE_PROVIDER(Plane);
     REGISTER_LIFECYCLE_PROVIDER(ReferencePoint);
@@ -561,3 +578,16 @@ UnityPluginLoad(IUnityInterfaces* unityInterfaces)
     }
 
 }
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API
+UnityPluginUnload()
+{
+    PersistentRaycasts::Destroy();
+    OcclusionRenderer::Destroy();
+    MeshingProvider::Destroy();
+    PlaneEstimator::Destroy();
+    AsyncRaycastQueue::Destroy();
+    ColliderRegistry::Destroy();
+    RaycastCache::Destroy();
+    WorkerPool::Destroy();
+}
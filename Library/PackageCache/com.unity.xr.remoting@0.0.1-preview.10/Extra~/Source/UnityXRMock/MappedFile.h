@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Maps a whole file read-only into memory, for loading without copying it
+// through a read buffer first. Unmapped when destroyed.
+class MappedFile
+{
+public:
+
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Unmaps any file mapped before. Returns false if path cannot be opened
+    // or is empty.
+    bool Open(const char* path);
+
+    void Close();
+
+    const uint8_t* GetData() const { return m_Data; }
+
+    size_t GetSize() const { return m_Size; }
+
+private:
+
+    const uint8_t* m_Data = nullptr;
+
+    size_t m_Size = 0;
+
+#ifdef _WIN32
+    void* m_File = nullptr;
+
+    void* m_Mapping = nullptr;
+#endif
+};
@@ -0,0 +1,750 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "MeshingProvider.h"
+#include "MockTrackableTypes.h"
+#include "DepthProvider.h"
+#include "UnityMath.h"
+#include "WorkerPool.h"
+
+extern "C"
+{
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setMeshingEnabled(bool enabled)
+    {
+        if (MeshingProvider* meshingProvider = MeshingProvider::GetInstance())
+            meshingProvider->SetEnabled(enabled);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setMeshingSettings(
+        float voxelSize, float truncationDistance, float maxWeight)
+    {
+        if (MeshingProvider::GetInstance() == nullptr || voxelSize <= 0.f || truncationDistance <= 0.f)
+            return;
+
+        MeshingSettings settings;
+        settings.voxelSize = voxelSize;
+        settings.truncationDistance = truncationDistance;
+        settings.maxWeight = std::max(maxWeight, 1.f);
+        MeshingProvider::GetInstance()->SetSettings(settings);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_clearMesh()
+    {
+        if (MeshingProvider::GetInstance())
+            MeshingProvider::GetInstance()->Clear();
+    }
+
+    uint64_t UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_getMeshVersion()
+    {
+        if (MeshingProvider::GetInstance())
+            return MeshingProvider::GetInstance()->GetVersion();
+
+        return 0;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_getMesh(
+        UnityXRVector3* vertices, int vertexCapacity, int* indices, int indexCapacity,
+        int* vertexCount, int* indexCount)
+    {
+        if (MeshingProvider::GetInstance())
+            return MeshingProvider::GetInstance()->CopyMesh(vertices, vertexCapacity, indices, indexCapacity, vertexCount, indexCount);
+
+        if (vertexCount)
+            *vertexCount = 0;
+        if (indexCount)
+            *indexCount = 0;
+
+        return false;
+    }
+}
+
+// Corner i of a cell is offset by (i & 1, (i >> 1) & 1, (i >> 2) & 1) voxels.
+// Edges 0-3 run along x, 4-7 along y and 8-11 along z, lower corner first.
+static const int kEdgeCorners[12][2] =
+{
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+    { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+};
+
+// Corners of each face of a cell, counter-clockwise seen from outside the cell.
+static const int kFaceCorners[6][4] =
+{
+    { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    { 0, 1, 5, 4 }, { 2, 6, 7, 3 },
+    { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+};
+
+// A surface crosses at most all 12 edges, in loops of at least 3.
+static const int kMaxTriangleEdges = 30;
+
+struct MarchingCubesTable
+{
+    // Three edges per triangle, for each combination of inside corners.
+    uint8_t edges[256][kMaxTriangleEdges];
+    uint8_t numEdges[256];
+};
+
+static int FindEdge(int cornerA, int cornerB)
+{
+    for (int edge = 0; edge < 12; ++edge)
+    {
+        if ((kEdgeCorners[edge][0] == cornerA && kEdgeCorners[edge][1] == cornerB) ||
+            (kEdgeCorners[edge][0] == cornerB && kEdgeCorners[edge][1] == cornerA))
+            return edge;
+    }
+
+    return -1;
+}
+
+// Builds the triangle table instead of spelling out its 256 cases. On every
+// face of a cell the surface runs along segments that cut off the face's
+// inside corners; chaining the segments of all six faces gives closed loops,
+// which are fanned into triangles. Cutting off inside corners splits an
+// ambiguous face the same way for both cells that share it, so the mesh has
+// no cracks, and walking each face the same way round winds every triangle
+// clockwise seen from outside, which is Unity's front face.
+static MarchingCubesTable BuildMarchingCubesTable()
+{
+    MarchingCubesTable table = {};
+
+    for (int caseIndex = 0; caseIndex < 256; ++caseIndex)
+    {
+        int nextEdge[12];
+        std::fill_n(nextEdge, 12, -1);
+
+        for (const auto& face : kFaceCorners)
+        {
+            int crossings[4];
+            bool entersInside[4];
+            int numCrossings = 0;
+            for (int k = 0; k < 4; ++k)
+            {
+                const int cornerA = face[k];
+                const int cornerB = face[(k + 1) & 3];
+                const bool isInsideA = (caseIndex >> cornerA) & 1;
+                const bool isInsideB = (caseIndex >> cornerB) & 1;
+                if (isInsideA == isInsideB)
+                    continue;
+
+                crossings[numCrossings] = FindEdge(cornerA, cornerB);
+                entersInside[numCrossings] = isInsideB;
+                ++numCrossings;
+            }
+
+            for (int k = 0; k < numCrossings; ++k)
+            {
+                if (entersInside[k])
+                    nextEdge[crossings[k]] = crossings[(k + 1) % numCrossings];
+            }
+        }
+
+        bool isVisited[12] = {};
+        for (int firstEdge = 0; firstEdge < 12; ++firstEdge)
+        {
+            if (nextEdge[firstEdge] < 0 || isVisited[firstEdge])
+                continue;
+
+            int loop[12];
+            int loopLength = 0;
+            for (int edge = firstEdge; !isVisited[edge]; edge = nextEdge[edge])
+            {
+                isVisited[edge] = true;
+                loop[loopLength++] = edge;
+            }
+
+            for (int k = 1; k + 1 < loopLength; ++k)
+            {
+                uint8_t* triangle = &table.edges[caseIndex][table.numEdges[caseIndex]];
+                triangle[0] = static_cast<uint8_t>(loop[0]);
+                triangle[1] = static_cast<uint8_t>(loop[k]);
+                triangle[2] = static_cast<uint8_t>(loop[k + 1]);
+                table.numEdges[caseIndex] += 3;
+            }
+        }
+    }
+
+    return table;
+}
+
+static const MarchingCubesTable& GetMarchingCubesTable()
+{
+    static const MarchingCubesTable table = BuildMarchingCubesTable();
+    return table;
+}
+
+static inline int FloorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+static inline float Component(const UnityXRVector3& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Slab test of ray against an axis aligned box, up to maxDistance.
+static bool IntersectsBounds(const Ray& ray, const UnityXRVector3& min, const UnityXRVector3& max, float maxDistance)
+{
+    float tMin = 0.f;
+    float tMax = maxDistance;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float origin = Component(ray.origin, axis);
+        const float direction = Component(ray.direction, axis);
+        const float lower = Component(min, axis);
+        const float upper = Component(max, axis);
+
+        if (std::abs(direction) < 1e-12f)
+        {
+            if (origin < lower || origin > upper)
+                return false;
+
+            continue;
+        }
+
+        float t0 = (lower - origin) / direction;
+        float t1 = (upper - origin) / direction;
+        if (t0 > t1)
+            std::swap(t0, t1);
+
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMin > tMax)
+            return false;
+    }
+
+    return true;
+}
+
+MeshingProvider::~MeshingProvider()
+{
+    // An update may still be running on a worker thread.
+    std::unique_lock<std::mutex> lock(m_UpdateMutex);
+    m_ResetRequested = false;
+    m_ClearRequested = false;
+    m_UpdateRequested = false;
+    m_UpdateDone.wait(lock, [this] { return !m_IsUpdating; });
+}
+
+void MeshingProvider::SetEnabled(bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_UpdateMutex);
+        m_Enabled = enabled;
+        if (enabled)
+            return;
+
+        // A reset rather than a clear, so enabling again integrates the
+        // current cloud.
+        m_ResetRequested = true;
+    }
+    ScheduleUpdate();
+}
+
+void MeshingProvider::SetSettings(const MeshingSettings& settings)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_UpdateMutex);
+        m_Settings = settings;
+        m_ResetRequested = true;
+    }
+    ScheduleUpdate();
+}
+
+void MeshingProvider::Clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_UpdateMutex);
+        m_ClearRequested = true;
+    }
+    ScheduleUpdate();
+}
+
+void MeshingProvider::RequestUpdate()
+{
+    DepthProvider* depthProvider = DepthProvider::GetInstance();
+    if (!m_Enabled.load() || depthProvider == nullptr || depthProvider->GetVersion() == m_IntegratedVersion.load())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_UpdateMutex);
+        m_UpdateRequested = true;
+    }
+    ScheduleUpdate();
+}
+
+void MeshingProvider::ScheduleUpdate()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_UpdateMutex);
+        if (m_IsUpdating)
+            return;
+
+        m_IsUpdating = true;
+    }
+
+    // Without a worker pool this runs inline, so no lock may be held here.
+    RunAsync([this] { ProcessUpdates(); });
+}
+
+void MeshingProvider::ProcessUpdates()
+{
+    for (;;)
+    {
+        MeshingSettings settings;
+        bool reset = false;
+        bool clear = false;
+        {
+            std::lock_guard<std::mutex> lock(m_UpdateMutex);
+            if (!m_ResetRequested && !m_ClearRequested && !m_UpdateRequested)
+            {
+                m_IsUpdating = false;
+                m_UpdateDone.notify_all();
+                return;
+            }
+
+            settings = m_Settings;
+            reset = m_ResetRequested;
+            clear = m_ClearRequested;
+            m_ResetRequested = false;
+            m_ClearRequested = false;
+            m_UpdateRequested = false;
+        }
+
+        DepthProvider* depthProvider = DepthProvider::GetInstance();
+
+        if (reset || clear)
+        {
+            m_Chunks.clear();
+            m_DirtyChunks.clear();
+
+            // A reset re-integrates the current cloud with the new settings; a
+            // clear waits for points added after it.
+            m_IntegratedVersion = 0;
+            m_DepthCursor = DepthCloudCursor();
+            if (clear && depthProvider)
+            {
+                m_IntegratedVersion = depthProvider->GetVersion();
+                m_DepthCursor = depthProvider->GetEndCursor();
+            }
+
+            std::lock_guard<std::shared_timed_mutex> lock(m_MeshMutex);
+            m_Meshes.clear();
+            ++m_MeshVersion;
+        }
+
+        if (!m_Enabled.load() || depthProvider == nullptr || depthProvider->GetVersion() == m_IntegratedVersion.load())
+            continue;
+
+        // Only points not integrated yet, seen from where their frame was captured.
+        UnityXRMatrix4x4 cameraToWorld;
+        m_IntegratedVersion = depthProvider->CopyNewPositions(m_DepthCursor, m_Points, &cameraToWorld);
+        if (m_Points.empty())
+            continue;
+
+        const UnityXRVector3 origin = { cameraToWorld.columns[3].x, cameraToWorld.columns[3].y, cameraToWorld.columns[3].z };
+        Integrate(settings, origin);
+
+        if (m_DirtyChunks.empty())
+            continue;
+
+        std::vector<ChunkMesh> meshes(m_DirtyChunks.size());
+        RunParallelFor(m_DirtyChunks.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                ExtractMesh(*m_DirtyChunks[i], settings.voxelSize, meshes[i]);
+        });
+
+        {
+            std::lock_guard<std::shared_timed_mutex> lock(m_MeshMutex);
+            for (size_t i = 0; i < m_DirtyChunks.size(); ++i)
+            {
+                const Chunk& chunk = *m_DirtyChunks[i];
+                const uint64_t key = ChunkKey(chunk.x, chunk.y, chunk.z);
+                if (meshes[i].indices.empty())
+                    m_Meshes.erase(key);
+                else
+                    m_Meshes[key] = std::move(meshes[i]);
+            }
+            ++m_MeshVersion;
+        }
+
+        for (Chunk* chunk : m_DirtyChunks)
+            chunk->isDirty = false;
+        m_DirtyChunks.clear();
+    }
+}
+
+uint64_t MeshingProvider::ChunkKey(int x, int y, int z)
+{
+    const uint64_t mask = (1 << 21) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << 42) | ((static_cast<uint64_t>(y) & mask) << 21) | (static_cast<uint64_t>(z) & mask);
+}
+
+MeshingProvider::Chunk* MeshingProvider::GetOrCreateChunk(int x, int y, int z)
+{
+    std::unique_ptr<Chunk>& chunk = m_Chunks[ChunkKey(x, y, z)];
+    if (!chunk)
+    {
+        // Value-initialized, so every voxel starts unobserved.
+        chunk.reset(new Chunk());
+        chunk->x = x;
+        chunk->y = y;
+        chunk->z = z;
+        chunk->id = GenerateTrackableId();
+    }
+
+    return chunk.get();
+}
+
+const MeshingProvider::Chunk* MeshingProvider::FindChunk(int x, int y, int z) const
+{
+    const auto iter = m_Chunks.find(ChunkKey(x, y, z));
+    return iter != m_Chunks.end() ? iter->second.get() : nullptr;
+}
+
+void MeshingProvider::MarkDirty(Chunk* chunk)
+{
+    if (chunk->isDirty)
+        return;
+
+    chunk->isDirty = true;
+    m_DirtyChunks.push_back(chunk);
+}
+
+void MeshingProvider::Integrate(const MeshingSettings& settings, const UnityXRVector3& origin)
+{
+    const float voxelSize = settings.voxelSize;
+    const float truncation = settings.truncationDistance;
+    const float invVoxelSize = 1.f / voxelSize;
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    Chunk* chunk = nullptr;
+
+    for (const auto& point : m_Points)
+    {
+        const UnityXRVector3 toPoint = Sub(point, origin);
+        const float depth = Length(toPoint);
+        if (depth < 1e-4f)
+            continue;
+
+        // Walks the voxels the ray crosses within the truncation band around
+        // the point, in voxel units.
+        const UnityXRVector3 direction = Mul(toPoint, 1.f / depth);
+        const float tBegin = std::max(depth - truncation, 0.f);
+        const float length = (depth + truncation - tBegin) * invVoxelSize;
+        const UnityXRVector3 start = Mul(Add(origin, Mul(direction, tBegin)), invVoxelSize);
+
+        int voxel[3];
+        int step[3];
+        float tMax[3];
+        float tDelta[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float s = Component(start, axis);
+            const float d = Component(direction, axis);
+            voxel[axis] = static_cast<int>(std::floor(s));
+            step[axis] = d > 0.f ? 1 : -1;
+            tDelta[axis] = d != 0.f ? 1.f / std::abs(d) : infinity;
+            tMax[axis] = d > 0.f ? (voxel[axis] + 1 - s) * tDelta[axis] : (d < 0.f ? (s - voxel[axis]) * tDelta[axis] : infinity);
+        }
+
+        for (;;)
+        {
+            const UnityXRVector3 center =
+            {
+                (voxel[0] + .5f) * voxelSize,
+                (voxel[1] + .5f) * voxelSize,
+                (voxel[2] + .5f) * voxelSize
+            };
+            const float distance = depth - Dot(Sub(center, origin), direction);
+
+            if (distance >= -truncation)
+            {
+                const int chunkX = FloorDiv(voxel[0], kChunkSize);
+                const int chunkY = FloorDiv(voxel[1], kChunkSize);
+                const int chunkZ = FloorDiv(voxel[2], kChunkSize);
+                if (chunk == nullptr || chunk->x != chunkX || chunk->y != chunkY || chunk->z != chunkZ)
+                    chunk = GetOrCreateChunk(chunkX, chunkY, chunkZ);
+
+                const int localX = voxel[0] - chunkX * kChunkSize;
+                const int localY = voxel[1] - chunkY * kChunkSize;
+                const int localZ = voxel[2] - chunkZ * kChunkSize;
+                const int index = (localZ * kChunkSize + localY) * kChunkSize + localX;
+
+                const float weight = chunk->weights[index];
+                const float sample = std::min(distance / truncation, 1.f);
+                chunk->distances[index] = (chunk->distances[index] * weight + sample) / (weight + 1.f);
+                chunk->weights[index] = std::min(weight + 1.f, settings.maxWeight);
+                MarkDirty(chunk);
+
+                // Cells of the chunks below read this voxel as their upper corners.
+                if (localX == 0 || localY == 0 || localZ == 0)
+                {
+                    for (int neighbor = 1; neighbor < 8; ++neighbor)
+                    {
+                        const int dx = neighbor & 1;
+                        const int dy = (neighbor >> 1) & 1;
+                        const int dz = (neighbor >> 2) & 1;
+                        if ((dx && localX != 0) || (dy && localY != 0) || (dz && localZ != 0))
+                            continue;
+
+                        const auto iter = m_Chunks.find(ChunkKey(chunkX - dx, chunkY - dy, chunkZ - dz));
+                        if (iter != m_Chunks.end())
+                            MarkDirty(iter->second.get());
+                    }
+                }
+            }
+
+            const int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+            if (tMax[axis] > length)
+                break;
+
+            voxel[axis] += step[axis];
+            tMax[axis] += tDelta[axis];
+        }
+    }
+}
+
+void MeshingProvider::ExtractMesh(const Chunk& chunk, float voxelSize, ChunkMesh& meshOut) const
+{
+    const MarchingCubesTable& table = GetMarchingCubesTable();
+
+    // The chunk's voxels plus one layer from the chunks above it, so that
+    // cells on the upper faces have all their corners.
+    const int size = kChunkSize + 1;
+    std::vector<float> distances(size * size * size);
+    std::vector<float> weights(size * size * size, 0.f);
+
+    const Chunk* neighbors[8];
+    for (int neighbor = 0; neighbor < 8; ++neighbor)
+        neighbors[neighbor] = FindChunk(chunk.x + (neighbor & 1), chunk.y + ((neighbor >> 1) & 1), chunk.z + ((neighbor >> 2) & 1));
+
+    for (int z = 0; z < size; ++z)
+    {
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                const Chunk* source = neighbors[(x / kChunkSize) | ((y / kChunkSize) << 1) | ((z / kChunkSize) << 2)];
+                if (source == nullptr)
+                    continue;
+
+                const int sourceIndex = ((z % kChunkSize) * kChunkSize + y % kChunkSize) * kChunkSize + x % kChunkSize;
+                const int index = (z * size + y) * size + x;
+                distances[index] = source->distances[sourceIndex];
+                weights[index] = source->weights[sourceIndex];
+            }
+        }
+    }
+
+    const int cornerOffsets[8] =
+    {
+        0, 1, size, size + 1,
+        size * size, size * size + 1, size * size + size, size * size + size + 1
+    };
+
+    // Vertex on each voxel edge, by lower voxel index * 3 + axis, so that
+    // neighboring cells share vertices.
+    std::vector<int> edgeVertices(size * size * size * 3, -1);
+
+    meshOut.id = chunk.id;
+    meshOut.vertices.clear();
+    meshOut.indices.clear();
+
+    for (int z = 0; z < kChunkSize; ++z)
+    {
+        for (int y = 0; y < kChunkSize; ++y)
+        {
+            for (int x = 0; x < kChunkSize; ++x)
+            {
+                const int base = (z * size + y) * size + x;
+
+                int caseIndex = 0;
+                bool isObserved = true;
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    const int index = base + cornerOffsets[corner];
+                    isObserved = isObserved && weights[index] > 0.f;
+                    caseIndex |= (distances[index] < 0.f ? 1 : 0) << corner;
+                }
+
+                if (!isObserved || table.numEdges[caseIndex] == 0)
+                    continue;
+
+                for (int i = 0; i < table.numEdges[caseIndex]; ++i)
+                {
+                    const int edge = table.edges[caseIndex][i];
+                    const int cornerA = kEdgeCorners[edge][0];
+                    const int cornerB = kEdgeCorners[edge][1];
+                    const int indexA = base + cornerOffsets[cornerA];
+                    const int indexB = base + cornerOffsets[cornerB];
+
+                    int& vertex = edgeVertices[indexA * 3 + edge / 4];
+                    if (vertex < 0)
+                    {
+                        const float distanceA = distances[indexA];
+                        const float t = distanceA / (distanceA - distances[indexB]);
+                        const UnityXRVector3 cornerPosition =
+                        {
+                            static_cast<float>(chunk.x * kChunkSize + x + (cornerA & 1)),
+                            static_cast<float>(chunk.y * kChunkSize + y + ((cornerA >> 1) & 1)),
+                            static_cast<float>(chunk.z * kChunkSize + z + ((cornerA >> 2) & 1))
+                        };
+                        const UnityXRVector3 edgeDirection = { edge / 4 == 0 ? 1.f : 0.f, edge / 4 == 1 ? 1.f : 0.f, edge / 4 == 2 ? 1.f : 0.f };
+
+                        // Voxel values are sampled at voxel centers.
+                        const UnityXRVector3 position = Add(Add(cornerPosition, Mul(edgeDirection, t)), UnityXRVector3{ .5f, .5f, .5f });
+
+                        vertex = static_cast<int>(meshOut.vertices.size());
+                        meshOut.vertices.push_back(Mul(position, voxelSize));
+                    }
+
+                    meshOut.indices.push_back(vertex);
+                }
+            }
+        }
+    }
+
+    if (meshOut.vertices.empty())
+        return;
+
+    meshOut.boundsMin = meshOut.vertices.front();
+    meshOut.boundsMax = meshOut.vertices.front();
+    for (const auto& vertex : meshOut.vertices)
+    {
+        meshOut.boundsMin = UnityXRVector3{ std::min(meshOut.boundsMin.x, vertex.x), std::min(meshOut.boundsMin.y, vertex.y), std::min(meshOut.boundsMin.z, vertex.z) };
+        meshOut.boundsMax = UnityXRVector3{ std::max(meshOut.boundsMax.x, vertex.x), std::max(meshOut.boundsMax.y, vertex.y), std::max(meshOut.boundsMax.z, vertex.z) };
+    }
+}
+
+uint64_t MeshingProvider::GetVersion() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_MeshMutex);
+    return m_MeshVersion;
+}
+
+bool MeshingProvider::CopyMesh(
+    UnityXRVector3* vertices, int vertexCapacity, int* indices, int indexCapacity,
+    int* vertexCountOut, int* indexCountOut) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_MeshMutex);
+
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (const auto& iter : m_Meshes)
+    {
+        vertexCount += iter.second.vertices.size();
+        indexCount += iter.second.indices.size();
+    }
+
+    if (vertexCountOut)
+        *vertexCountOut = static_cast<int>(vertexCount);
+    if (indexCountOut)
+        *indexCountOut = static_cast<int>(indexCount);
+
+    if (vertices == nullptr || indices == nullptr ||
+        vertexCapacity < static_cast<int>(vertexCount) || indexCapacity < static_cast<int>(indexCount))
+        return false;
+
+    int firstVertex = 0;
+    for (const auto& iter : m_Meshes)
+    {
+        const ChunkMesh& mesh = iter.second;
+        vertices = std::copy(mesh.vertices.begin(), mesh.vertices.end(), vertices);
+        for (int index : mesh.indices)
+            *indices++ = firstVertex + index;
+
+        firstVertex += static_cast<int>(mesh.vertices.size());
+    }
+
+    return true;
+}
+
+void MeshingProvider::Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeMesh) == 0)
+        return;
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_MeshMutex);
+    RaycastLocked(ray, hitsOut);
+}
+
+void MeshingProvider::Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeMesh) == 0)
+        return;
+
+    // Workers only read m_Meshes, which stays locked until every range is done.
+    std::shared_lock<std::shared_timed_mutex> lock(m_MeshMutex);
+    RunParallelFor(count, kRaycastBatchGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            RaycastLocked(rays[i], hitsOut[i]);
+    });
+}
+
+void MeshingProvider::RaycastLocked(const Ray& ray, RaycastHitCollector& hitsOut) const
+{
+    const float eps = 1e-6f;
+
+    float closestDistance = hitsOut.GetMaxDistance();
+    UnityXRVector3 closestNormal = kUp;
+    const ChunkMesh* closestMesh = nullptr;
+
+    for (const auto& iter : m_Meshes)
+    {
+        const ChunkMesh& mesh = iter.second;
+        if (!IntersectsBounds(ray, mesh.boundsMin, mesh.boundsMax, closestDistance))
+            continue;
+
+        // Möller-Trumbore, accepting triangles from either side.
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            const UnityXRVector3& v0 = mesh.vertices[mesh.indices[i]];
+            const UnityXRVector3 edge1 = Sub(mesh.vertices[mesh.indices[i + 1]], v0);
+            const UnityXRVector3 edge2 = Sub(mesh.vertices[mesh.indices[i + 2]], v0);
+
+            const UnityXRVector3 p = Cross(ray.direction, edge2);
+            const float determinant = Dot(edge1, p);
+            if (std::abs(determinant) < eps * eps)
+                continue;
+
+            const float invDeterminant = 1.f / determinant;
+            const UnityXRVector3 toOrigin = Sub(ray.origin, v0);
+            const float u = Dot(toOrigin, p) * invDeterminant;
+            if (u < 0.f || u > 1.f)
+                continue;
+
+            const UnityXRVector3 q = Cross(toOrigin, edge1);
+            const float v = Dot(ray.direction, q) * invDeterminant;
+            if (v < 0.f || u + v > 1.f)
+                continue;
+
+            const float distance = Dot(edge2, q) * invDeterminant;
+            if (distance <= eps || distance > closestDistance)
+                continue;
+
+            closestDistance = distance;
+            closestNormal = Cross(edge1, edge2);
+            closestMesh = &mesh;
+        }
+    }
+
+    if (closestMesh == nullptr)
+        return;
+
+    UnityXRVector3 normal = Normalize(closestNormal);
+    if (Dot(normal, ray.direction) > 0.f)
+        normal = Mul(normal, -1.f);
+
+    UnityXRRaycastHit hit;
+    hit.trackableId = closestMesh->id;
+    hit.pose.position = Add(ray.origin, Mul(ray.direction, closestDistance));
+    hit.pose.rotation = RotationFromUp(normal);
+    hit.distance = closestDistance;
+    SetMockHitType(hit, kUnityXRMockTrackableTypeMesh);
+    hitsOut.Add(hit);
+}
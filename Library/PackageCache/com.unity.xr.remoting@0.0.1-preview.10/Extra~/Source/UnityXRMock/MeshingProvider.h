@@ -0,0 +1,158 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+#include "DepthProvider.h"
+#include "TrackableIdHelpers.h"
+#include "Singleton.h"
+#include "Ray.h"
+#include "RaycastHitCollector.h"
+
+struct MeshingSettings
+{
+    // Edge length of a voxel, in meters.
+    float voxelSize = .04f;
+
+    // How far in front of and behind a depth sample the volume is updated, in meters.
+    float truncationDistance = .12f;
+
+    // Caps how many samples a voxel averages, so the volume keeps adapting to change.
+    float maxWeight = 64.f;
+};
+
+// Integrates DepthProvider's point cloud, seen from the camera pose of each
+// frame, into a truncated signed distance field stored in chunks of voxels.
+// Each point is integrated once, when its frame arrives or it is added.
+// Chunks touched by an update are re-meshed with marching cubes on the
+// WorkerPool. The provider lives as long as the plugin and integrates nothing
+// while disabled.
+class MeshingProvider : public Singleton<MeshingProvider>
+{
+public:
+
+    ~MeshingProvider();
+
+    // Disabling clears the volume.
+    void SetEnabled(bool enabled);
+
+    // Clears the volume.
+    void SetSettings(const MeshingSettings& settings);
+
+    void Clear();
+
+    // Integrates new depth points if the cloud changed since the last update. Called once per frame.
+    void RequestUpdate();
+
+    // Incremented whenever the mesh changes.
+    uint64_t GetVersion() const;
+
+    // Copies the meshes of all chunks as one triangle list. If either buffer is
+    // too small nothing is copied, the required counts are still written, and
+    // false is returned.
+    bool CopyMesh(
+        UnityXRVector3* vertices, int vertexCapacity, int* indices, int indexCapacity,
+        int* vertexCountOut, int* indexCountOut) const;
+
+    // Adds the closest mesh hit along ray, if any.
+    void Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Raycasts all rays under one lock, adding the hit of rays[i] to hitsOut[i].
+    void Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const;
+
+private:
+
+    static const int kChunkSize = 16;
+
+    static const int kVoxelsPerChunk = kChunkSize * kChunkSize * kChunkSize;
+
+    struct Chunk
+    {
+        int x;
+        int y;
+        int z;
+
+        UnityXRTrackableId id;
+
+        // Signed distance to the surface in units of the truncation distance,
+        // positive in front of it.
+        std::array<float, kVoxelsPerChunk> distances;
+
+        // Zero for voxels that have never been observed.
+        std::array<float, kVoxelsPerChunk> weights;
+
+        bool isDirty;
+    };
+
+    struct ChunkMesh
+    {
+        UnityXRTrackableId id;
+        std::vector<UnityXRVector3> vertices;
+        std::vector<int> indices;
+        UnityXRVector3 boundsMin;
+        UnityXRVector3 boundsMax;
+    };
+
+    void ScheduleUpdate();
+
+    void ProcessUpdates();
+
+    void Integrate(const MeshingSettings& settings, const UnityXRVector3& origin);
+
+    Chunk* GetOrCreateChunk(int x, int y, int z);
+
+    const Chunk* FindChunk(int x, int y, int z) const;
+
+    void MarkDirty(Chunk* chunk);
+
+    void ExtractMesh(const Chunk& chunk, float voxelSize, ChunkMesh& meshOut) const;
+
+    void RaycastLocked(const Ray& ray, RaycastHitCollector& hitsOut) const;
+
+    static uint64_t ChunkKey(int x, int y, int z);
+
+    // Volume state, only touched by the update job.
+    std::unordered_map<uint64_t, std::unique_ptr<Chunk>> m_Chunks;
+
+    std::vector<Chunk*> m_DirtyChunks;
+
+    // Points of the last update that were new to the volume.
+    std::vector<UnityXRVector3> m_Points;
+
+    // How far into DepthProvider's clouds the volume has integrated.
+    DepthCloudCursor m_DepthCursor;
+
+    // DepthProvider version last integrated. Read by RequestUpdate to skip
+    // scheduling when the cloud has not changed.
+    std::atomic<uint64_t> m_IntegratedVersion{0};
+
+    // Meshes by chunk key, read by raycasts while the volume is being updated.
+    std::unordered_map<uint64_t, ChunkMesh> m_Meshes;
+
+    uint64_t m_MeshVersion = 0;
+
+    mutable std::shared_timed_mutex m_MeshMutex;
+
+    MeshingSettings m_Settings;
+
+    std::atomic<bool> m_Enabled{false};
+
+    bool m_ResetRequested = false;
+
+    bool m_ClearRequested = false;
+
+    bool m_UpdateRequested = false;
+
+    bool m_IsUpdating = false;
+
+    std::mutex m_UpdateMutex;
+
+    std::condition_variable m_UpdateDone;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "IUnityXRRaycast.h"
+#include "UnityXRTrackable.h"
+
+// Trackable types only this plugin reports, using bits well above the ones
+// Unity assigns to its own trackable types. UnityXRTrackableType cannot hold
+// them, so hit flags are carried as uint32_t inside the plugin and are only
+// UnityXRTrackableType where Unity passes them in.
+enum UnityXRMockTrackableType : uint32_t
+{
+    // A point on a mesh extracted by MeshingProvider
+    kUnityXRMockTrackableTypeMesh = 1u << 16,
+
+    // A reference point, hit as a small sphere around its position
+    kUnityXRMockTrackableTypeReferencePoint = 1u << 17,
+
+    // A sphere or capsule registered with ColliderRegistry
+    kUnityXRMockTrackableTypeCollider = 1u << 18
+};
+
+// Stores a mock type in a hit's hitType. Its bits are copied into the field
+// rather than cast to UnityXRTrackableType, whose values stop below them.
+// Managed code reads hitType as a 32-bit int and sees these bits as they are.
+// Unity only asks for its own types, so hits with mock types never reach it.
+inline void SetMockHitType(UnityXRRaycastHit& hit, uint32_t hitType)
+{
+    static_assert(sizeof(hit.hitType) == sizeof(hitType), "hitType is not 32 bits wide");
+    std::memcpy(&hit.hitType, &hitType, sizeof(hitType));
+}
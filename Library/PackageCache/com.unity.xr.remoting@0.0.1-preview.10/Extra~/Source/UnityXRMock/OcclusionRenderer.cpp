@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "OcclusionRenderer.h"
+#include "CameraProvider.h"
+#include "DepthProvider.h"
+#include "InputProvider.h"
+#include "MeshingProvider.h"
+#include "PlaneProvider.h"
+#include "UnityMath.h"
+#include "WorkerPool.h"
+
+static const int kTileSize = 32;
+
+static const float kMaxSplatRadiusInPixels = 8.f;
+
+extern "C"
+{
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setOcclusionEnabled(bool enabled)
+    {
+        if (OcclusionRenderer* occlusionRenderer = OcclusionRenderer::GetInstance())
+            occlusionRenderer->SetEnabled(enabled);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setOcclusionPointRadius(float pointRadius)
+    {
+        if (OcclusionRenderer::GetInstance() && pointRadius >= 0.f)
+            OcclusionRenderer::GetInstance()->SetPointRadius(pointRadius);
+    }
+}
+
+static inline bool IsSupportedFormat(UnityRenderingExtTextureFormat format)
+{
+    return format == kUnityRenderingExtFormatR32_SFloat || format == kUnityRenderingExtFormatR16_UNorm;
+}
+
+static inline size_t BytesPerTexel(UnityRenderingExtTextureFormat format)
+{
+    return format == kUnityRenderingExtFormatR16_UNorm ? sizeof(uint16_t) : sizeof(float);
+}
+
+// Assumes cameraToWorld is a rigid transform.
+static inline UnityXRVector3 WorldToCamera(const UnityXRMatrix4x4& cameraToWorld, const UnityXRVector3& position)
+{
+    const UnityXRVector3 offset =
+    {
+        position.x - cameraToWorld.columns[3].x,
+        position.y - cameraToWorld.columns[3].y,
+        position.z - cameraToWorld.columns[3].z
+    };
+
+    return UnityXRVector3
+    {
+        cameraToWorld.columns[0].x * offset.x + cameraToWorld.columns[0].y * offset.y + cameraToWorld.columns[0].z * offset.z,
+        cameraToWorld.columns[1].x * offset.x + cameraToWorld.columns[1].y * offset.y + cameraToWorld.columns[1].z * offset.z,
+        cameraToWorld.columns[2].x * offset.x + cameraToWorld.columns[2].y * offset.y + cameraToWorld.columns[2].z * offset.z
+    };
+}
+
+// Pixel coordinates of a camera space point in front of the near plane. The
+// camera looks down +z while the projection expects -z, the same convention
+// CameraProvider::TryGetRay inverts.
+static inline bool ProjectToPixels(const UnityXRMatrix4x4& projection, const UnityXRVector3& pointInCameraSpace, int width, int height, float* xOut, float* yOut)
+{
+    UnityXRVector3 ndc;
+    if (!Mul(projection, UnityXRVector3{ pointInCameraSpace.x, pointInCameraSpace.y, -pointInCameraSpace.z }, &ndc))
+        return false;
+
+    *xOut = (ndc.x + 1.f) * .5f * width;
+    *yOut = (ndc.y + 1.f) * .5f * height;
+    return true;
+}
+
+static inline int ClampToInt(float value, int min, int max)
+{
+    return static_cast<int>(std::min(std::max(value, static_cast<float>(min)), static_cast<float>(max)));
+}
+
+static void FillEmpty(std::vector<uint8_t>& texture, size_t numTexels, UnityRenderingExtTextureFormat format, size_t bytesPerTexel)
+{
+    texture.assign(numTexels * bytesPerTexel, 0);
+    if (format == kUnityRenderingExtFormatR32_SFloat)
+        std::fill_n(reinterpret_cast<float*>(texture.data()), numTexels, FLT_MAX);
+    else if (format == kUnityRenderingExtFormatR16_UNorm)
+        std::fill_n(reinterpret_cast<uint16_t*>(texture.data()), numTexels, static_cast<uint16_t>(0xffff));
+}
+
+bool OcclusionRenderer::ViewKey::operator==(const ViewKey& other) const
+{
+    return cameraVersion == other.cameraVersion &&
+        poseVersion == other.poseVersion &&
+        planeVersion == other.planeVersion &&
+        depthVersion == other.depthVersion &&
+        meshVersion == other.meshVersion &&
+        pointRadius == other.pointRadius &&
+        width == other.width &&
+        height == other.height &&
+        format == other.format;
+}
+
+OcclusionRenderer::~OcclusionRenderer()
+{
+    // A render may still be running on a worker thread.
+    std::unique_lock<std::mutex> lock(m_PendingMutex);
+    m_HasPendingView = false;
+    m_RenderDone.wait(lock, [this] { return !m_IsRendering; });
+}
+
+void OcclusionRenderer::SetEnabled(bool enabled)
+{
+    m_Enabled = enabled;
+    if (enabled)
+        return;
+
+    // Enabling again renders the current view even if nothing changed since.
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        m_HasPendingView = false;
+        m_HasLastKey = false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_TextureMutex);
+    m_HasReadyTexture = false;
+    m_UploadTexture.texels.clear();
+}
+
+void OcclusionRenderer::SetPointRadius(float pointRadius)
+{
+    std::lock_guard<std::mutex> lock(m_PendingMutex);
+    m_PointRadius = pointRadius;
+}
+
+void OcclusionRenderer::RequestUpdate()
+{
+    CameraProvider* cameraProvider = CameraProvider::GetInstance();
+    if (!m_Enabled.load() || cameraProvider == nullptr)
+        return;
+
+    View view;
+    if (!cameraProvider->TryGetProjection(&view.projection, &view.zNear, &view.zFar) ||
+        !InputProvider::TryGetTransform(&view.cameraToWorld))
+        return;
+
+    view.zNear = std::max(view.zNear, 1e-3f);
+
+    {
+        std::lock_guard<std::mutex> lock(m_TextureMutex);
+        view.width = m_TextureWidth;
+        view.height = m_TextureHeight;
+        view.format = m_TextureFormat;
+    }
+
+    // Nothing to render until Unity has asked for a texture it can take.
+    if (view.width <= 0 || view.height <= 0 || !IsSupportedFormat(view.format))
+        return;
+
+    ViewKey key = {};
+    key.cameraVersion = cameraProvider->GetVersion();
+    key.poseVersion = InputProvider::GetPoseVersion();
+    key.planeVersion = PlaneProvider::GetInstance() ? PlaneProvider::GetInstance()->GetVersion() : 0;
+    key.depthVersion = DepthProvider::GetInstance() ? DepthProvider::GetInstance()->GetVersion() : 0;
+    key.meshVersion = MeshingProvider::GetInstance() ? MeshingProvider::GetInstance()->GetVersion() : 0;
+    key.width = view.width;
+    key.height = view.height;
+    key.format = view.format;
+
+    bool scheduleRender = false;
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        view.pointRadius = m_PointRadius;
+        key.pointRadius = m_PointRadius;
+        if (m_HasLastKey && key == m_LastKey)
+            return;
+
+        m_LastKey = key;
+        m_HasLastKey = true;
+        m_PendingView = view;
+        m_HasPendingView = true;
+
+        if (!m_IsRendering)
+        {
+            m_IsRendering = true;
+            scheduleRender = true;
+        }
+    }
+
+    // Without a worker pool this runs inline, so no lock may be held here.
+    if (scheduleRender)
+        RunAsync([this] { ProcessPendingViews(); });
+}
+
+void OcclusionRenderer::ProcessPendingViews()
+{
+    Texture texture;
+
+    for (;;)
+    {
+        View view;
+        {
+            std::lock_guard<std::mutex> lock(m_PendingMutex);
+            if (!m_HasPendingView)
+            {
+                m_IsRendering = false;
+                m_RenderDone.notify_all();
+                return;
+            }
+
+            view = m_PendingView;
+            m_HasPendingView = false;
+        }
+
+        Render(view, texture.texels);
+        texture.width = view.width;
+        texture.height = view.height;
+        texture.format = view.format;
+
+        // A render that was running when occlusion was disabled is dropped.
+        std::lock_guard<std::mutex> lock(m_TextureMutex);
+        if (!m_Enabled.load())
+            continue;
+
+        std::swap(m_ReadyTexture, texture);
+        m_HasReadyTexture = true;
+    }
+}
+
+void OcclusionRenderer::BeginTextureUpdate(UnityRenderingExtTextureUpdateParams& params)
+{
+    std::lock_guard<std::mutex> lock(m_TextureMutex);
+    m_TextureWidth = static_cast<int>(params.width);
+    m_TextureHeight = static_cast<int>(params.height);
+    m_TextureFormat = params.format;
+    if (!m_Enabled.load())
+        return;
+
+    if (m_HasReadyTexture)
+    {
+        std::swap(m_UploadTexture, m_ReadyTexture);
+        m_HasReadyTexture = false;
+    }
+
+    // A texture rendered for a different size or format, or none yet, reads
+    // as empty until the next render.
+    const size_t numTexels = static_cast<size_t>(params.width) * params.height;
+    if (m_UploadTexture.width != m_TextureWidth ||
+        m_UploadTexture.height != m_TextureHeight ||
+        m_UploadTexture.format != m_TextureFormat ||
+        m_UploadTexture.texels.size() != numTexels * params.bpp)
+    {
+        FillEmpty(m_UploadTexture.texels, numTexels, params.format, params.bpp);
+        m_UploadTexture.width = m_TextureWidth;
+        m_UploadTexture.height = m_TextureHeight;
+        m_UploadTexture.format = m_TextureFormat;
+    }
+
+    params.texData = m_UploadTexture.texels.data();
+}
+
+void OcclusionRenderer::Render(const View& view, std::vector<uint8_t>& textureOut)
+{
+    m_Triangles.clear();
+    m_Splats.clear();
+
+    if (PlaneProvider* planeProvider = PlaneProvider::GetInstance())
+    {
+        m_PlanePolygons = planeProvider->GetPlanePolygons();
+        for (const auto& polygon : m_PlanePolygons)
+            AddPolygon(view, polygon.data(), polygon.size());
+    }
+
+    if (MeshingProvider* meshingProvider = MeshingProvider::GetInstance())
+    {
+        // The mesh may grow between asking for its size and copying it.
+        int vertexCount = 0;
+        int indexCount = 0;
+        bool hasMesh = false;
+        for (int attempt = 0; attempt < 3 && !hasMesh; ++attempt)
+        {
+            meshingProvider->CopyMesh(nullptr, 0, nullptr, 0, &vertexCount, &indexCount);
+            m_MeshVertices.resize(vertexCount);
+            m_MeshIndices.resize(indexCount);
+            hasMesh = meshingProvider->CopyMesh(
+                m_MeshVertices.data(), vertexCount, m_MeshIndices.data(), indexCount, &vertexCount, &indexCount);
+        }
+
+        if (hasMesh)
+        {
+            for (size_t i = 0; i + 2 < m_MeshIndices.size(); i += 3)
+            {
+                const UnityXRVector3 triangle[3] =
+                {
+                    m_MeshVertices[m_MeshIndices[i]],
+                    m_MeshVertices[m_MeshIndices[i + 1]],
+                    m_MeshVertices[m_MeshIndices[i + 2]]
+                };
+                AddPolygon(view, triangle, 3);
+            }
+        }
+    }
+
+    if (DepthProvider* depthProvider = DepthProvider::GetInstance())
+    {
+        depthProvider->CopyPositions(m_Points);
+        for (const auto& point : m_Points)
+            AddSplat(view, point);
+    }
+
+    // Bin everything into screen tiles, so that tiles can be rasterized in
+    // parallel without sharing any texels.
+    const int width = view.width;
+    const int height = view.height;
+    m_NumTilesX = (width + kTileSize - 1) / kTileSize;
+    const int numTilesY = (height + kTileSize - 1) / kTileSize;
+    const size_t numTiles = static_cast<size_t>(m_NumTilesX) * numTilesY;
+
+    m_TileTriangles.resize(numTiles);
+    m_TileSplats.resize(numTiles);
+    for (size_t tile = 0; tile < numTiles; ++tile)
+    {
+        m_TileTriangles[tile].clear();
+        m_TileSplats[tile].clear();
+    }
+
+    for (size_t i = 0; i < m_Triangles.size(); ++i)
+    {
+        const ScreenTriangle& triangle = m_Triangles[i];
+        for (int tileY = triangle.minY / kTileSize; tileY <= triangle.maxY / kTileSize; ++tileY)
+        {
+            for (int tileX = triangle.minX / kTileSize; tileX <= triangle.maxX / kTileSize; ++tileX)
+                m_TileTriangles[tileY * m_NumTilesX + tileX].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    for (size_t i = 0; i < m_Splats.size(); ++i)
+    {
+        const ScreenSplat& splat = m_Splats[i];
+        for (int tileY = splat.minY / kTileSize; tileY <= splat.maxY / kTileSize; ++tileY)
+        {
+            for (int tileX = splat.minX / kTileSize; tileX <= splat.maxX / kTileSize; ++tileX)
+                m_TileSplats[tileY * m_NumTilesX + tileX].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    // Zero reciprocal depth is infinitely far away.
+    m_InverseDepths.assign(static_cast<size_t>(width) * height, 0.f);
+
+    RunParallelFor(numTiles, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t tile = begin; tile < end; ++tile)
+            RasterizeTile(static_cast<int>(tile % m_NumTilesX), static_cast<int>(tile / m_NumTilesX), width, height);
+    });
+
+    const size_t numTexels = m_InverseDepths.size();
+    textureOut.resize(numTexels * BytesPerTexel(view.format));
+    if (view.format == kUnityRenderingExtFormatR16_UNorm)
+    {
+        uint16_t* texels = reinterpret_cast<uint16_t*>(textureOut.data());
+        const float scale = 65535.f / view.zFar;
+        for (size_t i = 0; i < numTexels; ++i)
+        {
+            const float inverseDepth = m_InverseDepths[i];
+            const float value = inverseDepth > 0.f ? std::min(scale / inverseDepth, 65535.f) : 65535.f;
+            texels[i] = static_cast<uint16_t>(value + .5f);
+        }
+    }
+    else
+    {
+        float* texels = reinterpret_cast<float*>(textureOut.data());
+        for (size_t i = 0; i < numTexels; ++i)
+        {
+            const float inverseDepth = m_InverseDepths[i];
+            texels[i] = inverseDepth > 0.f ? 1.f / inverseDepth : FLT_MAX;
+        }
+    }
+}
+
+void OcclusionRenderer::AddPolygon(const View& view, const UnityXRVector3* positions, size_t count)
+{
+    if (count < 3)
+        return;
+
+    // Clip against the near plane in camera space.
+    m_ClippedPolygon.clear();
+    UnityXRVector3 previous = WorldToCamera(view.cameraToWorld, positions[count - 1]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const UnityXRVector3 current = WorldToCamera(view.cameraToWorld, positions[i]);
+        const bool isPreviousInside = previous.z >= view.zNear;
+        const bool isCurrentInside = current.z >= view.zNear;
+        if (isPreviousInside != isCurrentInside)
+        {
+            const float t = (view.zNear - previous.z) / (current.z - previous.z);
+            m_ClippedPolygon.push_back(Add(previous, Mul(Sub(current, previous), t)));
+        }
+
+        if (isCurrentInside)
+            m_ClippedPolygon.push_back(current);
+
+        previous = current;
+    }
+
+    if (m_ClippedPolygon.size() < 3)
+        return;
+
+    // Reuse the clipped vertices to hold pixel x, pixel y and reciprocal depth.
+    for (auto& vertex : m_ClippedPolygon)
+    {
+        float x;
+        float y;
+        if (!ProjectToPixels(view.projection, vertex, view.width, view.height, &x, &y))
+            return;
+
+        vertex = UnityXRVector3{ x, y, 1.f / vertex.z };
+    }
+
+    // Fan triangulation assumes a convex polygon, which plane boundaries are.
+    const UnityXRVector3& v0 = m_ClippedPolygon[0];
+    for (size_t k = 1; k + 1 < m_ClippedPolygon.size(); ++k)
+    {
+        const UnityXRVector3& v1 = m_ClippedPolygon[k];
+        const UnityXRVector3& v2 = m_ClippedPolygon[k + 1];
+
+        const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (std::abs(area) < 1e-6f)
+            continue;
+
+        ScreenTriangle triangle;
+        triangle.x[0] = v0.x;
+        triangle.x[1] = v1.x;
+        triangle.x[2] = v2.x;
+        triangle.y[0] = v0.y;
+        triangle.y[1] = v1.y;
+        triangle.y[2] = v2.y;
+        triangle.a = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+        triangle.b = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) / area;
+        triangle.c = v0.z - triangle.a * v0.x - triangle.b * v0.y;
+
+        const float minX = std::min(v0.x, std::min(v1.x, v2.x));
+        const float maxX = std::max(v0.x, std::max(v1.x, v2.x));
+        const float minY = std::min(v0.y, std::min(v1.y, v2.y));
+        const float maxY = std::max(v0.y, std::max(v1.y, v2.y));
+        if (maxX < 0.f || maxY < 0.f || minX >= view.width || minY >= view.height)
+            continue;
+
+        triangle.minX = ClampToInt(std::floor(minX), 0, view.width - 1);
+        triangle.maxX = ClampToInt(std::floor(maxX), 0, view.width - 1);
+        triangle.minY = ClampToInt(std::floor(minY), 0, view.height - 1);
+        triangle.maxY = ClampToInt(std::floor(maxY), 0, view.height - 1);
+        m_Triangles.push_back(triangle);
+    }
+}
+
+void OcclusionRenderer::AddSplat(const View& view, const UnityXRVector3& position)
+{
+    const UnityXRVector3 pointInCameraSpace = WorldToCamera(view.cameraToWorld, position);
+    if (pointInCameraSpace.z < view.zNear)
+        return;
+
+    float x;
+    float y;
+    if (!ProjectToPixels(view.projection, pointInCameraSpace, view.width, view.height, &x, &y))
+        return;
+
+    const float pixelsPerMeter = std::abs(view.projection.columns[0].x) * .5f * view.width / pointInCameraSpace.z;
+    const float radius = std::min(std::max(view.pointRadius * pixelsPerMeter, .5f), kMaxSplatRadiusInPixels);
+    if (x + radius < 0.f || y + radius < 0.f || x - radius >= view.width || y - radius >= view.height)
+        return;
+
+    ScreenSplat splat;
+    splat.inverseDepth = 1.f / pointInCameraSpace.z;
+    splat.minX = ClampToInt(std::floor(x - radius), 0, view.width - 1);
+    splat.maxX = ClampToInt(std::floor(x + radius), 0, view.width - 1);
+    splat.minY = ClampToInt(std::floor(y - radius), 0, view.height - 1);
+    splat.maxY = ClampToInt(std::floor(y + radius), 0, view.height - 1);
+    m_Splats.push_back(splat);
+}
+
+void OcclusionRenderer::RasterizeTile(int tileX, int tileY, int width, int height)
+{
+    const int tileMinX = tileX * kTileSize;
+    const int tileMinY = tileY * kTileSize;
+    const int tileMaxX = std::min(tileMinX + kTileSize, width) - 1;
+    const int tileMaxY = std::min(tileMinY + kTileSize, height) - 1;
+    const size_t tile = static_cast<size_t>(tileY) * m_NumTilesX + tileX;
+
+    for (uint32_t index : m_TileTriangles[tile])
+    {
+        const ScreenTriangle& triangle = m_Triangles[index];
+        const int minY = std::max(triangle.minY, tileMinY);
+        const int maxY = std::min(triangle.maxY, tileMaxY);
+        for (int y = minY; y <= maxY; ++y)
+        {
+            // Span of pixel centers on this row inside the triangle.
+            const float centerY = y + .5f;
+            float spanMinX = FLT_MAX;
+            float spanMaxX = -FLT_MAX;
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                const int next = edge == 2 ? 0 : edge + 1;
+                const float y0 = triangle.y[edge];
+                const float y1 = triangle.y[next];
+                if ((y0 <= centerY) == (y1 <= centerY))
+                    continue;
+
+                const float x = triangle.x[edge] + (centerY - y0) * (triangle.x[next] - triangle.x[edge]) / (y1 - y0);
+                spanMinX = std::min(spanMinX, x);
+                spanMaxX = std::max(spanMaxX, x);
+            }
+
+            if (spanMinX > spanMaxX)
+                continue;
+
+            const int minX = std::max(ClampToInt(std::ceil(spanMinX - .5f), tileMinX, tileMaxX + 1), tileMinX);
+            const int maxX = std::min(ClampToInt(std::floor(spanMaxX - .5f), tileMinX - 1, tileMaxX), tileMaxX);
+
+            // No branches, so this loop vectorizes.
+            float* row = &m_InverseDepths[static_cast<size_t>(y) * width];
+            const float rowStart = triangle.a * .5f + triangle.b * centerY + triangle.c;
+            for (int x = minX; x <= maxX; ++x)
+                row[x] = std::max(row[x], rowStart + triangle.a * x);
+        }
+    }
+
+    for (uint32_t index : m_TileSplats[tile])
+    {
+        const ScreenSplat& splat = m_Splats[index];
+        const int minX = std::max(splat.minX, tileMinX);
+        const int maxX = std::min(splat.maxX, tileMaxX);
+        const int minY = std::max(splat.minY, tileMinY);
+        const int maxY = std::min(splat.maxY, tileMaxY);
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float* row = &m_InverseDepths[static_cast<size_t>(y) * width];
+            for (int x = minX; x <= maxX; ++x)
+                row[x] = std::max(row[x], splat.inverseDepth);
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "IUnityRenderingExtensions.h"
+#include "UnityXRTypes.h"
+#include "Singleton.h"
+
+// userData of a texture update that should receive the environment depth
+// instead of the camera image.
+static const unsigned int kOcclusionTextureUserData = 1;
+
+// Rasterizes planes, the depth point cloud and the meshing output into a depth
+// texture seen from the current camera, for occluding virtual content. Texels
+// hold linear eye depth: meters for R32_SFloat, depth over the far clip plane
+// for R16_UNorm. Texels with nothing in them hold the largest representable
+// depth. The first row is the bottom of the screen. The renderer lives as
+// long as the plugin and renders nothing while disabled.
+class OcclusionRenderer : public Singleton<OcclusionRenderer>
+{
+public:
+
+    ~OcclusionRenderer();
+
+    // Disabling drops the rendered textures.
+    void SetEnabled(bool enabled);
+
+    // Radius points are drawn with, in meters.
+    void SetPointRadius(float pointRadius);
+
+    // Re-renders on a worker thread if the camera or any geometry changed.
+    // Called once per frame.
+    void RequestUpdate();
+
+    // Hands the latest finished depth texture to Unity, or leaves the texture
+    // as it is while disabled. Called on the render thread for
+    // kUnityRenderingExtEventUpdateTextureBegin.
+    void BeginTextureUpdate(UnityRenderingExtTextureUpdateParams& params);
+
+private:
+
+    struct View
+    {
+        UnityXRMatrix4x4 cameraToWorld;
+        UnityXRMatrix4x4 projection;
+        float zNear;
+        float zFar;
+        float pointRadius;
+        int width;
+        int height;
+        UnityRenderingExtTextureFormat format;
+    };
+
+    struct ViewKey
+    {
+        uint64_t cameraVersion;
+        uint64_t poseVersion;
+        uint64_t planeVersion;
+        uint64_t depthVersion;
+        uint64_t meshVersion;
+        float pointRadius;
+        int width;
+        int height;
+        UnityRenderingExtTextureFormat format;
+
+        bool operator==(const ViewKey& other) const;
+    };
+
+    struct Texture
+    {
+        std::vector<uint8_t> texels;
+        int width = 0;
+        int height = 0;
+        UnityRenderingExtTextureFormat format = kUnityRenderingExtFormatR32_SFloat;
+    };
+
+    struct ScreenTriangle
+    {
+        float x[3];
+        float y[3];
+
+        // Reciprocal depth is linear in screen space: a * x + b * y + c.
+        float a;
+        float b;
+        float c;
+
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+    };
+
+    struct ScreenSplat
+    {
+        float inverseDepth;
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+    };
+
+    void ProcessPendingViews();
+
+    void Render(const View& view, std::vector<uint8_t>& textureOut);
+
+    void AddPolygon(const View& view, const UnityXRVector3* positions, size_t count);
+
+    void AddSplat(const View& view, const UnityXRVector3& position);
+
+    void RasterizeTile(int tileX, int tileY, int width, int height);
+
+    // Per-render scratch, only touched by the render job.
+    std::vector<float> m_InverseDepths;
+
+    std::vector<ScreenTriangle> m_Triangles;
+
+    std::vector<ScreenSplat> m_Splats;
+
+    std::vector<std::vector<uint32_t>> m_TileTriangles;
+
+    std::vector<std::vector<uint32_t>> m_TileSplats;
+
+    int m_NumTilesX = 0;
+
+    std::vector<UnityXRVector3> m_ClippedPolygon;
+
+    std::vector<std::vector<UnityXRVector3>> m_PlanePolygons;
+
+    std::vector<UnityXRVector3> m_Points;
+
+    std::vector<UnityXRVector3> m_MeshVertices;
+
+    std::vector<int> m_MeshIndices;
+
+    // Scheduling, guarded by m_PendingMutex.
+    float m_PointRadius = .02f;
+
+    ViewKey m_LastKey = {};
+
+    bool m_HasLastKey = false;
+
+    View m_PendingView;
+
+    bool m_HasPendingView = false;
+
+    bool m_IsRendering = false;
+
+    std::mutex m_PendingMutex;
+
+    std::condition_variable m_RenderDone;
+
+    // Texture hand-off, guarded by m_TextureMutex. The size and format are
+    // taken from the last texture Unity asked to update.
+    Texture m_ReadyTexture;
+
+    bool m_HasReadyTexture = false;
+
+    Texture m_UploadTexture;
+
+    int m_TextureWidth = 0;
+
+    int m_TextureHeight = 0;
+
+    UnityRenderingExtTextureFormat m_TextureFormat = kUnityRenderingExtFormatR32_SFloat;
+
+    std::mutex m_TextureMutex;
+
+    std::atomic<bool> m_Enabled{false};
+};
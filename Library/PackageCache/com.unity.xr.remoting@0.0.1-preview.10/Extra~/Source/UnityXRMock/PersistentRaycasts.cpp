@@ -0,0 +1,206 @@
+#include <algorithm>
+
+#include "PersistentRaycasts.h"
+#include "MockTrackableTypes.h"
+#include "RaycastProvider.h"
+#include "UnityMath.h"
+
+extern "C"
+{
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_addPersistentScreenRaycast(
+        float screenX, float screenY, uint32_t hitFlags)
+    {
+        if (PersistentRaycasts::GetInstance())
+            return PersistentRaycasts::GetInstance()->AddScreenPoint(screenX, screenY, hitFlags);
+
+        return 0;
+    }
+
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_addPersistentWorldRaycast(
+        UnityXRVector3 origin, UnityXRVector3 direction, uint32_t hitFlags)
+    {
+        if (LengthSquared(direction) == 0.f || PersistentRaycasts::GetInstance() == nullptr)
+            return 0;
+
+        return PersistentRaycasts::GetInstance()->AddRay(Ray{origin, Normalize(direction)}, hitFlags);
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_removePersistentRaycast(int id)
+    {
+        if (PersistentRaycasts::GetInstance())
+            return PersistentRaycasts::GetInstance()->Remove(id);
+
+        return false;
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_clearPersistentRaycasts()
+    {
+        if (PersistentRaycasts::GetInstance())
+            PersistentRaycasts::GetInstance()->Clear();
+    }
+
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_getPersistentRaycastHits(
+        const int* ids, int count, UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut)
+    {
+        if (ids == nullptr && count > 0)
+            return -1;
+
+        if (PersistentRaycasts::GetInstance())
+            return PersistentRaycasts::GetInstance()->CopyHits(ids, count, hitsOut, hitCapacity, hitOffsetsOut);
+
+        if (hitOffsetsOut)
+            std::fill(hitOffsetsOut, hitOffsetsOut + std::max(count, 0) + 1, 0);
+
+        return 0;
+    }
+}
+
+int PersistentRaycasts::AddScreenPoint(float screenX, float screenY, uint32_t hitFlags)
+{
+    Query query = {};
+    query.isScreenPoint = true;
+    query.screenPoint = UnityXRVector2{screenX, screenY};
+    query.hitFlags = hitFlags;
+    return Add(query);
+}
+
+int PersistentRaycasts::AddRay(const Ray& ray, uint32_t hitFlags)
+{
+    Query query = {};
+    query.isScreenPoint = false;
+    query.ray = ray;
+    query.hitFlags = hitFlags;
+    return Add(query);
+}
+
+int PersistentRaycasts::Add(const Query& query)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    const int id = m_NextId++;
+    Query& added = m_Queries[id];
+    added = query;
+    added.isDirty = true;
+    return id;
+}
+
+bool PersistentRaycasts::Remove(int id)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Queries.erase(id) > 0;
+}
+
+void PersistentRaycasts::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Queries.clear();
+}
+
+void PersistentRaycasts::Update()
+{
+    // Checked before the versions are taken, so nothing is missed once the
+    // provider is back.
+    RaycastProvider* raycastProvider = RaycastProvider::GetInstance();
+    if (raycastProvider == nullptr)
+        return;
+
+    const RaycastVersions versions = RaycastVersions::GetCurrent();
+    const bool cameraChanged = versions.camera != m_Versions.camera || versions.pose != m_Versions.pose;
+    const bool planesChanged = versions.planes != m_Versions.planes;
+    const bool pointsChanged = versions.points != m_Versions.points;
+    const bool meshChanged = versions.mesh != m_Versions.mesh;
+    // Attached reference points move with their planes.
+    const bool referencePointsChanged = versions.referencePoints != m_Versions.referencePoints || planesChanged;
+    const bool collidersChanged = versions.colliders != m_Versions.colliders;
+    m_Versions = versions;
+
+    std::vector<Query*> screenPointQueries;
+    std::vector<Query*> rayQueries;
+    for (auto& iter : m_Queries)
+    {
+        Query& query = iter.second;
+        const bool isDirty = query.isDirty ||
+            (query.isScreenPoint && cameraChanged) ||
+            ((query.hitFlags & kUnityXRTrackableTypePlanes) && planesChanged) ||
+            ((query.hitFlags & kUnityXRTrackableTypePoint) && pointsChanged) ||
+            ((query.hitFlags & kUnityXRMockTrackableTypeMesh) && meshChanged) ||
+            ((query.hitFlags & kUnityXRMockTrackableTypeReferencePoint) && referencePointsChanged) ||
+            ((query.hitFlags & kUnityXRMockTrackableTypeCollider) && collidersChanged);
+
+        if (isDirty)
+            (query.isScreenPoint ? screenPointQueries : rayQueries).push_back(&query);
+    }
+
+    // Queries with the same hit flags are cast as one batch.
+    std::vector<UnityXRVector2> screenPoints;
+    std::vector<Ray> rays;
+    std::vector<UnityXRRaycastHit> hits;
+    std::vector<int> offsets;
+    for (auto* queries : { &screenPointQueries, &rayQueries })
+    {
+        std::sort(queries->begin(), queries->end(), [](const Query* a, const Query* b)
+        {
+            return a->hitFlags < b->hitFlags;
+        });
+
+        for (size_t begin = 0; begin < queries->size();)
+        {
+            const uint32_t hitFlags = (*queries)[begin]->hitFlags;
+            size_t end = begin + 1;
+            while (end < queries->size() && (*queries)[end]->hitFlags == hitFlags)
+                ++end;
+
+            screenPoints.clear();
+            rays.clear();
+            for (size_t i = begin; i < end; ++i)
+            {
+                screenPoints.push_back((*queries)[i]->screenPoint);
+                rays.push_back((*queries)[i]->ray);
+            }
+
+            const bool isScreenPoint = queries == &screenPointQueries;
+            raycastProvider->RaycastBatch(
+                isScreenPoint ? screenPoints.data() : nullptr, rays.data(), end - begin, hitFlags, hits, offsets);
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                Query& query = *(*queries)[i];
+                query.hits.assign(hits.begin() + offsets[i - begin], hits.begin() + offsets[i - begin + 1]);
+                query.isDirty = false;
+            }
+
+            begin = end;
+        }
+    }
+}
+
+int PersistentRaycasts::CopyHits(const int* ids, int count, UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Update();
+
+    int numHits = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (hitOffsetsOut)
+            hitOffsetsOut[i] = numHits;
+
+        const auto iter = m_Queries.find(ids[i]);
+        if (iter != m_Queries.end())
+            numHits += static_cast<int>(iter->second.hits.size());
+    }
+
+    if (hitOffsetsOut)
+        hitOffsetsOut[std::max(count, 0)] = numHits;
+
+    if (hitsOut == nullptr || numHits > hitCapacity)
+        return numHits;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const auto iter = m_Queries.find(ids[i]);
+        if (iter != m_Queries.end())
+            hitsOut = std::copy(iter->second.hits.begin(), iter->second.hits.end(), hitsOut);
+    }
+
+    return numHits;
+}
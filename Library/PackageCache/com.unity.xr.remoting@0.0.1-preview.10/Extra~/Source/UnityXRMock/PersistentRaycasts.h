@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+#include "Singleton.h"
+#include "Ray.h"
+#include "RaycastVersions.h"
+
+// Raycasts registered once and read back every frame. Results are cached and
+// a query is only cast again when something it depends on has changed: the
+// camera for screen points, and the trackables and colliders it hits. Lives
+// as long as the plugin, so ids are never reused.
+class PersistentRaycasts : public Singleton<PersistentRaycasts>
+{
+public:
+
+    // Return the id of the new query.
+    int AddScreenPoint(float screenX, float screenY, uint32_t hitFlags);
+
+    int AddRay(const Ray& ray, uint32_t hitFlags);
+
+    bool Remove(int id);
+
+    // Removes every query.
+    void Clear();
+
+    // Brings the queries up to date, then writes count + 1 offsets and, if
+    // they fit, the hits of each query in ids, nearest first, as for
+    // UnityXRMock_raycastScreenPoints. Unknown ids have no hits. Returns the
+    // total number of hits.
+    int CopyHits(const int* ids, int count, UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut);
+
+private:
+
+    struct Query
+    {
+        bool isScreenPoint;
+        UnityXRVector2 screenPoint;
+        Ray ray;
+        uint32_t hitFlags;
+        std::vector<UnityXRRaycastHit> hits;
+        bool isDirty;
+    };
+
+    void Update();
+
+    int Add(const Query& query);
+
+    std::unordered_map<int, Query> m_Queries;
+
+    int m_NextId = 1;
+
+    RaycastVersions m_Versions = {};
+
+    std::mutex m_Mutex;
+};
@@ -0,0 +1,774 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "PlaneEstimator.h"
+#include "PlaneProvider.h"
+#include "DepthProvider.h"
+#include "InputProvider.h"
+#include "UnityMath.h"
+#include "WorkerPool.h"
+
+// How often the estimator thread checks for a new cloud when no frame asks it to.
+static const std::chrono::milliseconds kIdlePollInterval(33);
+
+// Planes that cannot be re-fitted for this many clouds in a row are removed.
+static const int kMaxMissedPasses = 3;
+
+static const size_t kMaxNeighborsForNormal = 32;
+static const size_t kMaxScoringSamples = 2048;
+static const size_t kHypothesesPerIteration = 32;
+static const int kMaxFailedIterations = 8;
+
+// Points a new cloud is prepared in between checks of the deadline.
+static const size_t kPreparePointsPerStep = 4096;
+
+// Cells are clamped to this many from the origin along each axis.
+static const int64_t kMaxCellCoordinate = (1 << 20) - 1;
+
+extern "C"
+{
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setPlaneEstimationEnabled(bool enabled)
+    {
+        if (PlaneEstimator* planeEstimator = PlaneEstimator::GetInstance())
+            planeEstimator->SetEnabled(enabled);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setPlaneEstimationSettings(
+        float timeBudgetMilliseconds, float distanceThreshold, float normalThresholdDegrees,
+        float neighborRadius, int minInliers)
+    {
+        if (PlaneEstimator::GetInstance() == nullptr)
+            return;
+
+        PlaneEstimatorSettings settings;
+        settings.timeBudgetMilliseconds = std::max(timeBudgetMilliseconds, 0.f);
+        settings.distanceThreshold = distanceThreshold;
+        settings.normalThresholdDegrees = normalThresholdDegrees;
+        settings.neighborRadius = neighborRadius;
+        settings.minInliers = std::max(minInliers, 3);
+        if (distanceThreshold <= 0.f || neighborRadius <= 0.f)
+            return;
+
+        PlaneEstimator::GetInstance()->SetSettings(settings);
+    }
+}
+
+static inline float CosDegrees(float degrees)
+{
+    return std::cos(degrees * 3.1415926f / 180.f);
+}
+
+// Eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix, by Jacobi rotations.
+static UnityXRVector3 SmallestEigenvector(float a[3][3])
+{
+    float v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    static const int kPairs[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+
+    for (int sweep = 0; sweep < 8; ++sweep)
+    {
+        for (const auto& pair : kPairs)
+        {
+            const int p = pair[0];
+            const int q = pair[1];
+            if (std::abs(a[p][q]) < 1e-12f)
+                continue;
+
+            const float theta = (a[q][q] - a[p][p]) / (2.f * a[p][q]);
+            const float t = (theta >= 0.f ? 1.f : -1.f) / (std::abs(theta) + std::sqrt(theta * theta + 1.f));
+            const float c = 1.f / std::sqrt(t * t + 1.f);
+            const float s = t * c;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                const float akp = a[k][p];
+                const float akq = a[k][q];
+                a[k][p] = c * akp - s * akq;
+                a[k][q] = s * akp + c * akq;
+            }
+
+            for (int k = 0; k < 3; ++k)
+            {
+                const float apk = a[p][k];
+                const float aqk = a[q][k];
+                a[p][k] = c * apk - s * aqk;
+                a[q][k] = s * apk + c * aqk;
+            }
+
+            for (int k = 0; k < 3; ++k)
+            {
+                const float vkp = v[k][p];
+                const float vkq = v[k][q];
+                v[k][p] = c * vkp - s * vkq;
+                v[k][q] = s * vkp + c * vkq;
+            }
+        }
+    }
+
+    int smallest = 0;
+    for (int i = 1; i < 3; ++i)
+    {
+        if (a[i][i] < a[smallest][smallest])
+            smallest = i;
+    }
+
+    return UnityXRVector3{ v[0][smallest], v[1][smallest], v[2][smallest] };
+}
+
+// Least squares plane normal of positions around their centroid.
+template<typename T_GetPosition>
+static UnityXRVector3 FitNormal(size_t count, T_GetPosition getPosition, UnityXRVector3* centroidOut)
+{
+    UnityXRVector3 centroid = {};
+    for (size_t i = 0; i < count; ++i)
+        centroid = Add(centroid, getPosition(i));
+    centroid = Mul(centroid, 1.f / count);
+
+    float covariance[3][3] = {};
+    for (size_t i = 0; i < count; ++i)
+    {
+        const UnityXRVector3 d = Sub(getPosition(i), centroid);
+        const float components[3] = { d.x, d.y, d.z };
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = r; c < 3; ++c)
+                covariance[r][c] += components[r] * components[c];
+        }
+    }
+
+    covariance[1][0] = covariance[0][1];
+    covariance[2][0] = covariance[0][2];
+    covariance[2][1] = covariance[1][2];
+
+    *centroidOut = centroid;
+    return Normalize(SmallestEigenvector(covariance));
+}
+
+static inline bool IsInlier(
+    const UnityXRVector3& position, const UnityXRVector3& normal,
+    const UnityXRVector3& planeNormal, float planeOffset,
+    float distanceThreshold, float cosNormalThreshold)
+{
+    if (std::abs(Dot(planeNormal, position) - planeOffset) > distanceThreshold)
+        return false;
+
+    // Points without a normal are accepted on distance alone.
+    const bool hasNormal = LengthSquared(normal) > 0.f;
+    return !hasNormal || std::abs(Dot(planeNormal, normal)) >= cosNormalThreshold;
+}
+
+static inline float Cross2d(const UnityXRVector2& o, const UnityXRVector2& a, const UnityXRVector2& b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Andrew's monotone chain. Sorts points; returns the hull counter-clockwise.
+static std::vector<UnityXRVector2> ConvexHull(std::vector<UnityXRVector2>& points)
+{
+    std::sort(points.begin(), points.end(), [](const UnityXRVector2& a, const UnityXRVector2& b)
+    {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+
+    std::vector<UnityXRVector2> hull(points.size() * 2);
+    size_t k = 0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        while (k >= 2 && Cross2d(hull[k - 2], hull[k - 1], points[i]) <= 0.f)
+            --k;
+        hull[k++] = points[i];
+    }
+
+    for (size_t i = points.size() - 1, lower = k + 1; i > 0; --i)
+    {
+        while (k >= lower && Cross2d(hull[k - 2], hull[k - 1], points[i - 1]) <= 0.f)
+            --k;
+        hull[k++] = points[i - 1];
+    }
+
+    hull.resize(k > 1 ? k - 1 : k);
+    return hull;
+}
+
+PlaneEstimator::PlaneEstimator()
+    : m_Thread(&PlaneEstimator::ThreadLoop, this)
+{ }
+
+PlaneEstimator::~PlaneEstimator()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+
+    RemovePlanes();
+}
+
+void PlaneEstimator::SetEnabled(bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Enabled = enabled;
+    }
+    m_Condition.notify_all();
+}
+
+void PlaneEstimator::SetSettings(const PlaneEstimatorSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Settings = settings;
+    m_SettingsChanged = true;
+}
+
+void PlaneEstimator::RequestUpdate()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!m_Enabled)
+            return;
+
+        m_UpdateRequested = true;
+    }
+    m_Condition.notify_one();
+}
+
+void PlaneEstimator::ThreadLoop()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    for (;;)
+    {
+        if (m_Enabled)
+            m_Condition.wait_for(lock, kIdlePollInterval, [this] { return m_Quit || m_UpdateRequested || !m_Enabled; });
+        else
+            m_Condition.wait(lock, [this] { return m_Quit || m_Enabled; });
+
+        if (m_Quit)
+            return;
+
+        // Only this thread touches the planes, so it removes them too.
+        if (!m_Enabled)
+        {
+            lock.unlock();
+            RemovePlanes();
+            lock.lock();
+            continue;
+        }
+
+        m_UpdateRequested = false;
+        const PlaneEstimatorSettings settings = m_Settings;
+        const bool settingsChanged = m_SettingsChanged;
+        m_SettingsChanged = false;
+        lock.unlock();
+
+        const auto budget = std::chrono::duration<float, std::milli>(settings.timeBudgetMilliseconds);
+        RunPass(settings, settingsChanged, Clock::now() + std::chrono::duration_cast<Clock::duration>(budget));
+
+        lock.lock();
+    }
+}
+
+void PlaneEstimator::RunPass(const PlaneEstimatorSettings& settings, bool settingsChanged, Clock::time_point deadline)
+{
+    DepthProvider* depthProvider = DepthProvider::GetInstance();
+    if (depthProvider == nullptr || PlaneProvider::GetInstance() == nullptr)
+        return;
+
+    // A grid is only good for the radius it was built with.
+    if (settingsChanged)
+    {
+        m_HasCloud = false;
+        m_IsPreparing = false;
+    }
+
+    // A cloud being prepared is finished before a newer one is started, so
+    // versions bumped faster than that do not restart it.
+    if (!m_IsPreparing && (!m_HasCloud || depthProvider->GetVersion() != m_Cloud.version))
+        BeginCloud(settings);
+
+    if (m_IsPreparing)
+    {
+        // Half the budget is kept for the current cloud, if there is one.
+        const Clock::time_point now = Clock::now();
+        const Clock::time_point prepareDeadline = m_HasCloud ? now + (deadline - now) / 2 : deadline;
+        if (PrepareCloud(settings, prepareDeadline) &&
+            (!m_HasCloud || (m_NextRefit >= m_Planes.size() && m_HasSearched)))
+            AdoptNextCloud();
+    }
+
+    if (!m_HasCloud)
+        return;
+
+    // Re-fitting many planes can take longer than the budget, in which case
+    // it carries on in the next pass and the search waits for it.
+    if (m_NextRefit < m_Planes.size())
+    {
+        RefitPlanes(settings, deadline);
+        if (m_NextRefit < m_Planes.size())
+            return;
+    }
+
+    if (!m_SearchExhausted)
+        SearchPlanes(settings, deadline);
+
+    m_HasSearched = true;
+}
+
+void PlaneEstimator::BeginCloud(const PlaneEstimatorSettings& settings)
+{
+    Cloud& cloud = m_NextCloud;
+    cloud.version = DepthProvider::GetInstance()->CopyPositions(cloud.points);
+    cloud.cellSize = settings.neighborRadius;
+    cloud.cells.clear();
+    cloud.cellIndices.resize(cloud.points.size());
+    cloud.normals.assign(cloud.points.size(), UnityXRVector3{});
+
+    m_NextCellKeys.resize(cloud.points.size());
+    m_PrepareStage = kPrepareStageCountCells;
+    m_NextPrepared = 0;
+    m_IsPreparing = true;
+}
+
+bool PlaneEstimator::PrepareCloud(const PlaneEstimatorSettings& settings, Clock::time_point deadline)
+{
+    Cloud& cloud = m_NextCloud;
+    const size_t numPoints = cloud.points.size();
+
+    // At least one step is taken per pass, so a small budget still gets
+    // through a large cloud.
+    do
+    {
+        const size_t begin = m_NextPrepared;
+        const size_t end = std::min(begin + kPreparePointsPerStep, numPoints);
+        switch (m_PrepareStage)
+        {
+        case kPrepareStageCountCells:
+            // Each cell's end counts its points until they are all seen.
+            for (size_t i = begin; i < end; ++i)
+            {
+                m_NextCellKeys[i] = CellKey(cloud.points[i], cloud.cellSize);
+                ++cloud.cells[m_NextCellKeys[i]].end;
+            }
+            break;
+
+        case kPrepareStageFillCells:
+            for (size_t i = begin; i < end; ++i)
+            {
+                CellRange& range = cloud.cells.find(m_NextCellKeys[i])->second;
+                cloud.cellIndices[range.end++] = static_cast<uint32_t>(i);
+            }
+            break;
+
+        case kPrepareStageNormals:
+            EstimateNormals(cloud, begin, end, settings);
+            break;
+
+        case kPrepareStageDone:
+            return true;
+        }
+
+        m_NextPrepared = end;
+        if (m_NextPrepared < numPoints)
+            continue;
+
+        // Turns the counts into empty ranges for the points to be filled in.
+        if (m_PrepareStage == kPrepareStageCountCells)
+        {
+            uint32_t offset = 0;
+            for (auto& cell : cloud.cells)
+            {
+                const uint32_t count = cell.second.end;
+                cell.second = CellRange{ offset, offset };
+                offset += count;
+            }
+        }
+
+        m_PrepareStage = static_cast<PrepareStage>(m_PrepareStage + 1);
+        m_NextPrepared = 0;
+    }
+    while (Clock::now() < deadline);
+
+    return m_PrepareStage == kPrepareStageDone;
+}
+
+void PlaneEstimator::AdoptNextCloud()
+{
+    std::swap(m_Cloud, m_NextCloud);
+    m_Assigned.assign(m_Cloud.points.size(), 0);
+    m_HasCloud = true;
+    m_IsPreparing = false;
+
+    m_NextRefit = 0;
+    m_SearchExhausted = false;
+    m_HasSearched = false;
+}
+
+// Coordinates past kMaxCellCoordinate, and NaN, go to the border cells, as
+// in TrackableGrid, rather than overflowing the cast.
+static inline uint64_t CellCoordinate(float position, float cellSize)
+{
+    const float coordinate = std::floor(position / cellSize);
+    const int64_t clamped = coordinate < static_cast<float>(kMaxCellCoordinate)
+        ? (coordinate > static_cast<float>(-kMaxCellCoordinate) ? static_cast<int64_t>(coordinate) : -kMaxCellCoordinate)
+        : kMaxCellCoordinate;
+
+    return static_cast<uint64_t>(clamped) & ((1 << 21) - 1);
+}
+
+uint64_t PlaneEstimator::CellKey(const UnityXRVector3& position, float cellSize)
+{
+    return (CellCoordinate(position.x, cellSize) << 42) |
+        (CellCoordinate(position.y, cellSize) << 21) |
+        CellCoordinate(position.z, cellSize);
+}
+
+// Calls function with the index of every point in the 27 cells around position.
+template<typename T_Function>
+void PlaneEstimator::ForEachNeighbor(const Cloud& cloud, const UnityXRVector3& position, T_Function function)
+{
+    for (int dx = -1; dx <= 1; ++dx)
+    {
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dz = -1; dz <= 1; ++dz)
+            {
+                const UnityXRVector3 cellPosition =
+                {
+                    position.x + dx * cloud.cellSize,
+                    position.y + dy * cloud.cellSize,
+                    position.z + dz * cloud.cellSize
+                };
+
+                const auto iter = cloud.cells.find(CellKey(cellPosition, cloud.cellSize));
+                if (iter == cloud.cells.end())
+                    continue;
+
+                for (uint32_t i = iter->second.begin; i < iter->second.end; ++i)
+                    function(cloud.cellIndices[i]);
+            }
+        }
+    }
+}
+
+void PlaneEstimator::EstimateNormals(Cloud& cloud, size_t begin, size_t end, const PlaneEstimatorSettings& settings) const
+{
+    const float radiusSquared = settings.neighborRadius * settings.neighborRadius;
+
+    RunParallelFor(end - begin, 256, [&](size_t rangeBegin, size_t rangeEnd)
+    {
+        uint32_t neighbors[kMaxNeighborsForNormal];
+        for (size_t i = begin + rangeBegin; i < begin + rangeEnd; ++i)
+        {
+            const UnityXRVector3& position = cloud.points[i];
+            size_t numNeighbors = 0;
+            ForEachNeighbor(cloud, position, [&](uint32_t j)
+            {
+                if (numNeighbors < kMaxNeighborsForNormal && LengthSquared(Sub(cloud.points[j], position)) <= radiusSquared)
+                    neighbors[numNeighbors++] = j;
+            });
+
+            if (numNeighbors < 5)
+                continue;
+
+            UnityXRVector3 centroid;
+            cloud.normals[i] = FitNormal(numNeighbors, [&](size_t k) { return cloud.points[neighbors[k]]; }, &centroid);
+        }
+    });
+}
+
+void PlaneEstimator::FindLargestRegion(const Model& model, const PlaneEstimatorSettings& settings, std::vector<uint32_t>& regionOut)
+{
+    // 0: not a candidate, 1: unvisited inlier, 2: visited
+    std::vector<uint8_t> state(m_Cloud.points.size());
+    const float cosNormalThreshold = CosDegrees(settings.normalThresholdDegrees);
+    RunParallelFor(m_Cloud.points.size(), 1024, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            state[i] = !m_Assigned[i] && IsInlier(m_Cloud.points[i], m_Cloud.normals[i],
+                model.normal, model.offset, settings.distanceThreshold, cosNormalThreshold) ? 1 : 0;
+        }
+    });
+
+    const float radiusSquared = settings.neighborRadius * settings.neighborRadius;
+    std::vector<uint32_t> component;
+    regionOut.clear();
+    for (size_t seed = 0; seed < m_Cloud.points.size(); ++seed)
+    {
+        if (state[seed] != 1)
+            continue;
+
+        state[seed] = 2;
+        component.clear();
+        component.push_back(static_cast<uint32_t>(seed));
+        for (size_t k = 0; k < component.size(); ++k)
+        {
+            const UnityXRVector3 position = m_Cloud.points[component[k]];
+            ForEachNeighbor(m_Cloud, position, [&](uint32_t j)
+            {
+                if (state[j] == 1 && LengthSquared(Sub(m_Cloud.points[j], position)) <= radiusSquared)
+                {
+                    state[j] = 2;
+                    component.push_back(j);
+                }
+            });
+        }
+
+        if (component.size() > regionOut.size())
+            std::swap(component, regionOut);
+    }
+}
+
+PlaneEstimator::Model PlaneEstimator::FitModel(const std::vector<uint32_t>& region, const UnityXRVector3& referenceNormal) const
+{
+    UnityXRVector3 centroid;
+    UnityXRVector3 normal = FitNormal(region.size(), [&](size_t k) { return m_Cloud.points[region[k]]; }, &centroid);
+    if (Dot(normal, referenceNormal) < 0.f)
+        normal = Mul(normal, -1.f);
+
+    return Model{ normal, Dot(normal, centroid) };
+}
+
+void PlaneEstimator::RefitPlanes(const PlaneEstimatorSettings& settings, Clock::time_point deadline)
+{
+    PlaneProvider* planeProvider = PlaneProvider::GetInstance();
+    std::vector<uint32_t> region;
+
+    // At least one plane is re-fitted per pass, so a small budget still
+    // gets through them.
+    while (m_NextRefit < m_Planes.size())
+    {
+        EstimatedPlane& plane = m_Planes[m_NextRefit];
+        FindLargestRegion(plane.model, settings, region);
+        if (region.size() >= static_cast<size_t>(settings.minInliers))
+        {
+            plane.model = FitModel(region, plane.model.normal);
+            plane.missedPasses = 0;
+            for (uint32_t index : region)
+                m_Assigned[index] = 1;
+
+            Publish(plane, region);
+            ++m_NextRefit;
+        }
+        else if (++plane.missedPasses > kMaxMissedPasses)
+        {
+            planeProvider->RemovePlane(plane.id);
+            m_Planes.erase(m_Planes.begin() + m_NextRefit);
+        }
+        else
+        {
+            ++m_NextRefit;
+        }
+
+        if (Clock::now() >= deadline)
+            return;
+    }
+}
+
+void PlaneEstimator::SearchPlanes(const PlaneEstimatorSettings& settings, Clock::time_point deadline)
+{
+    const float cosNormalThreshold = CosDegrees(settings.normalThresholdDegrees);
+    const float cosMatchThreshold = CosDegrees(settings.normalThresholdDegrees * .5f);
+
+    std::vector<uint32_t> unassigned;
+    std::vector<uint32_t> samples;
+    std::vector<uint32_t> region;
+    std::vector<Model> hypotheses(kHypothesesPerIteration);
+    std::vector<size_t> scores(kHypothesesPerIteration);
+    int numFailedIterations = 0;
+
+    while (Clock::now() < deadline)
+    {
+        unassigned.clear();
+        for (size_t i = 0; i < m_Cloud.points.size(); ++i)
+        {
+            if (!m_Assigned[i])
+                unassigned.push_back(static_cast<uint32_t>(i));
+        }
+
+        if (unassigned.size() < static_cast<size_t>(settings.minInliers) || numFailedIterations >= kMaxFailedIterations)
+        {
+            m_SearchExhausted = true;
+            return;
+        }
+
+        std::uniform_int_distribution<size_t> pick(0, unassigned.size() - 1);
+        samples.resize(std::min(unassigned.size(), kMaxScoringSamples));
+        for (auto& sample : samples)
+            sample = unassigned[pick(m_Random)];
+
+        // A point with a normal defines a plane on its own; fall back to
+        // three points where there were too few neighbors for a normal.
+        for (auto& hypothesis : hypotheses)
+        {
+            const uint32_t a = unassigned[pick(m_Random)];
+            UnityXRVector3 normal = m_Cloud.normals[a];
+            if (LengthSquared(normal) == 0.f)
+            {
+                const UnityXRVector3& pa = m_Cloud.points[a];
+                normal = Cross(Sub(m_Cloud.points[unassigned[pick(m_Random)]], pa), Sub(m_Cloud.points[unassigned[pick(m_Random)]], pa));
+                const float length = Length(normal);
+                normal = length > 1e-6f ? Mul(normal, 1.f / length) : UnityXRVector3{};
+            }
+
+            hypothesis = Model{ normal, Dot(normal, m_Cloud.points[a]) };
+        }
+
+        RunParallelFor(hypotheses.size(), 4, [&](size_t begin, size_t end)
+        {
+            for (size_t h = begin; h < end; ++h)
+            {
+                scores[h] = 0;
+                if (LengthSquared(hypotheses[h].normal) == 0.f)
+                    continue;
+
+                for (uint32_t sample : samples)
+                {
+                    if (IsInlier(m_Cloud.points[sample], m_Cloud.normals[sample], hypotheses[h].normal,
+                            hypotheses[h].offset, settings.distanceThreshold, cosNormalThreshold))
+                        ++scores[h];
+                }
+            }
+        });
+
+        const size_t best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+        const size_t expectedInliers = scores[best] * unassigned.size() / samples.size();
+        if (expectedInliers < static_cast<size_t>(settings.minInliers))
+        {
+            ++numFailedIterations;
+            continue;
+        }
+
+        FindLargestRegion(hypotheses[best], settings, region);
+        if (region.size() < static_cast<size_t>(settings.minInliers))
+        {
+            ++numFailedIterations;
+            continue;
+        }
+
+        const Model model = FitModel(region, hypotheses[best].normal);
+
+        // A plane that lost its points in this cloud but is found again
+        // nearby keeps its id.
+        EstimatedPlane* match = nullptr;
+        for (auto& plane : m_Planes)
+        {
+            const float sign = Dot(plane.model.normal, model.normal) < 0.f ? -1.f : 1.f;
+            if (plane.missedPasses > 0 &&
+                sign * Dot(plane.model.normal, model.normal) >= cosMatchThreshold &&
+                std::abs(plane.model.offset - sign * model.offset) <= 2.f * settings.distanceThreshold)
+            {
+                match = &plane;
+                break;
+            }
+        }
+
+        if (match == nullptr)
+        {
+            // The region is left unassigned for a later pass to claim.
+            const UnityXRTrackableId id = GenerateTrackableId();
+            if (id == kInvalidId)
+            {
+                ++numFailedIterations;
+                continue;
+            }
+
+            // Fitted to the current cloud already.
+            m_Planes.push_back(EstimatedPlane{ id, model, 0 });
+            m_NextRefit = m_Planes.size();
+            match = &m_Planes.back();
+        }
+
+        numFailedIterations = 0;
+        for (uint32_t index : region)
+            m_Assigned[index] = 1;
+
+        match->model = model;
+        match->missedPasses = 0;
+        Publish(*match, region);
+    }
+}
+
+void PlaneEstimator::Publish(const EstimatedPlane& estimatedPlane, const std::vector<uint32_t>& region) const
+{
+    PlaneProvider* planeProvider = PlaneProvider::GetInstance();
+    if (planeProvider == nullptr)
+        return;
+
+    UnityXRVector3 centroid = {};
+    for (uint32_t index : region)
+        centroid = Add(centroid, m_Cloud.points[index]);
+    centroid = Mul(centroid, 1.f / region.size());
+
+    // Face the camera so that raycasts from it hit the front of the plane.
+    UnityXRVector3 normal = estimatedPlane.model.normal;
+    UnityXRMatrix4x4 cameraTransform;
+    if (InputProvider::TryGetTransform(&cameraTransform))
+    {
+        const UnityXRVector3 cameraPosition = { cameraTransform.columns[3].x, cameraTransform.columns[3].y, cameraTransform.columns[3].z };
+        if (Dot(normal, Sub(cameraPosition, centroid)) < 0.f)
+            normal = Mul(normal, -1.f);
+    }
+    else if (normal.y < 0.f)
+    {
+        normal = Mul(normal, -1.f);
+    }
+
+    const Model& model = estimatedPlane.model;
+    const UnityXRVector3 origin = Sub(centroid, Mul(model.normal, Dot(model.normal, centroid) - model.offset));
+    const UnityXRVector4 rotation = RotationFromUp(normal);
+    const UnityXRVector4 invRotation = Inverse(rotation);
+
+    std::vector<UnityXRVector2> pointsInPlaneSpace(region.size());
+    for (size_t i = 0; i < region.size(); ++i)
+    {
+        const UnityXRVector3 local = Mul(invRotation, Sub(m_Cloud.points[region[i]], origin));
+        pointsInPlaneSpace[i] = UnityXRVector2{ local.x, local.z };
+    }
+
+    const std::vector<UnityXRVector2> hull = ConvexHull(pointsInPlaneSpace);
+
+    UnityXRVector2 min = hull.front();
+    UnityXRVector2 max = hull.front();
+    for (const auto& point : hull)
+    {
+        min.x = std::min(min.x, point.x);
+        min.y = std::min(min.y, point.y);
+        max.x = std::max(max.x, point.x);
+        max.y = std::max(max.y, point.y);
+    }
+
+    const UnityXRVector3 center = Add(origin, Mul(rotation, UnityXRVector3{ (min.x + max.x) * .5f, 0, (min.y + max.y) * .5f }));
+
+    PlaneWithBoundary plane;
+    plane.plane.id = estimatedPlane.id;
+    plane.plane.center = center;
+    plane.plane.pose.position = center;
+    plane.plane.pose.rotation = rotation;
+    plane.plane.bounds = UnityXRVector2{ max.x - min.x, max.y - min.y };
+    plane.plane.wasUpdated = true;
+    plane.plane.wasMerged = false;
+    plane.plane.mergedInto = kInvalidId;
+    plane.isEstimated = true;
+
+    plane.boundaryPoints.reserve(hull.size());
+    for (const auto& point : hull)
+        plane.boundaryPoints.push_back(Add(origin, Mul(rotation, UnityXRVector3{ point.x, 0, point.y })));
+
+    planeProvider->SetPlaneData(plane);
+}
+
+void PlaneEstimator::RemovePlanes()
+{
+    if (PlaneProvider* planeProvider = PlaneProvider::GetInstance())
+    {
+        for (const auto& plane : m_Planes)
+            planeProvider->RemovePlane(plane.id);
+    }
+
+    m_Planes.clear();
+    m_NextRefit = 0;
+    m_HasCloud = false;
+    m_IsPreparing = false;
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "UnityXRTypes.h"
+#include "TrackableIdHelpers.h"
+#include "Singleton.h"
+
+struct PlaneEstimatorSettings
+{
+    // Time the estimator may spend searching for new planes per frame.
+    float timeBudgetMilliseconds = 4.f;
+
+    // Maximum distance of an inlier from its plane, in meters.
+    float distanceThreshold = .03f;
+
+    // Maximum angle between an inlier's normal and its plane's normal.
+    float normalThresholdDegrees = 15.f;
+
+    // Neighborhood used for point normals and region growing, in meters.
+    float neighborRadius = .1f;
+
+    int minInliers = 64;
+};
+
+// Fits planes to DepthProvider's point cloud on a background thread and
+// publishes them to PlaneProvider as estimated planes. Planes found in earlier
+// passes are re-fitted to a new cloud first, so they keep their ids and only
+// the points they do not explain go through RANSAC. A new cloud's grid and
+// normals are built over as many passes as the budget needs while the planes
+// keep being fitted to the current one. The estimator lives as long as the
+// plugin; its thread sleeps while estimation is disabled.
+class PlaneEstimator : public Singleton<PlaneEstimator>
+{
+public:
+
+    PlaneEstimator();
+
+    ~PlaneEstimator();
+
+    // Disabling removes the estimated planes.
+    void SetEnabled(bool enabled);
+
+    void SetSettings(const PlaneEstimatorSettings& settings);
+
+    // Wakes the estimator for one time-budgeted pass if it is enabled.
+    // Called once per frame.
+    void RequestUpdate();
+
+private:
+
+    struct Model
+    {
+        UnityXRVector3 normal;
+
+        // Dot(normal, p) == offset for points p on the plane.
+        float offset;
+    };
+
+    struct EstimatedPlane
+    {
+        UnityXRTrackableId id;
+        Model model;
+        int missedPasses;
+    };
+
+    struct CellRange
+    {
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    // A snapshot of the point cloud with what the search needs of it.
+    struct Cloud
+    {
+        std::vector<UnityXRVector3> points;
+
+        // Zero for points with too few neighbors to estimate a normal.
+        std::vector<UnityXRVector3> normals;
+
+        // Indices of points bucketed into cubic cells of neighborRadius.
+        std::unordered_map<uint64_t, CellRange> cells;
+
+        std::vector<uint32_t> cellIndices;
+
+        float cellSize = 0.f;
+
+        uint64_t version = 0;
+    };
+
+    // The steps building m_NextCloud, each taken a range of points at a time.
+    enum PrepareStage
+    {
+        kPrepareStageCountCells,
+        kPrepareStageFillCells,
+        kPrepareStageNormals,
+        kPrepareStageDone
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    void ThreadLoop();
+
+    void RunPass(const PlaneEstimatorSettings& settings, bool settingsChanged, Clock::time_point deadline);
+
+    void BeginCloud(const PlaneEstimatorSettings& settings);
+
+    // Returns true once m_NextCloud is ready to replace m_Cloud.
+    bool PrepareCloud(const PlaneEstimatorSettings& settings, Clock::time_point deadline);
+
+    void EstimateNormals(Cloud& cloud, size_t begin, size_t end, const PlaneEstimatorSettings& settings) const;
+
+    void AdoptNextCloud();
+
+    void RefitPlanes(const PlaneEstimatorSettings& settings, Clock::time_point deadline);
+
+    void SearchPlanes(const PlaneEstimatorSettings& settings, Clock::time_point deadline);
+
+    void FindLargestRegion(const Model& model, const PlaneEstimatorSettings& settings, std::vector<uint32_t>& regionOut);
+
+    Model FitModel(const std::vector<uint32_t>& region, const UnityXRVector3& referenceNormal) const;
+
+    void Publish(const EstimatedPlane& plane, const std::vector<uint32_t>& region) const;
+
+    void RemovePlanes();
+
+    template<typename T_Function>
+    static void ForEachNeighbor(const Cloud& cloud, const UnityXRVector3& position, T_Function function);
+
+    static uint64_t CellKey(const UnityXRVector3& position, float cellSize);
+
+    // The cloud the current planes are fitted to.
+    Cloud m_Cloud;
+
+    // Non-zero for points of m_Cloud that belong to a plane.
+    std::vector<uint8_t> m_Assigned;
+
+    bool m_HasCloud = false;
+
+    bool m_SearchExhausted = false;
+
+    // Set once the search has run on m_Cloud, which is only replaced after
+    // that so a stream of new clouds cannot starve it.
+    bool m_HasSearched = false;
+
+    // A newer cloud being prepared, and its cell keys by point.
+    Cloud m_NextCloud;
+
+    std::vector<uint64_t> m_NextCellKeys;
+
+    PrepareStage m_PrepareStage = kPrepareStageDone;
+
+    // Points of m_NextCloud the current stage has been through.
+    size_t m_NextPrepared = 0;
+
+    bool m_IsPreparing = false;
+
+    std::vector<EstimatedPlane> m_Planes;
+
+    // m_Planes before this index have been re-fitted to the current cloud.
+    size_t m_NextRefit = 0;
+
+    std::minstd_rand m_Random;
+
+    PlaneEstimatorSettings m_Settings;
+
+    bool m_SettingsChanged = false;
+
+    bool m_Enabled = false;
+
+    bool m_UpdateRequested = false;
+
+    bool m_Quit = false;
+
+    std::mutex m_Mutex;
+
+    std::condition_variable m_Condition;
+
+    std::thread m_Thread;
+};
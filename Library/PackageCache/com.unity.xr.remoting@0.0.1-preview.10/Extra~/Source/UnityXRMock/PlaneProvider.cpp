@@ -1,6 +1,9 @@
 #include <cstring>
 #include "PlaneProvider.h"
+#include "ColliderRegistry.h"
+#include "ReferencePointProvider.h"
 #include "UnityMath.h"
+#include "WorkerPool.h"
 
 extern "C"
 {   
@@ -145,39 +148,107 @@ private:
 
 void PlaneProvider::SetPlaneData(const PlaneWithBoundary& plane)
 {
-    std::lock_guard<std::mutex> lock(m_PlaneMutex);
-    m_Planes[plane.plane.id] = plane;
+    PlaneWithBoundary planeWithCache = plane;
+    planeWithCache.inverseRotation = Inverse(plane.plane.pose.rotation);
+    planeWithCache.boundaryInPlaneSpace.resize(plane.boundaryPoints.size());
+    for (size_t i = 0; i < plane.boundaryPoints.size(); ++i)
+    {
+        const auto pointInPlaneSpace = Mul(planeWithCache.inverseRotation, Sub(plane.boundaryPoints[i], plane.plane.center));
+        planeWithCache.boundaryInPlaneSpace[i] = {pointInPlaneSpace.x, pointInPlaneSpace.z};
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(m_PlaneMutex);
+    planeWithCache.version = ++m_Version;
+    m_Planes[plane.plane.id] = std::move(planeWithCache);
 }
 
 void PlaneProvider::RemovePlane(const UnityXRTrackableId& id)
 {
-    std::lock_guard<std::mutex> lock(m_PlaneMutex);
-    m_Planes.erase(id);
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(m_PlaneMutex);
+        if (m_Planes.erase(id) == 0)
+            return;
+
+        ++m_Version;
+    }
+
+    // Outside the lock, since ReferencePointProvider reads planes under its own.
+    if (auto referencePointProvider = ReferencePointProvider::GetInstance())
+        referencePointProvider->RemoveAttachments(id);
+}
+
+size_t PlaneProvider::GetNumPlanes() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    return m_Planes.size();
 }
 
 bool PlaneProvider::TryGetPlaneWithoutBoundary(const UnityXRTrackableId& planeId, UnityXRPlane* planeOut) const
 {
-    std::lock_guard<std::mutex> lock(m_PlaneMutex);
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    const auto iter = m_Planes.find(planeId);
+    if (iter == m_Planes.end())
+        return false;
+
+    *planeOut = iter->second.plane;
+    return true;
+}
+
+bool PlaneProvider::TryGetPlaneWithoutBoundary(
+    const UnityXRTrackableId& planeId, UnityXRPlane* planeOut, uint64_t* versionOut) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
     const auto iter = m_Planes.find(planeId);
     if (iter == m_Planes.end())
         return false;
 
     *planeOut = iter->second.plane;
+    *versionOut = iter->second.version;
     return true;
 }
 
 IdToUnityXRPlaneMap PlaneProvider::GetPlanesWithoutBoundaries() const
 {
     IdToUnityXRPlaneMap planes;
-    std::lock_guard<std::mutex> lock(m_PlaneMutex);
-    for (auto iter : m_Planes)
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    planes.reserve(m_Planes.size());
+    for (const auto& iter : m_Planes)
         planes[iter.first] = iter.second.plane;
 
     return planes;
 }
 
+std::vector<std::vector<UnityXRVector3>> PlaneProvider::GetPlanePolygons() const
+{
+    std::vector<std::vector<UnityXRVector3>> polygons;
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    polygons.reserve(m_Planes.size());
+    for (const auto& iter : m_Planes)
+    {
+        const auto& boundaryPoints = iter.second.boundaryPoints;
+        if (boundaryPoints.size() >= 3)
+        {
+            polygons.push_back(boundaryPoints);
+            continue;
+        }
+
+        const UnityXRPlane& plane = iter.second.plane;
+        const float halfX = plane.bounds.x * .5f;
+        const float halfZ = plane.bounds.y * .5f;
+        const UnityXRVector3 corners[] = { { -halfX, 0, -halfZ }, { -halfX, 0, halfZ }, { halfX, 0, halfZ }, { halfX, 0, -halfZ } };
+
+        polygons.emplace_back();
+        for (const auto& corner : corners)
+            polygons.back().push_back(Add(plane.center, Mul(plane.pose.rotation, corner)));
+    }
+
+    return polygons;
+}
+
 bool UNITY_INTERFACE_API PlaneProvider::GetAllPlanes(IUnityXRPlaneDataAllocator& allocator)
 {
+    // Exclusive, since wasUpdated is cleared on each plane.
+    std::lock_guard<std::shared_timed_mutex> lock(m_PlaneMutex);
     UnityXRPlane* planesOut = allocator.AllocatePlaneData(m_Planes.size());
     for (auto& iter : m_Planes)
     {
@@ -278,24 +349,42 @@ static inline bool WithinPolygon(
     return WindingNumber(positionInPlaneSpace, boundaryInPlaneSpace) != 0;
 }
 
-std::vector<UnityXRRaycastHit> PlaneProvider::Raycast(const Ray& ray, UnityXRTrackableType hitFlags) const
+void PlaneProvider::Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
 {
-    std::vector<UnityXRRaycastHit> hits;
     if ((hitFlags & kUnityXRTrackableTypePlanes) == kUnityXRTrackableTypeNone)
-        return hits;
+        return;
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    RaycastLocked(ray, hitFlags, hitsOut);
+}
+
+void PlaneProvider::Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const
+{
+    if ((hitFlags & kUnityXRTrackableTypePlanes) == kUnityXRTrackableTypeNone)
+        return;
+
+    // Workers only read m_Planes, which stays locked until every range is done.
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    RunParallelFor(count, kRaycastBatchGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            RaycastLocked(rays[i], hitFlags, hitsOut[i]);
+    });
+}
 
+void PlaneProvider::RaycastLocked(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
     const float eps = 1e-6f;
 
     const bool testWithinInfinity = hitFlags & kUnityXRTrackableTypePlaneWithinInfinity;
     const bool testWithinBounds = hitFlags & kUnityXRTrackableTypePlaneWithinBounds;
     const bool testWithinPolygon = hitFlags & kUnityXRTrackableTypePlaneWithinPolygon;
 
-    std::lock_guard<std::mutex> lock(m_PlaneMutex);
-    for (const auto iter : m_Planes)
+    for (const auto& iter : m_Planes)
     {
         const auto& plane = iter.second.plane;
         const auto& rotation = plane.pose.rotation;
-        const auto invRotation = Inverse(rotation);
+        const auto& invRotation = iter.second.inverseRotation;
         const auto directionInPlaneSpace = Mul(invRotation, ray.direction);
         const float dDotN = directionInPlaneSpace.y;
 
@@ -307,6 +396,8 @@ std::vector<UnityXRRaycastHit> PlaneProvider::Raycast(const Ray& ray, UnityXRTra
         const auto& center = plane.center;
         const auto originInPlaneSpace = Mul(invRotation, Sub(ray.origin, center));
         const float distance = -originInPlaneSpace.y / dDotN;
+        if (distance > hitsOut.GetMaxDistance())
+            continue;
 
         const auto hitPositionPlaneSpace3d = Add(originInPlaneSpace, Mul(directionInPlaneSpace, distance));
         const UnityXRVector2 hitPositionPlaneSpace = {hitPositionPlaneSpace3d.x, hitPositionPlaneSpace3d.z};
@@ -319,20 +410,11 @@ std::vector<UnityXRRaycastHit> PlaneProvider::Raycast(const Ray& ray, UnityXRTra
         if (testWithinBounds && WithinBounds(hitPositionPlaneSpace, plane.bounds))
             hitTeatureFlags = static_cast<UnityXRTrackableType>(hitTeatureFlags | kUnityXRTrackableTypePlaneWithinBounds);
 
-        if (testWithinPolygon)
-        {
-            const auto& boundaryPoints = iter.second.boundaryPoints;
-            std::vector<UnityXRVector2> polygon2d(boundaryPoints.size());
-            for (size_t i = 0; i < boundaryPoints.size(); ++i)
-            {
-                const auto& point = boundaryPoints[i];
-                const auto pointInPlaneSpace = Mul(invRotation, Sub(point, center));
-                polygon2d[i] = {pointInPlaneSpace.x, pointInPlaneSpace.z};
-            }
+        if (testWithinPolygon && WithinPolygon(hitPositionPlaneSpace, iter.second.boundaryInPlaneSpace))
+            hitTeatureFlags = static_cast<UnityXRTrackableType>(hitTeatureFlags | kUnityXRTrackableTypePlaneWithinPolygon);
 
-            if (WithinPolygon(hitPositionPlaneSpace, polygon2d))
-                hitTeatureFlags = static_cast<UnityXRTrackableType>(hitTeatureFlags | kUnityXRTrackableTypePlaneWithinPolygon);
-        }
+        if ((hitFlags & kUnityXRTrackableTypePlaneEstimated) && iter.second.isEstimated)
+            hitTeatureFlags = static_cast<UnityXRTrackableType>(hitTeatureFlags | kUnityXRTrackableTypePlaneEstimated);
 
         if (hitTeatureFlags != kUnityXRTrackableTypeNone)
         {
@@ -342,9 +424,159 @@ std::vector<UnityXRRaycastHit> PlaneProvider::Raycast(const Ray& ray, UnityXRTra
             hit.pose.rotation = rotation;
             hit.distance = distance;
             hit.hitType = hitTeatureFlags;
-            hits.push_back(hit);
+            hitsOut.Add(hit);
         }
     }
+}
+
+// How far a sphere of the given radius moving along ray, all in plane space,
+// travels before it touches the closed outline through points, and where.
+// Edges it overlaps at the origin are not hit.
+static bool SweepSphereToOutline(
+    const Ray& ray, float radius, const UnityXRVector2* points, size_t count, float maxDistance,
+    float* distanceOut, UnityXRVector3* contactOut)
+{
+    bool isHit = false;
+    for (size_t i = 0; count >= 2 && i < count; ++i)
+    {
+        const auto& a = points[i];
+        const auto& b = points[(i + 1) % count];
+        const UnityXRVector3 start = {a.x, 0, a.y};
+        const UnityXRVector3 end = {b.x, 0, b.y};
+        float distance;
+        if (!ColliderRegistry::IntersectCapsule(ray, start, end, radius, &distance) || distance > maxDistance)
+            continue;
 
-    return hits;
+        maxDistance = distance;
+        *distanceOut = distance;
+        *contactOut = ClosestPointOnSegment(Add(ray.origin, Mul(ray.direction, distance)), start, end);
+        isHit = true;
+    }
+
+    return isHit;
+}
+
+void PlaneProvider::SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRTrackableTypePlanes) == kUnityXRTrackableTypeNone)
+        return;
+
+    const float eps = 1e-6f;
+
+    const bool testWithinInfinity = hitFlags & kUnityXRTrackableTypePlaneWithinInfinity;
+    const bool testWithinBounds = hitFlags & kUnityXRTrackableTypePlaneWithinBounds;
+    const bool testWithinPolygon = hitFlags & kUnityXRTrackableTypePlaneWithinPolygon;
+    const bool testEstimated = hitFlags & kUnityXRTrackableTypePlaneEstimated;
+
+    // Each region can be touched at a different distance. Regions touched at
+    // the same point share one hit, as for rays.
+    struct Contact
+    {
+        float distance;
+        UnityXRVector3 positionInPlaneSpace;
+        int hitType;
+    };
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_PlaneMutex);
+    for (const auto& iter : m_Planes)
+    {
+        const auto& plane = iter.second.plane;
+        const auto& invRotation = iter.second.inverseRotation;
+        const Ray rayInPlaneSpace = {Mul(invRotation, Sub(ray.origin, plane.center)), Mul(invRotation, ray.direction)};
+        const auto& origin = rayInPlaneSpace.origin;
+        const auto& direction = rayInPlaneSpace.direction;
+
+        // Like rays, spheres only hit the front of a plane.
+        if (origin.y <= 0.f)
+            continue;
+
+        // A sphere clear of the plane first touches it where it comes down on
+        // it; the region it lands outside of can only be touched at an edge.
+        const bool landsOnPlane = origin.y > radius && direction.y < -eps;
+        if (!landsOnPlane && origin.y > radius)
+            continue;
+
+        float landingDistance = 0.f;
+        UnityXRVector3 landingPosition = {};
+        if (landsOnPlane)
+        {
+            landingDistance = (radius - origin.y) / direction.y;
+            if (landingDistance > hitsOut.GetMaxDistance())
+                continue;
+
+            landingPosition = Add(origin, Mul(direction, landingDistance));
+            landingPosition.y = 0.f;
+        }
+
+        Contact contacts[4];
+        size_t numContacts = 0;
+        auto addContact = [&](float distance, const UnityXRVector3& position, int hitType)
+        {
+            for (size_t i = 0; i < numContacts; ++i)
+            {
+                if (contacts[i].distance == distance)
+                {
+                    contacts[i].hitType |= hitType;
+                    return;
+                }
+            }
+
+            contacts[numContacts++] = Contact{distance, position, hitType};
+        };
+
+        auto addRegionContact = [&](int hitType, bool landsInside, const UnityXRVector2* outline, size_t count)
+        {
+            float distance;
+            UnityXRVector3 position;
+            if (landsInside)
+                addContact(landingDistance, landingPosition, hitType);
+            else if (SweepSphereToOutline(rayInPlaneSpace, radius, outline, count, hitsOut.GetMaxDistance(), &distance, &position))
+                addContact(distance, position, hitType);
+        };
+
+        const UnityXRVector2 landingPositionInPlane = {landingPosition.x, landingPosition.z};
+        if (testWithinInfinity && landsOnPlane)
+            addContact(landingDistance, landingPosition, kUnityXRTrackableTypePlaneWithinInfinity);
+
+        if (testWithinBounds)
+        {
+            const UnityXRVector2 halfExtents = Mul(plane.bounds, .5f);
+            const UnityXRVector2 corners[] =
+            {
+                {-halfExtents.x, -halfExtents.y},
+                {halfExtents.x, -halfExtents.y},
+                {halfExtents.x, halfExtents.y},
+                {-halfExtents.x, halfExtents.y}
+            };
+            addRegionContact(kUnityXRTrackableTypePlaneWithinBounds,
+                landsOnPlane && WithinBounds(landingPositionInPlane, plane.bounds), corners, 4);
+        }
+
+        if (testWithinPolygon)
+        {
+            const auto& boundary = iter.second.boundaryInPlaneSpace;
+            addRegionContact(kUnityXRTrackableTypePlaneWithinPolygon,
+                landsOnPlane && WithinPolygon(landingPositionInPlane, boundary), boundary.data(), boundary.size());
+        }
+
+        if (testEstimated && iter.second.isEstimated)
+        {
+            if (landsOnPlane)
+                addContact(landingDistance, landingPosition, kUnityXRTrackableTypePlaneEstimated);
+
+            for (size_t i = 0; i < numContacts; ++i)
+                contacts[i].hitType |= kUnityXRTrackableTypePlaneEstimated;
+        }
+
+        for (size_t i = 0; i < numContacts; ++i)
+        {
+            UnityXRRaycastHit hit;
+            hit.trackableId = plane.id;
+            hit.pose.position = Add(plane.center, Mul(plane.pose.rotation, contacts[i].positionInPlaneSpace));
+            hit.pose.rotation = plane.pose.rotation;
+            hit.distance = contacts[i].distance;
+            hit.hitType = static_cast<UnityXRTrackableType>(contacts[i].hitType);
+            hitsOut.Add(hit);
+        }
+    }
 }
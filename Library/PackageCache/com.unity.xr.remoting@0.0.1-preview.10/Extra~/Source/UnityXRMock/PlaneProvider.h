@@ -3,11 +3,16 @@
 #include "IUnityXRRaycast.h"
 #include "XRProvider.h"
 #include "TrackableIdHelpers.h"
+#include "TrackableIdMap.h"
 #include "Ray.h"
+#include "RaycastHitCollector.h"
 
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdint>
 
 struct PlaneWithBoundary
 {
@@ -16,10 +21,20 @@ struct PlaneWithBoundary
 
     UnityXRPlane plane = {};
     std::vector<UnityXRVector3> boundaryPoints;
+
+    // Set for planes fitted to the point cloud by the PlaneEstimator.
+    bool isEstimated = false;
+
+    // Derived by PlaneProvider::SetPlaneData, so raycasts need not recompute them.
+    UnityXRVector4 inverseRotation = {0, 0, 0, 1};
+    std::vector<UnityXRVector2> boundaryInPlaneSpace;
+
+    // PlaneProvider's version when the plane was last set.
+    uint64_t version = 0;
 };
 
-typedef std::unordered_map<UnityXRTrackableId, PlaneWithBoundary> IdToPlaneMap;
-typedef std::unordered_map<UnityXRTrackableId, UnityXRPlane> IdToUnityXRPlaneMap;
+typedef TrackableIdMap<PlaneWithBoundary> IdToPlaneMap;
+typedef TrackableIdMap<UnityXRPlane> IdToUnityXRPlaneMap;
 
 class PlaneProvider : public XRProvider<PlaneProvider, IUnityXRPlaneProvider>
 {
@@ -29,13 +44,36 @@ public:
 
     void RemovePlane(const UnityXRTrackableId& planeId);
 
-    std::vector<UnityXRRaycastHit> Raycast(const Ray& ray, UnityXRTrackableType hitFlags) const;
+    void Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Raycasts all rays under one lock, adding the hits of rays[i] to hitsOut[i].
+    void Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const;
+
+    // Adds where a sphere of the given radius moving along ray first touches
+    // the front of each plane, within its bounds or polygon if those are in
+    // hitFlags. Touching the inside and an edge of the region are both found.
+    // Planes the sphere overlaps at the origin are not hit from the front.
+    void SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
 
     bool TryGetPlaneWithoutBoundary(
         const UnityXRTrackableId& planeId, UnityXRPlane* planeOut) const;
 
+    // Also returns the version the plane was last set at, which only changes
+    // when that plane does.
+    bool TryGetPlaneWithoutBoundary(
+        const UnityXRTrackableId& planeId, UnityXRPlane* planeOut, uint64_t* versionOut) const;
+
     IdToUnityXRPlaneMap GetPlanesWithoutBoundaries() const;
 
+    // The boundary of every plane in world space, or the corners of its
+    // bounds if it has no boundary.
+    std::vector<std::vector<UnityXRVector3>> GetPlanePolygons() const;
+
+    // Incremented whenever a plane is added, updated or removed.
+    uint64_t GetVersion() const { return m_Version.load(); }
+
+    size_t GetNumPlanes() const;
+
     UnitySubsystemErrorCode RegisterAsCProvider(UnitySubsystemHandle handle, IUnityXRPlaneInterface* planeInterface);
 
 private:
@@ -47,9 +85,13 @@ private:
 
     bool UNITY_INTERFACE_API GetAllPlanes(IUnityXRPlaneDataAllocator& allocator);
 
+    void RaycastLocked(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
     IdToPlaneMap m_Planes;
 
+    std::atomic<uint64_t> m_Version{0};
+
     IUnityXRPlaneInterface* m_CInterface = nullptr;
 
-    mutable std::mutex m_PlaneMutex;
+    mutable std::shared_timed_mutex m_PlaneMutex;
 };
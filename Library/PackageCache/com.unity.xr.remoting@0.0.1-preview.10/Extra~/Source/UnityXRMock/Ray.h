@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstddef>
+
 #include "UnityXRTypes.h"
 
+// Batched raycasts hand rays to the WorkerPool in groups of this many.
+static const size_t kRaycastBatchGrainSize = 16;
+
 struct Ray
 {
     UnityXRVector3 origin;
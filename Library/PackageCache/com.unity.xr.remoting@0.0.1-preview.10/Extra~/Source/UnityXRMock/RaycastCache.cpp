@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "RaycastCache.h"
+
+// Screen points closer than this are the same query.
+static const float kScreenPointResolution = 1.f / 4096.f;
+
+// Ray origins closer than this, in meters, are the same query.
+static const float kRayOriginResolution = 1.f / 4096.f;
+
+// Ray directions whose components are closer than this are the same query.
+static const float kRayDirectionResolution = 1.f / 16384.f;
+
+static int32_t Quantize(float value, float resolution)
+{
+    const float quantized = std::round(value / resolution);
+    if (!(std::fabs(quantized) < 2e9f))
+        return quantized > 0.f ? INT32_MAX : INT32_MIN;
+
+    return static_cast<int32_t>(quantized);
+}
+
+extern "C"
+{
+    // 0 disables the cache. The capacity is allocated up front and capped at
+    // kMaxRaycastCacheCapacity. The cache itself lives as long as the plugin,
+    // since raycasts may be using it on other threads.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setRaycastCacheCapacity(int capacity)
+    {
+        if (RaycastCache* cache = RaycastCache::GetInstance())
+            cache->SetCapacity(capacity > 0 ? static_cast<size_t>(capacity) : 0);
+    }
+
+    // How many raycasts were answered from the cache, and how many were cast.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_getRaycastCacheStats(
+        uint64_t* numHitsOut, uint64_t* numMissesOut)
+    {
+        if (RaycastCache* cache = RaycastCache::GetInstance())
+        {
+            cache->GetStats(numHitsOut, numMissesOut);
+            return;
+        }
+
+        if (numHitsOut)
+            *numHitsOut = 0;
+
+        if (numMissesOut)
+            *numMissesOut = 0;
+    }
+}
+
+bool RaycastCache::Key::operator==(const Key& other) const
+{
+    return std::memcmp(input, other.input, sizeof(input)) == 0 &&
+        hitFlags == other.hitFlags &&
+        maxHits == other.maxHits &&
+        maxDistance == other.maxDistance &&
+        isRay == other.isRay;
+}
+
+size_t RaycastCache::Hash(const Key& key)
+{
+    // FNV-1a over the fields.
+    uint64_t hash = 14695981039346656037ull;
+    auto combine = [&hash](uint64_t value)
+    {
+        hash ^= value;
+        hash *= 1099511628211ull;
+    };
+
+    for (int32_t value : key.input)
+        combine(static_cast<uint32_t>(value));
+
+    uint32_t maxDistanceBits;
+    std::memcpy(&maxDistanceBits, &key.maxDistance, sizeof(maxDistanceBits));
+    combine(key.hitFlags);
+    combine(key.maxHits);
+    combine(maxDistanceBits);
+    combine(key.isRay);
+    return static_cast<size_t>(hash);
+}
+
+const uint32_t RaycastCache::kNone;
+
+RaycastCache::RaycastCache(size_t capacity)
+    : m_Capacity(0)
+{
+    SetCapacity(capacity);
+}
+
+RaycastCache::Key RaycastCache::ScreenPointKey(float screenX, float screenY, uint32_t hitFlags, size_t maxHits)
+{
+    Key key = {};
+    key.input[0] = Quantize(screenX, kScreenPointResolution);
+    key.input[1] = Quantize(screenY, kScreenPointResolution);
+    key.hitFlags = static_cast<uint32_t>(hitFlags);
+    key.maxHits = static_cast<uint32_t>(maxHits);
+    key.isRay = false;
+    return key;
+}
+
+RaycastCache::Key RaycastCache::RayKey(const Ray& ray, uint32_t hitFlags, size_t maxHits, float maxDistance)
+{
+    Key key = {};
+    key.input[0] = Quantize(ray.origin.x, kRayOriginResolution);
+    key.input[1] = Quantize(ray.origin.y, kRayOriginResolution);
+    key.input[2] = Quantize(ray.origin.z, kRayOriginResolution);
+    key.input[3] = Quantize(ray.direction.x, kRayDirectionResolution);
+    key.input[4] = Quantize(ray.direction.y, kRayDirectionResolution);
+    key.input[5] = Quantize(ray.direction.z, kRayDirectionResolution);
+    key.hitFlags = static_cast<uint32_t>(hitFlags);
+    key.maxHits = static_cast<uint32_t>(maxHits);
+    key.maxDistance = maxDistance;
+    key.isRay = true;
+    return key;
+}
+
+void RaycastCache::SetCapacity(size_t capacity)
+{
+    capacity = std::min(capacity, kMaxRaycastCacheCapacity);
+
+    size_t numSlots = 1;
+    while (numSlots < capacity * 2)
+        numSlots *= 2;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Capacity = capacity;
+    m_Entries.resize(capacity);
+    m_Entries.shrink_to_fit();
+    m_Slots.assign(numSlots, kNone);
+    m_NumEntries = 0;
+    m_MostRecent = kNone;
+    m_LeastRecent = kNone;
+}
+
+void RaycastCache::Invalidate(const RaycastVersions& versions)
+{
+    // Entries stay allocated so their hit buffers are reused.
+    std::fill(m_Slots.begin(), m_Slots.end(), kNone);
+    m_NumEntries = 0;
+    m_MostRecent = kNone;
+    m_LeastRecent = kNone;
+    m_Versions = versions;
+}
+
+size_t RaycastCache::FindSlotLocked(const Key& key, size_t hash) const
+{
+    const size_t mask = m_Slots.size() - 1;
+    size_t slot = hash & mask;
+    while (m_Slots[slot] != kNone)
+    {
+        const Entry& entry = m_Entries[m_Slots[slot]];
+        if (entry.hash == hash && entry.key == key)
+            return slot;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+void RaycastCache::EraseSlotLocked(size_t slot)
+{
+    const size_t mask = m_Slots.size() - 1;
+    size_t hole = slot;
+    for (size_t next = (slot + 1) & mask; m_Slots[next] != kNone; next = (next + 1) & mask)
+    {
+        // An entry may fill the hole if its home slot is not between the hole
+        // and where it is now.
+        const size_t home = m_Entries[m_Slots[next]].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            m_Slots[hole] = m_Slots[next];
+            hole = next;
+        }
+    }
+
+    m_Slots[hole] = kNone;
+}
+
+void RaycastCache::UnlinkLocked(uint32_t entry)
+{
+    Entry& node = m_Entries[entry];
+    if (node.prev != kNone)
+        m_Entries[node.prev].next = node.next;
+    else
+        m_MostRecent = node.next;
+
+    if (node.next != kNone)
+        m_Entries[node.next].prev = node.prev;
+    else
+        m_LeastRecent = node.prev;
+}
+
+void RaycastCache::LinkFrontLocked(uint32_t entry)
+{
+    Entry& node = m_Entries[entry];
+    node.prev = kNone;
+    node.next = m_MostRecent;
+    if (m_MostRecent != kNone)
+        m_Entries[m_MostRecent].prev = entry;
+    else
+        m_LeastRecent = entry;
+
+    m_MostRecent = entry;
+}
+
+bool RaycastCache::TryGetHits(const Key& key, const RaycastVersions& versions, RaycastHitCollector& hitsOut)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Capacity == 0)
+        return false;
+
+    if (versions != m_Versions)
+        Invalidate(versions);
+
+    const uint32_t entry = m_Slots[FindSlotLocked(key, Hash(key))];
+    if (entry == kNone)
+    {
+        ++m_NumMisses;
+        return false;
+    }
+
+    UnlinkLocked(entry);
+    LinkFrontLocked(entry);
+    for (const auto& hit : m_Entries[entry].hits)
+        hitsOut.Add(hit);
+
+    ++m_NumHits;
+    return true;
+}
+
+void RaycastCache::AddHits(const Key& key, const RaycastVersions& versions, const RaycastHitCollector& hits)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // The data changed while the raycast ran, so its hits are already stale.
+    if (versions != m_Versions || m_Capacity == 0)
+        return;
+
+    const size_t hash = Hash(key);
+    size_t slot = FindSlotLocked(key, hash);
+    uint32_t entry = m_Slots[slot];
+    if (entry == kNone)
+    {
+        if (m_NumEntries < m_Capacity)
+        {
+            entry = m_NumEntries++;
+        }
+        else
+        {
+            entry = m_LeastRecent;
+            const Entry& evicted = m_Entries[entry];
+            EraseSlotLocked(FindSlotLocked(evicted.key, evicted.hash));
+            UnlinkLocked(entry);
+
+            // The erase may have moved entries into the slot found for key.
+            slot = FindSlotLocked(key, hash);
+        }
+
+        m_Entries[entry].key = key;
+        m_Entries[entry].hash = hash;
+        m_Slots[slot] = entry;
+    }
+    else
+    {
+        UnlinkLocked(entry);
+    }
+
+    LinkFrontLocked(entry);
+    m_Entries[entry].hits.assign(hits.GetHits(), hits.GetHits() + hits.GetNumHits());
+}
+
+void RaycastCache::GetStats(uint64_t* numHitsOut, uint64_t* numMissesOut) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (numHitsOut)
+        *numHitsOut = m_NumHits;
+
+    if (numMissesOut)
+        *numMissesOut = m_NumMisses;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+#include "Singleton.h"
+#include "Ray.h"
+#include "RaycastHitCollector.h"
+#include "RaycastVersions.h"
+
+static const size_t kDefaultRaycastCacheCapacity = 256;
+
+static const size_t kMaxRaycastCacheCapacity = 65536;
+
+// Remembers the hits of recent native raycasts, so a query repeated within a
+// frame, such as several scripts casting through the screen center, is
+// answered without visiting the providers. Inputs are quantized, so nearly
+// identical queries share an entry. All entries are dropped as soon as any
+// version counter a raycast reads changes. Entries and index slots are
+// allocated for the whole capacity up front, and each entry keeps its hit
+// buffer when reused, so a raycast does not allocate once the buffers have
+// grown.
+class RaycastCache : public Singleton<RaycastCache>
+{
+public:
+
+    struct Key
+    {
+        // Quantized screen point, or ray origin and direction.
+        int32_t input[6];
+        uint32_t hitFlags;
+        uint32_t maxHits;
+        float maxDistance;
+        bool isRay;
+
+        bool operator==(const Key& other) const;
+    };
+
+    explicit RaycastCache(size_t capacity);
+
+    static Key ScreenPointKey(float screenX, float screenY, uint32_t hitFlags, size_t maxHits);
+
+    static Key RayKey(const Ray& ray, uint32_t hitFlags, size_t maxHits, float maxDistance);
+
+    // Drops all entries and allocates room for capacity of them, at most
+    // kMaxRaycastCacheCapacity.
+    void SetCapacity(size_t capacity);
+
+    // Adds the cached hits of key to hitsOut and returns true, or returns
+    // false if the query has to be cast. versions are the current ones.
+    bool TryGetHits(const Key& key, const RaycastVersions& versions, RaycastHitCollector& hitsOut);
+
+    // Stores the hits of a raycast made at versions.
+    void AddHits(const Key& key, const RaycastVersions& versions, const RaycastHitCollector& hits);
+
+    void GetStats(uint64_t* numHitsOut, uint64_t* numMissesOut) const;
+
+private:
+
+    static const uint32_t kNone = UINT32_MAX;
+
+    struct Entry
+    {
+        Key key;
+        size_t hash;
+        std::vector<UnityXRRaycastHit> hits;
+
+        // Neighbors in the recently used list, more recent first.
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    static size_t Hash(const Key& key);
+
+    void Invalidate(const RaycastVersions& versions);
+
+    // Returns the index slot holding key, or the empty slot it would go in.
+    size_t FindSlotLocked(const Key& key, size_t hash) const;
+
+    // Empties slot, moving later entries of its probe run back so lookups
+    // never stop early.
+    void EraseSlotLocked(size_t slot);
+
+    void UnlinkLocked(uint32_t entry);
+
+    void LinkFrontLocked(uint32_t entry);
+
+    std::vector<Entry> m_Entries;
+
+    // Entry indices or kNone, probed linearly. Kept at most half full.
+    std::vector<uint32_t> m_Slots;
+
+    // Entries in use, the rest are spare.
+    uint32_t m_NumEntries = 0;
+
+    uint32_t m_MostRecent = kNone;
+
+    uint32_t m_LeastRecent = kNone;
+
+    size_t m_Capacity;
+
+    RaycastVersions m_Versions = {};
+
+    uint64_t m_NumHits = 0;
+
+    uint64_t m_NumMisses = 0;
+
+    mutable std::mutex m_Mutex;
+};
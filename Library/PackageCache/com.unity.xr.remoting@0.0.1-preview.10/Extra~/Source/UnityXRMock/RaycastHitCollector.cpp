@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "RaycastHitCollector.h"
+
+static inline bool CompareDistance(const UnityXRRaycastHit& h1, const UnityXRRaycastHit& h2)
+{
+    return h1.distance < h2.distance;
+}
+
+void RaycastHitCollector::Reset(size_t maxHits, float maxDistance)
+{
+    m_Hits.clear();
+    m_MaxHits = maxHits;
+    m_MaxDistance = maxDistance;
+}
+
+void RaycastHitCollector::Add(const UnityXRRaycastHit& hit)
+{
+    if (hit.distance > m_MaxDistance)
+        return;
+
+    if (m_MaxHits == 0)
+    {
+        m_Hits.push_back(hit);
+        return;
+    }
+
+    // The heap keeps the farthest hit held at the front.
+    if (m_Hits.size() == m_MaxHits)
+    {
+        if (hit.distance >= m_Hits.front().distance)
+            return;
+
+        std::pop_heap(m_Hits.begin(), m_Hits.end(), CompareDistance);
+        m_Hits.back() = hit;
+    }
+    else
+    {
+        m_Hits.push_back(hit);
+    }
+
+    std::push_heap(m_Hits.begin(), m_Hits.end(), CompareDistance);
+    if (m_Hits.size() == m_MaxHits)
+        m_MaxDistance = m_Hits.front().distance;
+}
+
+void RaycastHitCollector::Sort()
+{
+    if (m_MaxHits == 0)
+        std::sort(m_Hits.begin(), m_Hits.end(), CompareDistance);
+    else
+        std::sort_heap(m_Hits.begin(), m_Hits.end(), CompareDistance);
+}
+
+void RaycastHitCollector::AddSorted(const RaycastHitCollector* sources, size_t count)
+{
+    // k-way merge with one cursor per source. k is the number of parallel
+    // parts of a raycast, so a linear scan for the nearest head is enough.
+    static thread_local std::vector<size_t> s_Cursors;
+    s_Cursors.assign(count, 0);
+
+    for (;;)
+    {
+        const UnityXRRaycastHit* nearest = nullptr;
+        size_t nearestSource = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (s_Cursors[i] == sources[i].m_Hits.size())
+                continue;
+
+            const UnityXRRaycastHit& hit = sources[i].m_Hits[s_Cursors[i]];
+            if (nearest == nullptr || hit.distance < nearest->distance)
+            {
+                nearest = &hit;
+                nearestSource = i;
+            }
+        }
+
+        if (nearest == nullptr || nearest->distance > m_MaxDistance)
+            return;
+
+        // Once full, only a strictly nearer hit gets in.
+        if (m_MaxHits != 0 && m_Hits.size() == m_MaxHits && nearest->distance >= m_MaxDistance)
+            return;
+
+        Add(*nearest);
+        ++s_Cursors[nearestSource];
+    }
+}
+
+RaycastHitCollector& RaycastHitCollector::GetForCurrentThread()
+{
+    static thread_local RaycastHitCollector s_Collector;
+    return s_Collector;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "IUnityXRRaycast.h"
+
+// Gathers the hits of one raycast across providers. It can keep only the
+// nearest maxHits hits in a bounded max-heap, and providers can stop
+// searching past GetMaxDistance(). The storage is kept between raycasts, so
+// reusing a collector does not allocate once it has grown.
+class RaycastHitCollector
+{
+public:
+
+    // maxHits == 0 keeps every hit no farther than maxDistance.
+    void Reset(size_t maxHits = 0, float maxDistance = std::numeric_limits<float>::max());
+
+    void Add(const UnityXRRaycastHit& hit);
+
+    // Hits farther than this are rejected. Shrinks once maxHits hits are held.
+    float GetMaxDistance() const { return m_MaxDistance; }
+
+    // Orders the hits nearest first. Call once all providers are done.
+    void Sort();
+
+    // Merges collectors that were each sorted, visiting hits nearest first and
+    // stopping at the first one this collector would reject.
+    void AddSorted(const RaycastHitCollector* sources, size_t count);
+
+    size_t GetMaxHits() const { return m_MaxHits; }
+
+    size_t GetNumHits() const { return m_Hits.size(); }
+
+    const UnityXRRaycastHit* GetHits() const { return m_Hits.data(); }
+
+    // The collector used for raycasts on the calling thread.
+    static RaycastHitCollector& GetForCurrentThread();
+
+private:
+
+    std::vector<UnityXRRaycastHit> m_Hits;
+
+    size_t m_MaxHits = 0;
+
+    float m_MaxDistance = std::numeric_limits<float>::max();
+};
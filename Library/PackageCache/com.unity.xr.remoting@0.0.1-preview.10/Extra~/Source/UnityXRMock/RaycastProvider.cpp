@@ -1,16 +1,126 @@
+#include <atomic>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "RaycastProvider.h"
+#include "AsyncRaycastQueue.h"
+#include "RaycastCache.h"
 #include "PlaneProvider.h"
 #include "DepthProvider.h"
 #include "CameraProvider.h"
+#include "MeshingProvider.h"
+#include "ReferencePointProvider.h"
+#include "ColliderRegistry.h"
+#include "RaycastHitCollector.h"
+#include "UnityMath.h"
+#include "WorkerPool.h"
 
 typedef int(UNITY_INTERFACE_API * Raycaster)(float x, float y, unsigned char type);
 
-static Raycaster s_Raycaster = nullptr;
+// Like Raycaster, but the answer may come from any thread through
+// UnityXRMock_setRaycastHitsForRequest before the handler returns.
+typedef int(UNITY_INTERFACE_API * RequestRaycaster)(int requestId, float x, float y, int hitFlags);
 
-static std::vector<UnityXRRaycastHit> s_XRRaycastHits;
+static std::atomic<Raycaster> s_Raycaster(nullptr);
+
+static std::atomic<RequestRaycaster> s_RequestRaycaster(nullptr);
+
+// Filled by the managed raycaster. Each thread has its own, so raycasts from
+// several threads do not overwrite each other's hits.
+static thread_local std::vector<UnityXRRaycastHit> s_XRRaycastHits;
+
+// More managed raycasts in flight than this spill into s_OverflowRequestHits,
+// which allocates.
+static const size_t kNumRequestSlots = 128;
+
+struct RequestSlot
+{
+    int requestId;
+    std::vector<UnityXRRaycastHit>* hits;
+};
+
+// The hit buffers of managed raycasts in flight. A request first tries the
+// slot of its id modulo kNumRequestSlots, then the ones after it. Free slots
+// have request id 0, which is never handed out.
+static RequestSlot s_RequestSlots[kNumRequestSlots];
+
+static std::unordered_map<int, std::vector<UnityXRRaycastHit>*> s_OverflowRequestHits;
+
+static std::shared_timed_mutex s_RequestHitsMutex;
+
+static std::atomic<int> s_NextRequestId(1);
+
+// How many of the nearest hits a raycast reports, 0 for all of them.
+static std::atomic<size_t> s_MaxRaycastHits(0);
+
+static size_t GetHomeSlot(int requestId)
+{
+    return static_cast<unsigned int>(requestId) % kNumRequestSlots;
+}
+
+// Registers hitsOut as the buffer of requestId.
+static void AddRequestLocked(int requestId, std::vector<UnityXRRaycastHit>* hitsOut)
+{
+    for (size_t i = 0; i < kNumRequestSlots; ++i)
+    {
+        RequestSlot& slot = s_RequestSlots[(GetHomeSlot(requestId) + i) % kNumRequestSlots];
+        if (slot.requestId == 0)
+        {
+            slot.requestId = requestId;
+            slot.hits = hitsOut;
+            return;
+        }
+    }
+
+    s_OverflowRequestHits[requestId] = hitsOut;
+}
+
+static std::vector<UnityXRRaycastHit>* FindRequestLocked(int requestId)
+{
+    if (requestId == 0)
+        return nullptr;
+
+    for (size_t i = 0; i < kNumRequestSlots; ++i)
+    {
+        const RequestSlot& slot = s_RequestSlots[(GetHomeSlot(requestId) + i) % kNumRequestSlots];
+        if (slot.requestId == requestId)
+            return slot.hits;
+    }
+
+    const auto iter = s_OverflowRequestHits.find(requestId);
+    return iter != s_OverflowRequestHits.end() ? iter->second : nullptr;
+}
+
+static void RemoveRequestLocked(int requestId)
+{
+    for (size_t i = 0; i < kNumRequestSlots; ++i)
+    {
+        RequestSlot& slot = s_RequestSlots[(GetHomeSlot(requestId) + i) % kNumRequestSlots];
+        if (slot.requestId == requestId)
+        {
+            slot.requestId = 0;
+            slot.hits = nullptr;
+            return;
+        }
+    }
+
+    s_OverflowRequestHits.erase(requestId);
+}
+
+static void CopyHits(const UnityXRRaycastHit* hits, int size, std::vector<UnityXRRaycastHit>& hitsOut)
+{
+    if (hits == nullptr || size < 0)
+    {
+        hitsOut.clear();
+        return;
+    }
+
+    hitsOut.assign(hits, hits + size);
+}
 
 extern "C"
 {
@@ -19,15 +129,302 @@ extern "C"
         s_Raycaster = raycastHandler;
     }
 
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setRaycastHandlerWithRequestId(RequestRaycaster raycastHandler)
+    {
+        s_RequestRaycaster = raycastHandler;
+    }
+
+    // Only valid on the thread the raycast handler was called on.
     void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setRaycastHits(
         const UnityXRRaycastHit* hits, int size)
     {
+        CopyHits(hits, size, s_XRRaycastHits);
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setRaycastHitsForRequest(
+        int requestId, const UnityXRRaycastHit* hits, int size)
+    {
+        // Only readers of the map, so answers to different requests are copied
+        // concurrently. Each buffer has a single writer, and its owner waits
+        // for an exclusive lock before reading it.
+        std::shared_lock<std::shared_timed_mutex> lock(s_RequestHitsMutex);
+        std::vector<UnityXRRaycastHit>* hitsOut = FindRequestLocked(requestId);
+        if (hitsOut == nullptr)
+            return false;
+
+        CopyHits(hits, size, *hitsOut);
+        return true;
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setMaxRaycastHits(int maxHits)
+    {
+        s_MaxRaycastHits = maxHits > 0 ? static_cast<size_t>(maxHits) : 0;
+    }
+}
+
+// Calls the managed raycaster, if one is set, leaving its hits in this
+// thread's s_XRRaycastHits.
+static bool TryRaycastManaged(float screenX, float screenY, uint32_t hitFlags)
+{
+    if (RequestRaycaster raycaster = s_RequestRaycaster.load())
+    {
+        int requestId = s_NextRequestId++;
+        if (requestId == 0)
+            requestId = s_NextRequestId++;
+
         s_XRRaycastHits.clear();
-        if (hits == nullptr || size < 0)
-            return;
+        {
+            std::lock_guard<std::shared_timed_mutex> lock(s_RequestHitsMutex);
+            AddRequestLocked(requestId, &s_XRRaycastHits);
+        }
+
+        raycaster(requestId, screenX, screenY, hitFlags);
+
+        std::lock_guard<std::shared_timed_mutex> lock(s_RequestHitsMutex);
+        RemoveRequestLocked(requestId);
+        return true;
+    }
+
+    if (Raycaster raycaster = s_Raycaster.load())
+    {
+        s_XRRaycastHits.clear();
+        raycaster(screenX, screenY, hitFlags);
+        return true;
+    }
+
+    return false;
+}
+
+// Below this many planes and points, a raycast is done before handing its
+// parts to other threads would pay off.
+static const size_t kMinParallelRaycastSize = 4096;
+
+enum RaycastPart
+{
+    kRaycastPartPlanes,
+    kRaycastPartPoints,
+    kRaycastPartMesh,
+    kRaycastPartReferencePoints,
+    kRaycastPartColliders,
+    kNumRaycastParts
+};
+
+static void RaycastPart(
+    size_t part, const UnityXRVector2* screenPoint, const Ray& ray, uint32_t hitFlags,
+    RaycastHitCollector& hitsOut)
+{
+    switch (part)
+    {
+    case kRaycastPartPlanes:
+        if (auto planeProvider = PlaneProvider::GetInstance())
+            planeProvider->Raycast(ray, hitFlags, hitsOut);
+        break;
+
+    case kRaycastPartPoints:
+        if (auto depthProvider = DepthProvider::GetInstance())
+        {
+            if (screenPoint)
+                depthProvider->RaycastScreenPoint(screenPoint->x, screenPoint->y, ray, hitFlags, hitsOut);
+            else
+                depthProvider->Raycast(ray, hitFlags, hitsOut);
+        }
+        break;
+
+    case kRaycastPartMesh:
+        if (auto meshingProvider = MeshingProvider::GetInstance())
+            meshingProvider->Raycast(ray, hitFlags, hitsOut);
+        break;
+
+    case kRaycastPartReferencePoints:
+        if (auto referencePointProvider = ReferencePointProvider::GetInstance())
+            referencePointProvider->Raycast(ray, hitFlags, hitsOut);
+        break;
+
+    case kRaycastPartColliders:
+        if (auto colliderRegistry = ColliderRegistry::GetInstance())
+            colliderRegistry->Raycast(ray, hitFlags, hitsOut);
+        break;
+    }
+}
+
+// Adds the hits of every provider along ray, which was generated from
+// screenPoint unless it is null. With enough planes and points the providers
+// are queried in parallel, each into its own collector, and merged.
+static void RaycastProviders(
+    const UnityXRVector2* screenPoint, const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut)
+{
+    size_t size = 0;
+    if (GetParallelism() > 1)
+    {
+        auto planeProvider = PlaneProvider::GetInstance();
+        if (planeProvider && (hitFlags & kUnityXRTrackableTypePlanes))
+            size += planeProvider->GetNumPlanes();
+
+        auto depthProvider = DepthProvider::GetInstance();
+        if (depthProvider && (hitFlags & kUnityXRTrackableTypePoint))
+            size += depthProvider->GetNumPoints();
+    }
 
-        s_XRRaycastHits.resize(size);
-        std::copy(hits, hits + size, s_XRRaycastHits.data());
+    if (size < kMinParallelRaycastSize)
+    {
+        for (size_t part = 0; part < kNumRaycastParts; ++part)
+            RaycastPart(part, screenPoint, ray, hitFlags, hitsOut);
+
+        return;
+    }
+
+    // Workers reach the collectors through the pointer, not their own thread_local.
+    static thread_local RaycastHitCollector s_PartHits[kNumRaycastParts];
+    RaycastHitCollector* partHits = s_PartHits;
+    for (size_t part = 0; part < kNumRaycastParts; ++part)
+        partHits[part].Reset(hitsOut.GetMaxHits(), hitsOut.GetMaxDistance());
+
+    RunParallelFor(kNumRaycastParts, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t part = begin; part < end; ++part)
+        {
+            RaycastPart(part, screenPoint, ray, hitFlags, partHits[part]);
+            partHits[part].Sort();
+        }
+    });
+
+    hitsOut.AddSorted(partHits, kNumRaycastParts);
+}
+
+// Queries the providers directly, without going through the camera.
+static void RaycastWorld(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut)
+{
+    RaycastProviders(nullptr, ray, hitFlags, hitsOut);
+    hitsOut.Sort();
+}
+
+// Writes count + 1 offsets and, if they fit, the hits. Returns the total
+// number of hits, or -1 if there is no raycast provider.
+static int RaycastBatch(
+    const UnityXRVector2* screenPoints, const Ray* rays, int count, uint32_t hitFlags,
+    UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut)
+{
+    RaycastProvider* provider = RaycastProvider::GetInstance();
+    if (provider == nullptr || count < 0)
+        return -1;
+
+    std::vector<UnityXRRaycastHit> hits;
+    std::vector<int> offsets;
+    provider->RaycastBatch(screenPoints, rays, static_cast<size_t>(count), hitFlags, hits, offsets);
+
+    if (hitOffsetsOut)
+        std::copy(offsets.begin(), offsets.end(), hitOffsetsOut);
+
+    const int numHits = static_cast<int>(hits.size());
+    if (hitsOut && numHits <= hitCapacity)
+        std::copy(hits.begin(), hits.end(), hitsOut);
+
+    return numHits;
+}
+
+extern "C"
+{
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_raycastScreenPoints(
+        const UnityXRVector2* screenPoints, int count, uint32_t hitFlags,
+        UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut)
+    {
+        if (screenPoints == nullptr && count > 0)
+            return -1;
+
+        return RaycastBatch(screenPoints, nullptr, count, hitFlags, hitsOut, hitCapacity, hitOffsetsOut);
+    }
+
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_raycastRays(
+        const Ray* rays, int count, uint32_t hitFlags,
+        UnityXRRaycastHit* hitsOut, int hitCapacity, int* hitOffsetsOut)
+    {
+        if (rays == nullptr && count > 0)
+            return -1;
+
+        // Hit distances are measured in units of the direction's length.
+        std::vector<Ray> normalizedRays(rays, rays + std::max(count, 0));
+        for (auto& ray : normalizedRays)
+            ray.direction = Normalize(ray.direction);
+
+        return RaycastBatch(nullptr, normalizedRays.data(), count, hitFlags, hitsOut, hitCapacity, hitOffsetsOut);
+    }
+
+    // Writes the nearest capacity hits no farther than maxDistance from origin,
+    // nearest first, and returns how many were written. maxDistance <= 0 means
+    // no limit. Providers stop searching past the farthest hit kept once
+    // capacity hits are found.
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_raycastWorld(
+        UnityXRVector3 origin, UnityXRVector3 direction, uint32_t hitFlags, float maxDistance,
+        UnityXRRaycastHit* hitsOut, int capacity)
+    {
+        if (hitsOut == nullptr || capacity <= 0 || LengthSquared(direction) == 0.f)
+            return 0;
+
+        const Ray ray = {origin, Normalize(direction)};
+        if (!(maxDistance > 0.f))
+            maxDistance = std::numeric_limits<float>::max();
+
+        RaycastHitCollector& hits = RaycastHitCollector::GetForCurrentThread();
+        hits.Reset(static_cast<size_t>(capacity), maxDistance);
+
+        RaycastCache* cache = RaycastCache::GetInstance();
+        if (cache == nullptr)
+        {
+            RaycastWorld(ray, hitFlags, hits);
+        }
+        else
+        {
+            const RaycastVersions versions = RaycastVersions::GetCurrent();
+            const RaycastCache::Key key = RaycastCache::RayKey(ray, hitFlags, static_cast<size_t>(capacity), maxDistance);
+            if (cache->TryGetHits(key, versions, hits))
+            {
+                hits.Sort();
+            }
+            else
+            {
+                RaycastWorld(ray, hitFlags, hits);
+                cache->AddHits(key, versions, hits);
+            }
+        }
+
+        std::copy(hits.GetHits(), hits.GetHits() + hits.GetNumHits(), hitsOut);
+        return static_cast<int>(hits.GetNumHits());
+    }
+
+    // Like UnityXRMock_raycastWorld, for a sphere of the given radius moving
+    // from origin along direction. Distances are how far its center travels
+    // before touching, and hit poses are at the points touched. Planes,
+    // points, reference points and colliders are tested; the sphere misses
+    // what it already overlaps at origin.
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_sphereCast(
+        UnityXRVector3 origin, UnityXRVector3 direction, float radius, uint32_t hitFlags, float maxDistance,
+        UnityXRRaycastHit* hitsOut, int capacity)
+    {
+        if (hitsOut == nullptr || capacity <= 0 || LengthSquared(direction) == 0.f || !(radius >= 0.f))
+            return 0;
+
+        const Ray ray = {origin, Normalize(direction)};
+        if (!(maxDistance > 0.f))
+            maxDistance = std::numeric_limits<float>::max();
+
+        RaycastHitCollector& hits = RaycastHitCollector::GetForCurrentThread();
+        hits.Reset(static_cast<size_t>(capacity), maxDistance);
+
+        if (auto planeProvider = PlaneProvider::GetInstance())
+            planeProvider->SphereCast(ray, radius, hitFlags, hits);
+
+        if (auto depthProvider = DepthProvider::GetInstance())
+            depthProvider->SphereCast(ray, radius, hitFlags, hits);
+
+        if (auto referencePointProvider = ReferencePointProvider::GetInstance())
+            referencePointProvider->SphereCast(ray, radius, hitFlags, hits);
+
+        if (auto colliderRegistry = ColliderRegistry::GetInstance())
+            colliderRegistry->SphereCast(ray, radius, hitFlags, hits);
+
+        hits.Sort();
+        std::copy(hits.GetHits(), hits.GetHits() + hits.GetNumHits(), hitsOut);
+        return static_cast<int>(hits.GetNumHits());
     }
 }
 
@@ -37,52 +434,162 @@ bool UNITY_INTERFACE_API RaycastProvider::Raycast(
     UnityXRTrackableType hitFlags,
     IUnityXRRaycastAllocator& allocator)
 {
-    if (s_Raycaster == nullptr)
-        return RaycastImpl(screenX, screenY, hitFlags, allocator);
+    AsyncRaycastQueue* queue = AsyncRaycastQueue::GetInstance();
+    if (queue != nullptr && queue->IsEnabled())
+    {
+        RaycastHitCollector& hits = RaycastHitCollector::GetForCurrentThread();
+        hits.Reset(s_MaxRaycastHits);
+        if (!queue->TryGetHits(screenX, screenY, hitFlags, hits))
+            return RaycastImpl(screenX, screenY, hitFlags, allocator);
 
-    s_XRRaycastHits.clear();
-    s_Raycaster(screenX, screenY, hitFlags);
+        if (hits.GetNumHits() == 0)
+            return false;
+
+        hits.Sort();
+        std::copy(hits.GetHits(), hits.GetHits() + hits.GetNumHits(), allocator.SetNumberOfHits(hits.GetNumHits()));
+        return true;
+    }
+
+    if (!TryRaycastManaged(screenX, screenY, hitFlags))
+        return RaycastImpl(screenX, screenY, hitFlags, allocator);
 
     std::copy(s_XRRaycastHits.begin(), s_XRRaycastHits.end(), allocator.SetNumberOfHits(s_XRRaycastHits.size()));
     return s_XRRaycastHits.size() > 0;
 }
 
-template<typename T>
-static inline void InsertBack(std::vector<T>& dst, const std::vector<T>& src)
-{
-    dst.insert(dst.end(), src.begin(), src.end());
-}
-
 bool UNITY_INTERFACE_API RaycastProvider::RaycastImpl(
         float screenX,
         float screenY,
-        UnityXRTrackableType hitFlags,
+        uint32_t hitFlags,
         IUnityXRRaycastAllocator& allocator) const
 {
     if (CameraProvider::GetInstance() == nullptr)
         return false;
 
-    Ray ray;
-    if (!CameraProvider::GetInstance()->TryGetRay(screenX, screenY, &ray))
-        return false;
+    // Providers add straight into a per-thread collector, so the copy into
+    // Unity's allocator is the only one.
+    const size_t maxHits = s_MaxRaycastHits;
+    RaycastHitCollector& hits = RaycastHitCollector::GetForCurrentThread();
+    hits.Reset(maxHits);
 
-    std::vector<UnityXRRaycastHit> hits;
-    if (auto planeProvider = PlaneProvider::GetInstance())
-        InsertBack(hits, planeProvider->Raycast(ray, hitFlags));
+    RaycastCache* cache = RaycastCache::GetInstance();
+    const RaycastVersions versions = cache ? RaycastVersions::GetCurrent() : RaycastVersions();
+    const RaycastCache::Key key = RaycastCache::ScreenPointKey(screenX, screenY, hitFlags, maxHits);
+    if (cache == nullptr || !cache->TryGetHits(key, versions, hits))
+    {
+        Ray ray;
+        if (!CameraProvider::GetInstance()->TryGetRay(screenX, screenY, &ray))
+            return false;
 
-    if (auto depthProvider = DepthProvider::GetInstance())
-        InsertBack(hits, depthProvider->Raycast(ray, hitFlags));
+        const UnityXRVector2 screenPoint = {screenX, screenY};
+        RaycastProviders(&screenPoint, ray, hitFlags, hits);
+        hits.Sort();
+        if (cache)
+            cache->AddHits(key, versions, hits);
+    }
+    else
+    {
+        hits.Sort();
+    }
 
-    if (hits.size() == 0)
+    if (hits.GetNumHits() == 0)
         return false;
+    std::copy(hits.GetHits(), hits.GetHits() + hits.GetNumHits(), allocator.SetNumberOfHits(hits.GetNumHits()));
+
+    return true;
+}
+
+void RaycastProvider::RaycastBatch(
+    const UnityXRVector2* screenPoints, const Ray* rays, size_t count, uint32_t hitFlags,
+    std::vector<UnityXRRaycastHit>& hitsOut, std::vector<int>& offsetsOut) const
+{
+    hitsOut.clear();
+    offsetsOut.assign(count + 1, 0);
 
-    std::sort(hits.begin(), hits.end(), [](const UnityXRRaycastHit& h1, const UnityXRRaycastHit& h2) -> bool
+    std::vector<RaycastHitCollector> hitsPerRay(count);
+    for (auto& hits : hitsPerRay)
+        hits.Reset(s_MaxRaycastHits);
+
+    if (screenPoints != nullptr && (s_RequestRaycaster.load() != nullptr || s_Raycaster.load() != nullptr))
     {
-        return h1.distance < h2.distance;
-    });
-    std::copy(hits.begin(), hits.end(), allocator.SetNumberOfHits(hits.size()));
+        // The managed raycaster only takes one screen point at a time.
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!TryRaycastManaged(screenPoints[i].x, screenPoints[i].y, hitFlags))
+                continue;
 
-    return true;
+            for (const auto& hit : s_XRRaycastHits)
+                hitsPerRay[i].Add(hit);
+        }
+    }
+    else
+    {
+        // Screen points that do not map to a ray are dropped, keeping the
+        // index of each ray that does.
+        std::vector<Ray> validRays;
+        std::vector<UnityXRVector2> validScreenPoints;
+        std::vector<size_t> rayIndices;
+        if (screenPoints != nullptr)
+        {
+            CameraProvider* cameraProvider = CameraProvider::GetInstance();
+            std::vector<Ray> generatedRays(count);
+            std::unique_ptr<bool[]> isValid(new bool[count]);
+            const bool hasRays = cameraProvider != nullptr &&
+                cameraProvider->TryGetRays(screenPoints, count, generatedRays.data(), isValid.get());
+
+            for (size_t i = 0; hasRays && i < count; ++i)
+            {
+                if (!isValid[i])
+                    continue;
+
+                validRays.push_back(generatedRays[i]);
+                validScreenPoints.push_back(screenPoints[i]);
+                rayIndices.push_back(i);
+            }
+        }
+        else
+        {
+            validRays.assign(rays, rays + count);
+            rayIndices.resize(count);
+            for (size_t i = 0; i < count; ++i)
+                rayIndices[i] = i;
+        }
+
+        const size_t numValidRays = validRays.size();
+        std::vector<RaycastHitCollector> validHits(numValidRays);
+        for (auto& hits : validHits)
+            hits.Reset(s_MaxRaycastHits);
+
+        if (auto planeProvider = PlaneProvider::GetInstance())
+            planeProvider->Raycast(validRays.data(), numValidRays, hitFlags, validHits.data());
+
+        if (auto depthProvider = DepthProvider::GetInstance())
+        {
+            depthProvider->Raycast(
+                screenPoints ? validScreenPoints.data() : nullptr, validRays.data(), numValidRays, hitFlags, validHits.data());
+        }
+
+        if (auto meshingProvider = MeshingProvider::GetInstance())
+            meshingProvider->Raycast(validRays.data(), numValidRays, hitFlags, validHits.data());
+
+        if (auto referencePointProvider = ReferencePointProvider::GetInstance())
+            referencePointProvider->Raycast(validRays.data(), numValidRays, hitFlags, validHits.data());
+
+        if (auto colliderRegistry = ColliderRegistry::GetInstance())
+            colliderRegistry->Raycast(validRays.data(), numValidRays, hitFlags, validHits.data());
+
+        for (size_t i = 0; i < numValidRays; ++i)
+            std::swap(hitsPerRay[rayIndices[i]], validHits[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        RaycastHitCollector& hits = hitsPerRay[i];
+        hits.Sort();
+        offsetsOut[i] = static_cast<int>(hitsOut.size());
+        hitsOut.insert(hitsOut.end(), hits.GetHits(), hits.GetHits() + hits.GetNumHits());
+    }
+    offsetsOut[count] = static_cast<int>(hitsOut.size());
 }
 
 UnitySubsystemErrorCode RaycastProvider::RegisterAsCProvider(UnitySubsystemHandle handle, IUnityXRRaycastInterface* raycastInterface)
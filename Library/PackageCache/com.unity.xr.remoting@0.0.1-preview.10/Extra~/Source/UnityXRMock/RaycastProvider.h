@@ -1,8 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 #include "IUnityXRRaycast.deprecated.h"
 #include "XRProvider.h"
+#include "Ray.h"
 
 class RaycastProvider : public XRProvider<RaycastProvider, IUnityXRRaycastProvider>
 {
@@ -10,6 +13,13 @@ public:
 
     UnitySubsystemErrorCode RegisterAsCProvider(UnitySubsystemHandle handle, IUnityXRRaycastInterface* raycastInterface);
 
+    // Raycasts screen points, or world rays if screenPoints is null, visiting
+    // each provider once for the whole batch. The hits of the i-th ray, nearest
+    // first, are hitsOut[offsetsOut[i]] up to hitsOut[offsetsOut[i + 1]].
+    void RaycastBatch(
+        const UnityXRVector2* screenPoints, const Ray* rays, size_t count, uint32_t hitFlags,
+        std::vector<UnityXRRaycastHit>& hitsOut, std::vector<int>& offsetsOut) const;
+
 private:
 
     bool UNITY_INTERFACE_API Raycast(
@@ -21,7 +31,7 @@ private:
     bool RaycastImpl(
         float screenX,
         float screenY,
-        UnityXRTrackableType hitFlags,
+        uint32_t hitFlags,
         IUnityXRRaycastAllocator& allocator) const;
 
     static UnitySubsystemErrorCode UNITY_INTERFACE_API StaticRaycast(
@@ -0,0 +1,32 @@
+#include "RaycastVersions.h"
+#include "CameraProvider.h"
+#include "ColliderRegistry.h"
+#include "DepthProvider.h"
+#include "InputProvider.h"
+#include "MeshingProvider.h"
+#include "PlaneProvider.h"
+#include "ReferencePointProvider.h"
+
+RaycastVersions RaycastVersions::GetCurrent()
+{
+    RaycastVersions versions;
+    versions.camera = CameraProvider::GetInstance() ? CameraProvider::GetInstance()->GetVersion() : 0;
+    versions.pose = InputProvider::GetPoseVersion();
+    versions.planes = PlaneProvider::GetInstance() ? PlaneProvider::GetInstance()->GetVersion() : 0;
+    versions.points = DepthProvider::GetInstance() ? DepthProvider::GetInstance()->GetVersion() : 0;
+    versions.mesh = MeshingProvider::GetInstance() ? MeshingProvider::GetInstance()->GetVersion() : 0;
+    versions.referencePoints = ReferencePointProvider::GetInstance() ? ReferencePointProvider::GetInstance()->GetVersion() : 0;
+    versions.colliders = ColliderRegistry::GetInstance() ? ColliderRegistry::GetInstance()->GetVersion() : 0;
+    return versions;
+}
+
+bool RaycastVersions::operator==(const RaycastVersions& other) const
+{
+    return camera == other.camera &&
+        pose == other.pose &&
+        planes == other.planes &&
+        points == other.points &&
+        mesh == other.mesh &&
+        referencePoints == other.referencePoints &&
+        colliders == other.colliders;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+// Version counters of everything a raycast reads. If two snapshots are
+// equal, repeating a raycast gives the same hits.
+struct RaycastVersions
+{
+    uint64_t camera;
+    uint64_t pose;
+    uint64_t planes;
+    uint64_t points;
+    uint64_t mesh;
+    uint64_t referencePoints;
+    uint64_t colliders;
+
+    // Providers that do not exist report 0.
+    static RaycastVersions GetCurrent();
+
+    bool operator==(const RaycastVersions& other) const;
+
+    bool operator!=(const RaycastVersions& other) const { return !(*this == other); }
+};
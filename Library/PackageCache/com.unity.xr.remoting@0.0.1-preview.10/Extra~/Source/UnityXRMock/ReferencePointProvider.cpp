@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include "ReferencePointProvider.h"
+#include "ColliderRegistry.h"
+#include "MappedFile.h"
+#include "MockTrackableTypes.h"
 #include "PlaneProvider.h"
 #include "TrackableIdHelpers.h"
 #include "UnityMath.h"
+#include "WorkerPool.h"
 
 extern "C"
 {
@@ -39,6 +45,15 @@ extern "C"
 
     static RequestAddReferencePoint s_AddReferencePointHandler = nullptr;
 
+    // Sends an add to the device, which answers later through
+    // UnityXRMock_completeAddReferencePoint. Must not block.
+    typedef void(UNITY_INTERFACE_API *AsyncAddReferencePoint)(
+        int requestId,
+        float px, float py, float pz,
+        float rx, float ry, float rz, float rw);
+
+    static AsyncAddReferencePoint s_AsyncAddReferencePointHandler = nullptr;
+
     UNITY_INTERFACE_EXPORT void UnityARMock_setAddReferencePointHandler(RequestAddReferencePoint unityFunctionPointer,
         RequestRemoveReferencePoint removeUnityFunctionPointer)
     {
@@ -81,69 +96,1242 @@ extern "C"
             trackingState);
     }
 
+    // Takes precedence over the handler set by UnityARMock_setAddReferencePointHandler,
+    // whose remove handler is still used. Passing nullptr goes back to it.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setAsyncAddReferencePointHandler(
+        AsyncAddReferencePoint handler)
+    {
+        s_AsyncAddReferencePointHandler = handler;
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_completeAddReferencePoint(
+        int requestId, bool result, UnityXRTrackableId deviceId, int trackingState)
+    {
+        if (ReferencePointProvider::GetInstance())
+            ReferencePointProvider::GetInstance()->CompleteAddReferencePoint(
+                requestId, result, deviceId, static_cast<UnityXRTrackingState>(trackingState));
+    }
+
     UnityXRTrackableId UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_attachReferencePoint(
-        UnityXRTrackableId planeId, UnityXRPose pose)
+        UnityXRTrackableId attacheeId, UnityXRPose pose)
     {
         if (ReferencePointProvider::GetInstance())
-            return ReferencePointProvider::GetInstance()->AttachReferencePoint(planeId, pose);
+            return ReferencePointProvider::GetInstance()->AttachReferencePoint(attacheeId, pose);
 
         return kInvalidId;
     }
 
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_reattachReferencePoint(
+        UnityXRTrackableId referencePointId, UnityXRTrackableId attacheeId)
+    {
+        if (ReferencePointProvider::GetInstance())
+            return ReferencePointProvider::GetInstance()->ReattachReferencePoint(referencePointId, attacheeId);
+
+        return false;
+    }
+
     void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_updateReferencePoint(
         UnityXRTrackableId trackableId, UnityXRPose pose, UnityXRTrackingState trackingState)
     {
         if (ReferencePointProvider::GetInstance())
             return ReferencePointProvider::GetInstance()->UpdateReferencePoint(trackableId, pose, trackingState);
     }
+
+    // For restoring many reference points at once, e.g. after relocalization.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setReferencePoints(
+        const UnityXRReferencePoint* referencePoints, int count,
+        const UnityXRTrackableId* removedIds, int removedCount)
+    {
+        if (ReferencePointProvider::GetInstance() == nullptr)
+            return;
+
+        if (referencePoints == nullptr || count < 0)
+            count = 0;
+
+        if (removedIds == nullptr || removedCount < 0)
+            removedCount = 0;
+
+        ReferencePointProvider::GetInstance()->SetReferencePoints(referencePoints, count, removedIds, removedCount);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setReferencePointSmoothing(
+        bool enabled, float minCutoff, float beta, float derivativeCutoff, float maxExtrapolation)
+    {
+        if (ReferencePointProvider::GetInstance() == nullptr || minCutoff <= 0.f || derivativeCutoff <= 0.f)
+            return;
+
+        ReferencePointSmoothingSettings settings;
+        settings.minCutoff = minCutoff;
+        settings.beta = std::max(beta, 0.f);
+        settings.derivativeCutoff = derivativeCutoff;
+        settings.maxExtrapolation = std::max(maxExtrapolation, 0.f);
+        ReferencePointProvider::GetInstance()->SetSmoothing(enabled, settings);
+    }
+
+    // Each query copies up to capacity reference points and returns how many
+    // it found, so a caller can grow its buffer and query again.
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_findReferencePointsInRadius(
+        UnityXRVector3 center, float radius, UnityXRReferencePoint* referencePointsOut, int capacity)
+    {
+        if (ReferencePointProvider::GetInstance() == nullptr || !(radius >= 0.f))
+            return 0;
+
+        if (referencePointsOut == nullptr || capacity < 0)
+            capacity = 0;
+
+        return static_cast<int>(ReferencePointProvider::GetInstance()->FindReferencePointsInRadius(
+            center, radius, referencePointsOut, capacity));
+    }
+
+    // Pass infinity as maxDistance for no limit.
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_findNearestReferencePoints(
+        UnityXRVector3 center, float maxDistance, UnityXRReferencePoint* referencePointsOut, int capacity)
+    {
+        if (ReferencePointProvider::GetInstance() == nullptr || !(maxDistance >= 0.f) ||
+            referencePointsOut == nullptr || capacity <= 0)
+            return 0;
+
+        return static_cast<int>(ReferencePointProvider::GetInstance()->FindNearestReferencePoints(
+            center, maxDistance, referencePointsOut, capacity));
+    }
+
+    // planes are normals and distances, as from GeometryUtility.CalculateFrustumPlanes.
+    int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_findReferencePointsInFrustum(
+        const UnityXRVector4* planes, int planeCount, UnityXRReferencePoint* referencePointsOut, int capacity)
+    {
+        if (ReferencePointProvider::GetInstance() == nullptr || planes == nullptr || planeCount < 0)
+            return 0;
+
+        if (referencePointsOut == nullptr || capacity < 0)
+            capacity = 0;
+
+        return static_cast<int>(ReferencePointProvider::GetInstance()->FindReferencePointsInside(
+            planes, planeCount, referencePointsOut, capacity));
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setReferencePointIndexCellSize(float cellSize)
+    {
+        if (ReferencePointProvider::GetInstance() && cellSize > 0.f)
+            ReferencePointProvider::GetInstance()->SetSpatialIndexCellSize(cellSize);
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setReferencePointChangeTracking(bool enabled)
+    {
+        if (ReferencePointProvider::GetInstance())
+            ReferencePointProvider::GetInstance()->SetChangeTracking(enabled);
+    }
+
+    // changedOut receives the added reference points followed by the updated ones.
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_getReferencePointChanges(
+        UnityXRReferencePoint* changedOut, int changedCapacity,
+        UnityXRTrackableId* removedOut, int removedCapacity,
+        int* addedCountOut, int* updatedCountOut, int* removedCountOut)
+    {
+        if (addedCountOut == nullptr || updatedCountOut == nullptr || removedCountOut == nullptr)
+            return false;
+
+        *addedCountOut = 0;
+        *updatedCountOut = 0;
+        *removedCountOut = 0;
+        if (ReferencePointProvider::GetInstance() == nullptr)
+            return false;
+
+        size_t addedCount, updatedCount, removedCount;
+        const bool copied = ReferencePointProvider::GetInstance()->GetChanges(
+            changedOut, changedOut ? std::max(changedCapacity, 0) : 0,
+            removedOut, removedOut ? std::max(removedCapacity, 0) : 0,
+            &addedCount, &updatedCount, &removedCount);
+
+        *addedCountOut = static_cast<int>(addedCount);
+        *updatedCountOut = static_cast<int>(updatedCount);
+        *removedCountOut = static_cast<int>(removedCount);
+        return copied;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_saveReferencePoints(const char* path)
+    {
+        if (ReferencePointProvider::GetInstance() && path)
+            return ReferencePointProvider::GetInstance()->SaveReferencePoints(path);
+
+        return false;
+    }
+
+    bool UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_loadReferencePoints(const char* path)
+    {
+        if (ReferencePointProvider::GetInstance() && path)
+            return ReferencePointProvider::GetInstance()->LoadReferencePoints(path);
+
+        return false;
+    }
+
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setReferencePointHitRadius(float hitRadius)
+    {
+        if (ReferencePointProvider::GetInstance() && hitRadius > 0.f)
+            ReferencePointProvider::GetInstance()->SetHitRadius(hitRadius);
+    }
 }
 
-UnityXRTrackableId ReferencePointProvider::AttachReferencePoint(const UnityXRTrackableId& planeId, const UnityXRPose& pose)
+// Files written by SaveReferencePoints are a ReferencePointFileHeader followed
+// by the reference points and then the attached ones, in the byte order of
+// the machine that wrote them. Records are multiples of 8 bytes, so each one
+// is aligned in a mapped file. Bump kReferencePointFileVersion when the
+// layout changes.
+static const uint32_t kReferencePointFileMagic = 0x50525258; // "XRRP"
+
+static const uint32_t kReferencePointFileVersion = 2;
+
+struct ReferencePointFileHeader
 {
-    auto planeProvider = PlaneProvider::GetInstance();
-    if (planeProvider == nullptr)
-        return kInvalidId;
+    uint32_t magic;
+    uint32_t version;
+    uint64_t numReferencePoints;
+    uint64_t numAttachments;
+};
 
+struct ReferencePointRecord
+{
+    uint64_t id[2];
+    float position[3];
+    float rotation[4];
+    int32_t trackingState;
+};
+
+struct AttachmentRecord
+{
+    ReferencePointRecord referencePoint;
+    uint64_t attacheeId[2];
+    float localPosition[3];
+    float localRotation[4];
+    uint32_t attacheeType;
+};
+
+static_assert(sizeof(ReferencePointFileHeader) == 24, "ReferencePointFileHeader layout changed");
+static_assert(sizeof(ReferencePointRecord) == 48, "ReferencePointRecord layout changed");
+static_assert(sizeof(AttachmentRecord) == 96, "AttachmentRecord layout changed");
+
+static ReferencePointRecord ToRecord(const UnityXRReferencePoint& referencePoint)
+{
+    ReferencePointRecord record;
+    record.id[0] = referencePoint.id.idPart[0];
+    record.id[1] = referencePoint.id.idPart[1];
+    record.position[0] = referencePoint.pose.position.x;
+    record.position[1] = referencePoint.pose.position.y;
+    record.position[2] = referencePoint.pose.position.z;
+    record.rotation[0] = referencePoint.pose.rotation.x;
+    record.rotation[1] = referencePoint.pose.rotation.y;
+    record.rotation[2] = referencePoint.pose.rotation.z;
+    record.rotation[3] = referencePoint.pose.rotation.w;
+    record.trackingState = referencePoint.trackingState;
+    return record;
+}
+
+static void FromRecord(const ReferencePointRecord& record, UnityXRReferencePoint& referencePointOut)
+{
+    referencePointOut.id.idPart[0] = record.id[0];
+    referencePointOut.id.idPart[1] = record.id[1];
+    referencePointOut.pose.position = {record.position[0], record.position[1], record.position[2]};
+    referencePointOut.pose.rotation = {record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]};
+    referencePointOut.trackingState = static_cast<UnityXRTrackingState>(record.trackingState);
+}
+
+static float ToSeconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<float>(duration).count();
+}
+
+// How far a low-pass filter with the given cutoff frequency moves toward its
+// input in dt seconds.
+static float GetSmoothingFactor(float cutoff, float dt)
+{
+    const float timeConstant = 1.f / (2.f * 3.14159265f * cutoff);
+    return 1.f / (1.f + timeConstant / dt);
+}
+
+// Asks the device to remove reference points it added for adds that were
+// removed before completing. Called without holding the provider's lock.
+static void RemoveOnDevice(const std::vector<UnityXRTrackableId>& deviceIds)
+{
+    if (s_RemoveReferencePointHandler == nullptr)
+        return;
+
+    for (const auto& id : deviceIds)
+        s_RemoveReferencePointHandler(id.idPart[0], id.idPart[1]);
+}
+
+UnityXRTrackableId ReferencePointProvider::AttachReferencePoint(const UnityXRTrackableId& attacheeId, const UnityXRPose& pose)
+{
     auto newId = GenerateTrackableId();
     if (newId == kInvalidId)
         return kInvalidId;
 
-    UnityXRPlane plane;
-    if (!planeProvider->TryGetPlaneWithoutBoundary(planeId, &plane))
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    AttacheeType attacheeType;
+    UnityXRPose attacheePose;
+    uint64_t planeVersion = 0;
+    if (!FindAttacheeLocked(attacheeId, &attacheeType, &attacheePose, &planeVersion))
         return kInvalidId;
 
     AttachedReferencePoint attachment = {};
     attachment.id = newId;
     attachment.pose = pose;
     attachment.trackingState = kUnityXRTrackingStateTracking;
-    attachment.attacheeId = planeId;
-
-    const auto planeNormal = Mul(plane.pose.rotation, kUp);
-    attachment.distance = Dot(Sub(pose.position, plane.pose.position), planeNormal);
+    attachment.attacheeId = attacheeId;
+    attachment.attacheeType = attacheeType;
+    attachment.localPose = InverseTransformPose(attacheePose, pose);
 
-    std::lock_guard<std::mutex> lock(m_Mutex);
     m_Attachments[newId] = attachment;
+    AddToAttacheeLocked(newId, attacheeId, attacheeType, planeVersion);
+    MarkChangedLocked(newId, kReferencePointAdded);
+
+    // The plane may be removed before the next update, so check it then even
+    // if no plane changes after this.
+    if (attacheeType == kAttacheePlane)
+        m_AttachmentsPlaneVersion = 0;
+
+    ++m_Version;
 
     return newId;
 }
 
+bool ReferencePointProvider::ReattachReferencePoint(const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& attacheeId)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto iter = m_Attachments.find(referencePointId);
+    if (iter == m_Attachments.end())
+        return false;
+
+    if (attacheeId == referencePointId || IsAttachedToLocked(attacheeId, referencePointId))
+        return false;
+
+    AttacheeType attacheeType;
+    UnityXRPose attacheePose;
+    uint64_t planeVersion = 0;
+    if (!FindAttacheeLocked(attacheeId, &attacheeType, &attacheePose, &planeVersion))
+        return false;
+
+    // Attachments are at their pose as of the last update, so both ends are
+    // taken to where the next update would move them.
+    auto& attachment = iter->second;
+    UnityXRPose pose;
+    if (!TryGetCurrentPoseLocked(attachment, &pose))
+        pose = attachment.pose;
+
+    const auto attacheeIter = m_Attachments.find(attacheeId);
+    if (attacheeIter != m_Attachments.end())
+        TryGetCurrentPoseLocked(attacheeIter->second, &attacheePose);
+
+    DetachLocked(attachment);
+    attachment.attacheeId = attacheeId;
+    attachment.attacheeType = attacheeType;
+    attachment.pose = pose;
+    attachment.localPose = InverseTransformPose(attacheePose, pose);
+    AddToAttacheeLocked(referencePointId, attacheeId, attacheeType, planeVersion);
+    MarkChangedLocked(referencePointId, kReferencePointUpdated);
+    MarkMovedLocked(referencePointId);
+
+    if (attacheeType == kAttacheePlane)
+        m_AttachmentsPlaneVersion = 0;
+
+    ++m_Version;
+    return true;
+}
+
+void ReferencePointProvider::RemoveAttachments(const UnityXRTrackableId& planeId)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (RemoveAttachmentsLocked(planeId))
+        ++m_Version;
+}
+
+bool ReferencePointProvider::FindAttacheeLocked(
+    const UnityXRTrackableId& attacheeId, AttacheeType* attacheeTypeOut,
+    UnityXRPose* poseOut, uint64_t* planeVersionOut) const
+{
+    if (TryGetAttacheePoseLocked(attacheeId, kAttacheeReferencePoint, poseOut, planeVersionOut))
+    {
+        *attacheeTypeOut = kAttacheeReferencePoint;
+        return true;
+    }
+
+    if (TryGetAttacheePoseLocked(attacheeId, kAttacheePlane, poseOut, planeVersionOut))
+    {
+        *attacheeTypeOut = kAttacheePlane;
+        return true;
+    }
+
+    return false;
+}
+
+bool ReferencePointProvider::TryGetAttacheePoseLocked(
+    const UnityXRTrackableId& attacheeId, AttacheeType attacheeType,
+    UnityXRPose* poseOut, uint64_t* planeVersionOut) const
+{
+    if (attacheeType == kAttacheePlane)
+    {
+        auto planeProvider = PlaneProvider::GetInstance();
+        UnityXRPlane plane;
+        if (planeProvider == nullptr || !planeProvider->TryGetPlaneWithoutBoundary(attacheeId, &plane, planeVersionOut))
+            return false;
+
+        *poseOut = plane.pose;
+        return true;
+    }
+
+    const auto iter = m_ReferencePoints.find(attacheeId);
+    if (iter != m_ReferencePoints.end())
+    {
+        *poseOut = iter->second.pose;
+        return true;
+    }
+
+    // Attached reference points are at their pose as of the last update,
+    // which is current for those the update is visiting.
+    const auto attachmentIter = m_Attachments.find(attacheeId);
+    if (attachmentIter != m_Attachments.end())
+    {
+        *poseOut = attachmentIter->second.pose;
+        return true;
+    }
+
+    return false;
+}
+
+bool ReferencePointProvider::TryGetCurrentPoseLocked(const AttachedReferencePoint& attachment, UnityXRPose* poseOut) const
+{
+    UnityXRPose attacheePose;
+    uint64_t planeVersion;
+    const auto attacheeIter = attachment.attacheeType == kAttacheeReferencePoint
+        ? m_Attachments.find(attachment.attacheeId) : m_Attachments.end();
+
+    // Cycles are never made, so this reaches an unattached attachee.
+    if (attacheeIter != m_Attachments.end())
+    {
+        if (!TryGetCurrentPoseLocked(attacheeIter->second, &attacheePose))
+            return false;
+    }
+    else if (!TryGetAttacheePoseLocked(attachment.attacheeId, attachment.attacheeType, &attacheePose, &planeVersion))
+    {
+        return false;
+    }
+
+    *poseOut = TransformPose(attacheePose, attachment.localPose);
+    return true;
+}
+
+bool ReferencePointProvider::IsAttachedToLocked(const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& ancestorId) const
+{
+    // Cycles are never made, so this reaches an unattached attachee.
+    for (auto iter = m_Attachments.find(referencePointId); iter != m_Attachments.end(); iter = m_Attachments.find(iter->second.attacheeId))
+    {
+        if (iter->second.attacheeId == ancestorId)
+            return true;
+    }
+
+    return false;
+}
+
+void ReferencePointProvider::AddToAttacheeLocked(
+    const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& attacheeId,
+    AttacheeType attacheeType, uint64_t planeVersion)
+{
+    // A plane with attachments already is kept at the version its other
+    // attachments were computed at, so an update in between still moves them.
+    auto& attachments = m_AttachmentsByAttachee[attacheeId];
+    if (attachments.referencePointIds.empty())
+    {
+        attachments.attacheeType = attacheeType;
+        attachments.planeVersion = planeVersion;
+    }
+
+    attachments.referencePointIds.push_back(referencePointId);
+}
+
+void ReferencePointProvider::DetachLocked(const AttachedReferencePoint& attachment)
+{
+    auto attacheeIter = m_AttachmentsByAttachee.find(attachment.attacheeId);
+    if (attacheeIter == m_AttachmentsByAttachee.end())
+        return;
+
+    auto& ids = attacheeIter->second.referencePointIds;
+    auto idIter = std::find(ids.begin(), ids.end(), attachment.id);
+    if (idIter != ids.end())
+    {
+        *idIter = ids.back();
+        ids.pop_back();
+    }
+
+    if (ids.empty())
+        m_AttachmentsByAttachee.erase(attacheeIter);
+}
+
+void ReferencePointProvider::RemoveAttachmentLocked(const AttachedReferencePoint& attachment)
+{
+    // Copied, since attachment is erased by its own id.
+    const UnityXRTrackableId id = attachment.id;
+    DetachLocked(attachment);
+    m_Attachments.erase(id);
+    MarkChangedLocked(id, kReferencePointRemoved);
+    RemoveAttachmentsLocked(id);
+}
+
+bool ReferencePointProvider::RemoveAttachmentsLocked(const UnityXRTrackableId& attacheeId)
+{
+    if (m_AttachmentsByAttachee.count(attacheeId) == 0)
+        return false;
+
+    std::vector<UnityXRTrackableId> attacheeIds(1, attacheeId);
+    while (!attacheeIds.empty())
+    {
+        const UnityXRTrackableId id = attacheeIds.back();
+        attacheeIds.pop_back();
+
+        auto iter = m_AttachmentsByAttachee.find(id);
+        if (iter == m_AttachmentsByAttachee.end())
+            continue;
+
+        for (const auto& referencePointId : iter->second.referencePointIds)
+        {
+            m_Attachments.erase(referencePointId);
+            MarkChangedLocked(referencePointId, kReferencePointRemoved);
+            attacheeIds.push_back(referencePointId);
+        }
+
+        m_AttachmentsByAttachee.erase(iter);
+    }
+
+    return true;
+}
+
+void ReferencePointProvider::MarkMovedLocked(const UnityXRTrackableId& referencePointId)
+{
+    if (m_AttachmentsByAttachee.count(referencePointId) != 0)
+        m_MovedAttachees.push_back(referencePointId);
+}
+
+void ReferencePointProvider::UpdateAttachmentsLocked()
+{
+    // Any plane being added, updated or removed changes the provider's version.
+    auto planeProvider = PlaneProvider::GetInstance();
+    const uint64_t planeProviderVersion = planeProvider != nullptr ? planeProvider->GetVersion() : 0;
+    if (planeProviderVersion != m_AttachmentsPlaneVersion)
+    {
+        m_AttachmentsPlaneVersion = planeProviderVersion;
+        for (const auto& iter : m_AttachmentsByAttachee)
+        {
+            if (iter.second.attacheeType != kAttacheePlane)
+                continue;
+
+            // A plane that is gone is found to be gone again below.
+            UnityXRPose pose;
+            uint64_t planeVersion;
+            if (!TryGetAttacheePoseLocked(iter.first, kAttacheePlane, &pose, &planeVersion) ||
+                planeVersion != iter.second.planeVersion)
+                m_MovedAttachees.push_back(iter.first);
+        }
+    }
+
+    if (m_MovedAttachees.empty())
+        return;
+
+    std::vector<UnityXRTrackableId> movedAttachees;
+    movedAttachees.swap(m_MovedAttachees);
+
+    TrackableIdMap<bool> unvisited;
+    unvisited.reserve(movedAttachees.size());
+    for (const auto& id : movedAttachees)
+        unvisited[id] = true;
+
+    // Each moved attachee not attached to another one is the root of a
+    // subtree that is walked attachee first, so every attached reference
+    // point is moved once, after what it is attached to.
+    std::vector<UnityXRTrackableId> attacheeIds;
+    for (const auto& rootId : movedAttachees)
+    {
+        if (unvisited.count(rootId) == 0)
+            continue;
+
+        bool isAttachedToMoved = false;
+        for (auto iter = m_Attachments.find(rootId); iter != m_Attachments.end(); iter = m_Attachments.find(iter->second.attacheeId))
+        {
+            if (unvisited.count(iter->second.attacheeId) != 0)
+            {
+                isAttachedToMoved = true;
+                break;
+            }
+        }
+
+        if (isAttachedToMoved)
+            continue;
+
+        attacheeIds.push_back(rootId);
+        while (!attacheeIds.empty())
+        {
+            const UnityXRTrackableId attacheeId = attacheeIds.back();
+            attacheeIds.pop_back();
+            unvisited.erase(attacheeId);
+
+            auto attacheeIter = m_AttachmentsByAttachee.find(attacheeId);
+            if (attacheeIter == m_AttachmentsByAttachee.end())
+                continue;
+
+            auto& attachments = attacheeIter->second;
+            UnityXRPose attacheePose;
+            if (!TryGetAttacheePoseLocked(attacheeId, attachments.attacheeType, &attacheePose, &attachments.planeVersion))
+            {
+                RemoveAttachmentsLocked(attacheeId);
+                continue;
+            }
+
+            for (const auto& id : attachments.referencePointIds)
+            {
+                auto iter = m_Attachments.find(id);
+                iter->second.pose = TransformPose(attacheePose, iter->second.localPose);
+                MarkChangedLocked(id, kReferencePointUpdated);
+                if (m_AttachmentsByAttachee.count(id) != 0)
+                    attacheeIds.push_back(id);
+            }
+        }
+    }
+
+    ++m_Version;
+}
+
 void ReferencePointProvider::UpdateReferencePoint(
     UnityXRTrackableId trackableId, UnityXRPose pose,
     UnityXRTrackingState trackingState)
 {
     std::lock_guard<std::mutex> lock(m_Mutex);
-    auto iter = m_ReferencePoints.find(trackableId);
+    auto iter = m_ReferencePoints.find(GetLocalIdLocked(trackableId));
     if (iter == m_ReferencePoints.end())
         return;
 
     auto& referencePoint = iter->second;
     referencePoint.pose = pose;
     referencePoint.trackingState = trackingState;
+    MarkChangedLocked(referencePoint.id, kReferencePointUpdated);
+    MarkMovedLocked(referencePoint.id);
+    AddPoseSampleLocked(referencePoint.id, pose, Clock::now());
+    ++m_Version;
+}
+
+void ReferencePointProvider::SetReferencePoints(
+    const UnityXRReferencePoint* referencePoints, size_t count,
+    const UnityXRTrackableId* removedIds, size_t removedCount)
+{
+    if (count == 0 && removedCount == 0)
+        return;
+
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ReferencePoints.reserve(m_ReferencePoints.size() + count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const UnityXRTrackableId localId = GetLocalIdLocked(referencePoints[i].id);
+        const auto result = m_ReferencePoints.emplace(localId, referencePoints[i]);
+        if (!result.second)
+            result.first->second = referencePoints[i];
+
+        result.first->second.id = localId;
+        MarkChangedLocked(localId, result.second ? kReferencePointAdded : kReferencePointUpdated);
+        MarkMovedLocked(localId);
+        AddPoseSampleLocked(localId, referencePoints[i].pose, now);
+    }
+
+    for (size_t i = 0; i < removedCount; ++i)
+    {
+        const UnityXRTrackableId localId = GetLocalIdLocked(removedIds[i]);
+        UnityXRTrackableId deviceId;
+        if (RemoveAsyncAddedLocked(localId, &deviceId))
+            continue;
+
+        if (m_ReferencePoints.erase(localId) > 0)
+        {
+            MarkChangedLocked(localId, kReferencePointRemoved);
+            MarkMovedLocked(localId);
+            continue;
+        }
+
+        const auto iter = m_Attachments.find(localId);
+        if (iter != m_Attachments.end())
+            RemoveAttachmentLocked(iter->second);
+    }
+
+    ++m_Version;
+}
+
+bool ReferencePointProvider::SaveReferencePoints(const char* path) const
+{
+    std::vector<ReferencePointRecord> referencePointRecords;
+    std::vector<AttachmentRecord> attachmentRecords;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        referencePointRecords.reserve(m_ReferencePoints.size());
+        for (const auto& iter : m_ReferencePoints)
+            referencePointRecords.push_back(ToRecord(iter.second));
+
+        attachmentRecords.reserve(m_Attachments.size());
+        for (const auto& iter : m_Attachments)
+        {
+            AttachmentRecord record = {};
+            record.referencePoint = ToRecord(iter.second);
+            record.attacheeId[0] = iter.second.attacheeId.idPart[0];
+            record.attacheeId[1] = iter.second.attacheeId.idPart[1];
+            const auto& localPose = iter.second.localPose;
+            record.localPosition[0] = localPose.position.x;
+            record.localPosition[1] = localPose.position.y;
+            record.localPosition[2] = localPose.position.z;
+            record.localRotation[0] = localPose.rotation.x;
+            record.localRotation[1] = localPose.rotation.y;
+            record.localRotation[2] = localPose.rotation.z;
+            record.localRotation[3] = localPose.rotation.w;
+            record.attacheeType = iter.second.attacheeType;
+            attachmentRecords.push_back(record);
+        }
+    }
+
+    ReferencePointFileHeader header;
+    header.magic = kReferencePointFileMagic;
+    header.version = kReferencePointFileVersion;
+    header.numReferencePoints = referencePointRecords.size();
+    header.numAttachments = attachmentRecords.size();
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr)
+        return false;
+
+    bool succeeded =
+        std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(referencePointRecords.data(), sizeof(ReferencePointRecord), referencePointRecords.size(), file) == referencePointRecords.size() &&
+        std::fwrite(attachmentRecords.data(), sizeof(AttachmentRecord), attachmentRecords.size(), file) == attachmentRecords.size();
+
+    if (std::fclose(file) != 0)
+        succeeded = false;
+
+    return succeeded;
+}
+
+bool ReferencePointProvider::LoadReferencePoints(const char* path)
+{
+    MappedFile file;
+    if (!file.Open(path) || file.GetSize() < sizeof(ReferencePointFileHeader))
+        return false;
+
+    const auto& header = *reinterpret_cast<const ReferencePointFileHeader*>(file.GetData());
+    if (header.magic != kReferencePointFileMagic || header.version != kReferencePointFileVersion)
+        return false;
+
+    // Counts are checked against the size first, so a corrupt file cannot overflow them.
+    const size_t recordsSize = file.GetSize() - sizeof(ReferencePointFileHeader);
+    if (header.numReferencePoints > recordsSize / sizeof(ReferencePointRecord) ||
+        header.numAttachments > recordsSize / sizeof(AttachmentRecord) ||
+        header.numReferencePoints * sizeof(ReferencePointRecord) + header.numAttachments * sizeof(AttachmentRecord) != recordsSize)
+        return false;
+
+    const auto numReferencePoints = static_cast<size_t>(header.numReferencePoints);
+    const auto numAttachments = static_cast<size_t>(header.numAttachments);
+    const auto referencePointRecords = reinterpret_cast<const ReferencePointRecord*>(file.GetData() + sizeof(ReferencePointFileHeader));
+    const auto attachmentRecords = reinterpret_cast<const AttachmentRecord*>(referencePointRecords + numReferencePoints);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ReferencePoints.reserve(m_ReferencePoints.size() + numReferencePoints);
+    for (size_t i = 0; i < numReferencePoints; ++i)
+    {
+        UnityXRReferencePoint referencePoint;
+        FromRecord(referencePointRecords[i], referencePoint);
+
+        // An id is in only one of the maps, so an attachment loaded as a
+        // reference point is detached, keeping what is attached to it.
+        bool isAdded = true;
+        const auto attachmentIter = m_Attachments.find(referencePoint.id);
+        if (attachmentIter != m_Attachments.end())
+        {
+            DetachLocked(attachmentIter->second);
+            m_Attachments.erase(attachmentIter);
+            isAdded = false;
+        }
+
+        const auto result = m_ReferencePoints.emplace(referencePoint.id, referencePoint);
+        if (!result.second)
+            result.first->second = referencePoint;
+
+        // A loaded pose is reported as it is, not smoothed towards.
+        m_PoseFilters.erase(referencePoint.id);
+        MarkChangedLocked(referencePoint.id, isAdded && result.second ? kReferencePointAdded : kReferencePointUpdated);
+        MarkMovedLocked(referencePoint.id);
+    }
+
+    m_Attachments.reserve(m_Attachments.size() + numAttachments);
+    for (size_t i = 0; i < numAttachments; ++i)
+    {
+        const auto& record = attachmentRecords[i];
+        AttachedReferencePoint attachment;
+        FromRecord(record.referencePoint, attachment);
+        attachment.attacheeId.idPart[0] = record.attacheeId[0];
+        attachment.attacheeId.idPart[1] = record.attacheeId[1];
+        attachment.attacheeType = record.attacheeType == kAttacheeReferencePoint ? kAttacheeReferencePoint : kAttacheePlane;
+        attachment.localPose.position = {record.localPosition[0], record.localPosition[1], record.localPosition[2]};
+        attachment.localPose.rotation = {record.localRotation[0], record.localRotation[1], record.localRotation[2], record.localRotation[3]};
+
+        // Only a corrupt file attaches a reference point to itself or to one
+        // attached to it.
+        if (attachment.attacheeId == attachment.id || IsAttachedToLocked(attachment.attacheeId, attachment.id))
+            continue;
+
+        // Replacing an attachment, or a reference point loaded above, keeps
+        // what is attached to it.
+        const auto iter = m_Attachments.find(attachment.id);
+        bool isAdded = iter == m_Attachments.end();
+        if (!isAdded)
+            DetachLocked(iter->second);
+
+        if (m_ReferencePoints.erase(attachment.id) != 0)
+        {
+            m_PoseFilters.erase(attachment.id);
+            isAdded = false;
+        }
+
+        m_Attachments[attachment.id] = attachment;
+        AddToAttacheeLocked(attachment.id, attachment.attacheeId, attachment.attacheeType, 0);
+        MarkChangedLocked(attachment.id, isAdded ? kReferencePointAdded : kReferencePointUpdated);
+
+        // Every loaded attachment is moved onto its attachee on the next
+        // update, or dropped if it does not exist.
+        m_MovedAttachees.push_back(attachment.attacheeId);
+    }
+
+    ++m_Version;
+    return true;
 }
 
 void ReferencePointProvider::AddReferencePoint(UnityXRReferencePoint referencePoint)
 {
-    m_ReferencePoints[referencePoint.id] = referencePoint;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    referencePoint.id = GetLocalIdLocked(referencePoint.id);
+    const auto result = m_ReferencePoints.emplace(referencePoint.id, referencePoint);
+    if (!result.second)
+        result.first->second = referencePoint;
+
+    MarkChangedLocked(referencePoint.id, result.second ? kReferencePointAdded : kReferencePointUpdated);
+    MarkMovedLocked(referencePoint.id);
+    AddPoseSampleLocked(referencePoint.id, referencePoint.pose, Clock::now());
+    ++m_Version;
+}
+
+void ReferencePointProvider::SetSmoothing(bool enabled, const ReferencePointSmoothingSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_IsSmoothing = enabled;
+    m_SmoothingSettings = settings;
+    m_PoseFilters.clear();
+}
+
+void ReferencePointProvider::AddPoseSampleLocked(
+    const UnityXRTrackableId& referencePointId, const UnityXRPose& pose, Clock::time_point now)
+{
+    if (!m_IsSmoothing)
+        return;
+
+    const auto result = m_PoseFilters.emplace(referencePointId, PoseFilter());
+    auto& filter = result.first->second;
+    if (!result.second)
+    {
+        filter.previousPosition = filter.position;
+        filter.previousUpdateTime = filter.updateTime;
+        filter.hasPreviousUpdate = true;
+    }
+
+    filter.position = pose.position;
+    filter.rotation = pose.rotation;
+    filter.updateTime = now;
+}
+
+UnityXRPose ReferencePointProvider::GetSmoothedPoseLocked(const UnityXRReferencePoint& referencePoint, Clock::time_point now)
+{
+    // Reference points that have not been updated since smoothing was enabled
+    // are reported as they are.
+    const auto iter = m_PoseFilters.find(referencePoint.id);
+    if (iter == m_PoseFilters.end())
+        return referencePoint.pose;
+
+    auto& filter = iter->second;
+    const auto& settings = m_SmoothingSettings;
+
+    // Predicted along the velocity between the last two updates, so the filter
+    // follows a moving reference point between updates instead of stepping.
+    UnityXRVector3 target = filter.position;
+    if (filter.hasPreviousUpdate && settings.maxExtrapolation > 0.f)
+    {
+        const float updateInterval = ToSeconds(filter.updateTime - filter.previousUpdateTime);
+        if (updateInterval > 0.f)
+        {
+            const UnityXRVector3 velocity = Mul(Sub(filter.position, filter.previousPosition), 1.f / updateInterval);
+            const float elapsed = std::min(ToSeconds(now - filter.updateTime), settings.maxExtrapolation);
+            target = Add(target, Mul(velocity, elapsed));
+        }
+    }
+
+    if (!filter.isFiltered)
+    {
+        filter.filteredPosition = target;
+        filter.filteredRotation = filter.rotation;
+        filter.filteredSpeed = UnityXRVector3{0, 0, 0};
+        filter.filterTime = now;
+        filter.isFiltered = true;
+        return UnityXRPose{target, filter.rotation};
+    }
+
+    const float dt = ToSeconds(now - filter.filterTime);
+    if (dt > 0.f)
+    {
+        // One-euro filter: the cutoff rises with the filtered speed.
+        const UnityXRVector3 speed = Mul(Sub(target, filter.filteredPosition), 1.f / dt);
+        filter.filteredSpeed = Lerp(filter.filteredSpeed, speed, GetSmoothingFactor(settings.derivativeCutoff, dt));
+
+        const float cutoff = settings.minCutoff + settings.beta * Length(filter.filteredSpeed);
+        const float smoothingFactor = GetSmoothingFactor(cutoff, dt);
+        filter.filteredPosition = Lerp(filter.filteredPosition, target, smoothingFactor);
+        filter.filteredRotation = Slerp(filter.filteredRotation, filter.rotation, smoothingFactor);
+        filter.filterTime = now;
+    }
+
+    return UnityXRPose{filter.filteredPosition, filter.filteredRotation};
+}
+
+UnityXRTrackableId ReferencePointProvider::GetLocalIdLocked(const UnityXRTrackableId& trackableId) const
+{
+    const auto iter = m_LocalIds.find(trackableId);
+    return iter != m_LocalIds.end() ? iter->second : trackableId;
+}
+
+void ReferencePointProvider::CompleteAddReferencePoint(
+    int requestId, bool result, const UnityXRTrackableId& deviceId, UnityXRTrackingState trackingState)
+{
+    std::lock_guard<std::mutex> lock(m_AddCompletionsMutex);
+    m_AddCompletions.push_back(AddCompletion{requestId, result, deviceId, trackingState});
+}
+
+std::vector<UnityXRTrackableId> ReferencePointProvider::ApplyAddCompletionsLocked()
+{
+    std::vector<AddCompletion> completions;
+    {
+        std::lock_guard<std::mutex> lock(m_AddCompletionsMutex);
+        completions.swap(m_AddCompletions);
+    }
+
+    std::vector<UnityXRTrackableId> orphanedDeviceIds;
+    for (const auto& completion : completions)
+    {
+        const auto pendingIter = m_PendingAdds.find(completion.requestId);
+        if (pendingIter == m_PendingAdds.end())
+            continue;
+
+        const UnityXRTrackableId localId = pendingIter->second;
+        m_PendingAdds.erase(pendingIter);
+
+        const auto iter = m_ReferencePoints.find(localId);
+        if (iter == m_ReferencePoints.end())
+        {
+            if (completion.result)
+                orphanedDeviceIds.push_back(completion.deviceId);
+
+            continue;
+        }
+
+        if (!completion.result)
+        {
+            m_ReferencePoints.erase(iter);
+            m_DeviceIds.erase(localId);
+            MarkChangedLocked(localId, kReferencePointRemoved);
+            MarkMovedLocked(localId);
+            ++m_Version;
+            continue;
+        }
+
+        iter->second.trackingState = completion.trackingState;
+        m_DeviceIds[localId] = completion.deviceId;
+        m_LocalIds[completion.deviceId] = localId;
+        MarkChangedLocked(localId, kReferencePointUpdated);
+        ++m_Version;
+    }
+
+    return orphanedDeviceIds;
+}
+
+bool ReferencePointProvider::RemoveAsyncAddedLocked(const UnityXRTrackableId& referencePointId, UnityXRTrackableId* deviceIdOut)
+{
+    const auto iter = m_DeviceIds.find(referencePointId);
+    if (iter == m_DeviceIds.end())
+        return false;
+
+    // A pending add is answered later, and the device's reference point removed then.
+    *deviceIdOut = iter->second;
+    if (iter->second != kInvalidId)
+        m_LocalIds.erase(iter->second);
+
+    m_DeviceIds.erase(iter);
+    m_ReferencePoints.erase(referencePointId);
+    MarkChangedLocked(referencePointId, kReferencePointRemoved);
+    MarkMovedLocked(referencePointId);
+    ++m_Version;
+    return true;
+}
+
+std::vector<UnityXRTrackableId> ReferencePointProvider::UpdateLocked()
+{
+    auto orphanedDeviceIds = ApplyAddCompletionsLocked();
+    UpdateAttachmentsLocked();
+    return orphanedDeviceIds;
+}
+
+void ReferencePointProvider::MarkChangedLocked(const UnityXRTrackableId& referencePointId, ReferencePointChange change)
+{
+    // Every removal passes through here, so it also drops the pose filter.
+    if (change == kReferencePointRemoved)
+    {
+        m_SpatialIndex.Remove(referencePointId);
+        m_PoseFilters.erase(referencePointId);
+    }
+    else if (const UnityXRReferencePoint* referencePoint = FindReferencePointLocked(referencePointId))
+        m_SpatialIndex.Set(referencePointId, referencePoint->pose.position);
+
+    if (!m_IsTrackingChanges)
+        return;
+
+    const auto result = m_Changes.emplace(referencePointId, change);
+    if (result.second)
+        return;
+
+    // Adding and then removing is no change at all, removing and then adding
+    // again is an update. Otherwise an add stays an add.
+    auto& unreported = result.first->second;
+    if (change == kReferencePointRemoved)
+    {
+        if (unreported == kReferencePointAdded)
+            m_Changes.erase(result.first);
+        else
+            unreported = kReferencePointRemoved;
+    }
+    else if (unreported == kReferencePointRemoved)
+    {
+        unreported = kReferencePointUpdated;
+    }
+}
+
+void ReferencePointProvider::SetChangeTracking(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_IsTrackingChanges = enabled;
+    m_Changes.clear();
+    if (!enabled)
+        return;
+
+    m_Changes.reserve(m_ReferencePoints.size() + m_Attachments.size());
+    for (const auto& iter : m_ReferencePoints)
+        m_Changes.emplace(iter.first, kReferencePointAdded);
+
+    for (const auto& iter : m_Attachments)
+        m_Changes.emplace(iter.first, kReferencePointAdded);
+}
+
+bool ReferencePointProvider::GetChanges(
+    UnityXRReferencePoint* changedOut, size_t changedCapacity,
+    UnityXRTrackableId* removedOut, size_t removedCapacity,
+    size_t* addedCountOut, size_t* updatedCountOut, size_t* removedCountOut)
+{
+    std::vector<UnityXRTrackableId> orphanedDeviceIds;
+    bool copied = false;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        orphanedDeviceIds = UpdateLocked();
+
+        size_t counts[3] = {};
+        for (const auto& iter : m_Changes)
+            ++counts[iter.second];
+
+        *addedCountOut = counts[kReferencePointAdded];
+        *updatedCountOut = counts[kReferencePointUpdated];
+        *removedCountOut = counts[kReferencePointRemoved];
+        if (counts[kReferencePointAdded] + counts[kReferencePointUpdated] <= changedCapacity &&
+            counts[kReferencePointRemoved] <= removedCapacity)
+        {
+            UnityXRReferencePoint* updatedOut = changedOut + counts[kReferencePointAdded];
+            for (const auto& iter : m_Changes)
+            {
+                if (iter.second == kReferencePointRemoved)
+                {
+                    *removedOut++ = iter.first;
+                    continue;
+                }
+
+                auto& referencePointOut = iter.second == kReferencePointAdded ? *changedOut++ : *updatedOut++;
+                referencePointOut = *FindReferencePointLocked(iter.first);
+            }
+
+            m_Changes.clear();
+            copied = true;
+        }
+    }
+
+    RemoveOnDevice(orphanedDeviceIds);
+    return copied;
+}
+
+const UnityXRReferencePoint* ReferencePointProvider::FindReferencePointLocked(const UnityXRTrackableId& referencePointId) const
+{
+    const auto iter = m_ReferencePoints.find(referencePointId);
+    if (iter != m_ReferencePoints.end())
+        return &iter->second;
+
+    const auto attachmentIter = m_Attachments.find(referencePointId);
+    return attachmentIter != m_Attachments.end() ? &attachmentIter->second : nullptr;
+}
+
+template<typename Find>
+size_t ReferencePointProvider::FindReferencePoints(const Find& find, UnityXRReferencePoint* referencePointsOut, size_t capacity)
+{
+    std::vector<UnityXRTrackableId> orphanedDeviceIds;
+    size_t numFound;
+    {
+        // Updated first, so attached reference points are found where they are now.
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        orphanedDeviceIds = UpdateLocked();
+
+        m_FoundIds.clear();
+        find(m_FoundIds);
+        numFound = m_FoundIds.size();
+        for (size_t i = 0; i < numFound && i < capacity; ++i)
+            referencePointsOut[i] = *FindReferencePointLocked(m_FoundIds[i]);
+    }
+
+    RemoveOnDevice(orphanedDeviceIds);
+    return numFound;
+}
+
+size_t ReferencePointProvider::FindReferencePointsInRadius(
+    const UnityXRVector3& center, float radius, UnityXRReferencePoint* referencePointsOut, size_t capacity)
+{
+    return FindReferencePoints([&](std::vector<UnityXRTrackableId>& idsOut)
+    {
+        m_SpatialIndex.FindInRadius(center, radius, idsOut);
+    }, referencePointsOut, capacity);
+}
+
+size_t ReferencePointProvider::FindNearestReferencePoints(
+    const UnityXRVector3& center, float maxDistance, UnityXRReferencePoint* referencePointsOut, size_t capacity)
+{
+    return FindReferencePoints([&](std::vector<UnityXRTrackableId>& idsOut)
+    {
+        m_SpatialIndex.FindNearest(center, capacity, maxDistance, idsOut);
+    }, referencePointsOut, capacity);
+}
+
+size_t ReferencePointProvider::FindReferencePointsInside(
+    const UnityXRVector4* planes, size_t planeCount, UnityXRReferencePoint* referencePointsOut, size_t capacity)
+{
+    return FindReferencePoints([&](std::vector<UnityXRTrackableId>& idsOut)
+    {
+        m_SpatialIndex.FindInside(planes, planeCount, idsOut);
+    }, referencePointsOut, capacity);
+}
+
+void ReferencePointProvider::SetSpatialIndexCellSize(float cellSize)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_SpatialIndex.SetCellSize(cellSize);
+}
+
+void ReferencePointProvider::SetHitRadius(float hitRadius)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_HitRadius = hitRadius;
+    ++m_Version;
+}
+
+uint64_t ReferencePointProvider::GetVersion() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Version;
+}
+
+void ReferencePointProvider::Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeReferencePoint) == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    RaycastLocked(ray, 0.f, hitsOut);
+}
+
+void ReferencePointProvider::SphereCast(
+    const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeReferencePoint) == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    RaycastLocked(ray, radius, hitsOut);
+}
+
+void ReferencePointProvider::Raycast(
+    const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const
+{
+    if ((hitFlags & kUnityXRMockTrackableTypeReferencePoint) == 0)
+        return;
+
+    // Workers only read the reference points, which stay locked until every range is done.
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    RunParallelFor(count, kRaycastBatchGrainSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            RaycastLocked(rays[i], 0.f, hitsOut[i]);
+    });
+}
+
+void ReferencePointProvider::RaycastLocked(const Ray& ray, float sweepRadius, RaycastHitCollector& hitsOut) const
+{
+    for (const auto& iter : m_ReferencePoints)
+        AddHit(ray, sweepRadius, iter.second, hitsOut);
+
+    for (const auto& iter : m_Attachments)
+    {
+        const auto& attachment = iter.second;
+        if (attachment.attacheeType != kAttacheePlane)
+        {
+            AddHit(ray, sweepRadius, attachment, hitsOut);
+            continue;
+        }
+
+        // Reference points attached to a plane follow it before the next
+        // update. The plane may be gone before that too.
+        UnityXRPose planePose;
+        uint64_t planeVersion;
+        if (!TryGetAttacheePoseLocked(attachment.attacheeId, kAttacheePlane, &planePose, &planeVersion))
+            continue;
+
+        UnityXRReferencePoint referencePoint = attachment;
+        referencePoint.pose = TransformPose(planePose, attachment.localPose);
+        AddHit(ray, sweepRadius, referencePoint, hitsOut);
+    }
+}
+
+void ReferencePointProvider::AddHit(
+    const Ray& ray, float sweepRadius, const UnityXRReferencePoint& referencePoint, RaycastHitCollector& hitsOut) const
+{
+    const auto& position = referencePoint.pose.position;
+    float distance;
+    if (!ColliderRegistry::IntersectCapsule(ray, position, position, m_HitRadius + sweepRadius, &distance) ||
+        distance > hitsOut.GetMaxDistance())
+        return;
+
+    // A swept sphere touches the hit sphere sweepRadius short of its center.
+    const auto center = Add(ray.origin, Mul(ray.direction, distance));
+    UnityXRRaycastHit hit;
+    hit.trackableId = referencePoint.id;
+    hit.pose.position = Add(center, Mul(Normalize(Sub(position, center)), sweepRadius));
+    hit.pose.rotation = referencePoint.pose.rotation;
+    hit.distance = distance;
+    SetMockHitType(hit, kUnityXRMockTrackableTypeReferencePoint);
+    hitsOut.Add(hit);
 }
 
 void ReferencePointProvider::SetAddResponseData(unsigned long id0, unsigned long id1, bool result, int tracking)
@@ -156,7 +1344,48 @@ void ReferencePointProvider::SetAddResponseData(unsigned long id0, unsigned long
 
 bool UNITY_INTERFACE_API ReferencePointProvider::TryAddReferencePoint(const UnityXRPose& referencePointPose, UnityXRTrackableId& outReferencePointId, UnityXRTrackingState& outTrackingState)
 {
-    if (s_AddReferencePointHandler)
+    if (AsyncAddReferencePoint handler = s_AsyncAddReferencePointHandler)
+    {
+        // Added right away with a local id, its tracking state unknown until
+        // the device answers.
+        auto newId = GenerateTrackableId();
+        if (newId == kInvalidId)
+            return false;
+
+        int requestId;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_ReferencePoints[newId] = UnityXRReferencePoint
+            {
+                newId,
+                referencePointPose,
+                kUnityXRTrackingStateUnknown
+            };
+            m_DeviceIds[newId] = kInvalidId;
+            MarkChangedLocked(newId, kReferencePointAdded);
+            ++m_Version;
+
+            requestId = m_NextAddRequestId++;
+            if (m_NextAddRequestId <= 0)
+                m_NextAddRequestId = 1;
+
+            m_PendingAdds[requestId] = newId;
+        }
+
+        handler(requestId,
+            referencePointPose.position.x,
+            referencePointPose.position.y,
+            referencePointPose.position.z,
+            referencePointPose.rotation.x,
+            referencePointPose.rotation.y,
+            referencePointPose.rotation.z,
+            referencePointPose.rotation.w);
+
+        outReferencePointId = newId;
+        outTrackingState = kUnityXRTrackingStateUnknown;
+        return true;
+    }
+    else if (s_AddReferencePointHandler)
     {
         unsigned char* resultBytes = s_AddReferencePointHandler(referencePointPose.position.x,
             referencePointPose.position.y,
@@ -191,6 +1420,8 @@ bool UNITY_INTERFACE_API ReferencePointProvider::TryAddReferencePoint(const Unit
             referencePointPose,
             kUnityXRTrackingStateTracking
         };
+        MarkChangedLocked(newId, kReferencePointAdded);
+        ++m_Version;
 
         outReferencePointId = newId;
         outTrackingState = kUnityXRTrackingStateTracking;
@@ -200,6 +1431,21 @@ bool UNITY_INTERFACE_API ReferencePointProvider::TryAddReferencePoint(const Unit
 
 bool UNITY_INTERFACE_API ReferencePointProvider::TryRemoveReferencePoint(const UnityXRTrackableId& referencePointId)
 {
+    UnityXRTrackableId deviceId;
+    bool wasAsyncAdded;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        wasAsyncAdded = RemoveAsyncAddedLocked(referencePointId, &deviceId);
+    }
+
+    if (wasAsyncAdded)
+    {
+        if (s_RemoveReferencePointHandler && deviceId != kInvalidId)
+            s_RemoveReferencePointHandler(deviceId.idPart[0], deviceId.idPart[1]);
+
+        return true;
+    }
+
     if (s_RemoveReferencePointHandler)
         return s_RemoveReferencePointHandler(referencePointId.idPart[0], referencePointId.idPart[1]);
 
@@ -209,6 +1455,9 @@ bool UNITY_INTERFACE_API ReferencePointProvider::TryRemoveReferencePoint(const U
         if (iter != m_ReferencePoints.end())
         {
             m_ReferencePoints.erase(iter);
+            MarkChangedLocked(referencePointId, kReferencePointRemoved);
+            MarkMovedLocked(referencePointId);
+            ++m_Version;
             return true;
         }
     }
@@ -217,7 +1466,8 @@ bool UNITY_INTERFACE_API ReferencePointProvider::TryRemoveReferencePoint(const U
         auto iter = m_Attachments.find(referencePointId);
         if (iter != m_Attachments.end())
         {
-            m_Attachments.erase(iter);
+            RemoveAttachmentLocked(iter->second);
+            ++m_Version;
             return true;
         }
     }
@@ -227,54 +1477,35 @@ bool UNITY_INTERFACE_API ReferencePointProvider::TryRemoveReferencePoint(const U
 
 bool UNITY_INTERFACE_API ReferencePointProvider::GetAllReferencePoints(IUnityXRReferencePointAllocator& allocator)
 {
-    std::vector<UnityXRReferencePoint> referencePoints;
+    std::vector<UnityXRTrackableId> orphanedDeviceIds;
     {
+        // Copied straight into Unity's buffer, which is allocated under the
+        // lock so the count cannot change in between.
         std::lock_guard<std::mutex> lock(m_Mutex);
-        referencePoints.reserve(m_Attachments.size() + m_ReferencePoints.size());
-
-        for (auto iter : m_ReferencePoints)
-            referencePoints.push_back(iter.second);
+        orphanedDeviceIds = UpdateLocked();
 
-        if (auto planeProvider = PlaneProvider::GetInstance())
+        UnityXRReferencePoint* referencePointsOut = allocator.AllocateReferencePoints(m_ReferencePoints.size() + m_Attachments.size());
+        if (m_IsSmoothing)
         {
-            auto planes = planeProvider->GetPlanesWithoutBoundaries();
-
-            std::vector<UnityXRTrackableId> attachmentsToRemove;
-            for (auto iter : m_Attachments)
+            const Clock::time_point now = Clock::now();
+            for (const auto& iter : m_ReferencePoints)
             {
-                auto& attacher = iter.second;
-                auto planeIter = planes.find(attacher.attacheeId);
-
-                // The plane may have been removed. If so, remove
-                // the attached reference point.
-                if (planeIter == planes.end())
-                {
-                    attachmentsToRemove.push_back(iter.first);
-                    continue;
-                }
-
-                const auto& plane = planeIter->second;
-
-                // Update position based on current distance to plane
-                const auto planeNormal = Mul(plane.pose.rotation, kUp);
-                const float distanceToPlane = Dot(Sub(attacher.pose.position, plane.pose.position), planeNormal);
-                attacher.pose.position = Add(attacher.pose.position, Mul(planeNormal, (attacher.distance - distanceToPlane)));
-
-                referencePoints.push_back(attacher);
-            }
-
-            for (const auto& id : attachmentsToRemove)
-            {
-                m_Attachments.erase(id);
+                *referencePointsOut = iter.second;
+                referencePointsOut->pose = GetSmoothedPoseLocked(iter.second, now);
+                ++referencePointsOut;
             }
         }
-    }
+        else
+        {
+            for (const auto& iter : m_ReferencePoints)
+                *referencePointsOut++ = iter.second;
+        }
 
-    std::copy(
-        referencePoints.begin(),
-        referencePoints.end(),
-        allocator.AllocateReferencePoints(referencePoints.size()));
+        for (const auto& iter : m_Attachments)
+            *referencePointsOut++ = iter.second;
+    }
 
+    RemoveOnDevice(orphanedDeviceIds);
     return true;
 }
 
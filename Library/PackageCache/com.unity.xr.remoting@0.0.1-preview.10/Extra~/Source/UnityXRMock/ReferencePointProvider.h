@@ -1,19 +1,75 @@
 #pragma once
 #include "IUnityXRReferencePoint.deprecated.h"
+#include "IUnityXRRaycast.h"
 #include "XRProvider.h"
 #include "TrackableIdHelpers.h"
+#include "TrackableIdMap.h"
+#include "TrackableGrid.h"
+#include "Ray.h"
+#include "RaycastHitCollector.h"
 
+#include <chrono>
+#include <cstdint>
 #include <unordered_map>
 #include <mutex>
+#include <vector>
+
+// Kind of trackable a reference point is attached to.
+enum AttacheeType : uint32_t
+{
+    kAttacheePlane,
+    kAttacheeReferencePoint
+};
 
 struct AttachedReferencePoint : UnityXRReferencePoint
 {
     UnityXRTrackableId attacheeId;
-    float distance;
+    AttacheeType attacheeType;
+
+    // Pose relative to the attachee, kept as the attachee moves.
+    UnityXRPose localPose;
+};
+
+typedef TrackableIdMap<UnityXRReferencePoint> IdToReferencePointMap;
+typedef TrackableIdMap<AttachedReferencePoint> IdToAttachmentsMap;
+
+// The reference points attached directly to one trackable.
+struct TrackableAttachments
+{
+    AttacheeType attacheeType;
+
+    // PlaneProvider version of a plane attachee the attached poses were last computed at.
+    uint64_t planeVersion;
+
+    std::vector<UnityXRTrackableId> referencePointIds;
 };
 
-typedef std::unordered_map<UnityXRTrackableId, UnityXRReferencePoint> IdToReferencePointMap;
-typedef std::unordered_map<UnityXRTrackableId, AttachedReferencePoint> IdToAttachmentsMap;
+typedef TrackableIdMap<TrackableAttachments> AttacheeToAttachmentsMap;
+
+struct ReferencePointSmoothingSettings
+{
+    // Cutoff frequency of the one-euro filter on positions at rest, in Hz.
+    // Lower is smoother but lags more.
+    float minCutoff = 1.f;
+
+    // How much the cutoff rises with speed, in Hz per m/s, so moving
+    // reference points lag less.
+    float beta = 2.f;
+
+    // Cutoff frequency of the speed estimate, in Hz.
+    float derivativeCutoff = 1.f;
+
+    // How long past its last update a reference point keeps moving at the
+    // velocity of its last two updates, in seconds. 0 disables prediction.
+    float maxExtrapolation = .1f;
+};
+
+enum ReferencePointChange
+{
+    kReferencePointAdded,
+    kReferencePointUpdated,
+    kReferencePointRemoved
+};
 
 class ReferencePointProvider : public XRProvider<ReferencePointProvider, IUnityXRReferencePointProvider>
 {
@@ -25,12 +81,212 @@ public:
 
     void SetAddResponseData(unsigned long id0, unsigned long id1, bool result, int tracking);
 
-    UnityXRTrackableId AttachReferencePoint(const UnityXRTrackableId& planeId, const UnityXRPose& pose);
+    // Queues the device's answer to a reference point added through the async
+    // add handler. Answers are applied on the next GetAllReferencePoints. A
+    // successful answer sets the tracking state and maps deviceId to the id
+    // the reference point was added with; a failed one removes it.
+    void CompleteAddReferencePoint(
+        int requestId, bool result, const UnityXRTrackableId& deviceId, UnityXRTrackingState trackingState);
+
+    // Adds a reference point that keeps its pose relative to a plane or to
+    // another reference point, attached ones included. Returns kInvalidId if
+    // there is no such trackable.
+    UnityXRTrackableId AttachReferencePoint(const UnityXRTrackableId& attacheeId, const UnityXRPose& pose);
+
+    // Attaches an attached reference point to another trackable, keeping its
+    // current pose. Returns false if either does not exist, or if attacheeId
+    // is attached to referencePointId, which would make a cycle.
+    bool ReattachReferencePoint(const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& attacheeId);
 
     void UpdateReferencePoint(UnityXRTrackableId trackableId, UnityXRPose pose, UnityXRTrackingState trackingState);
 
+    // Adds or updates referencePoints, then removes the reference points in
+    // removedIds, all under one lock. Ids may be the device's for reference
+    // points added asynchronously.
+    void SetReferencePoints(
+        const UnityXRReferencePoint* referencePoints, size_t count,
+        const UnityXRTrackableId* removedIds, size_t removedCount);
+
+    // Removes the reference points attached to a plane, directly or through
+    // other attached reference points. Called by PlaneProvider when the plane
+    // is removed.
+    void RemoveAttachments(const UnityXRTrackableId& planeId);
+
+    // Writes every reference point, attached ones included, to a binary file.
+    bool SaveReferencePoints(const char* path) const;
+
+    // Adds or updates the reference points in a file written by
+    // SaveReferencePoints. Attached ones are moved with their plane on the next
+    // update, and dropped if it does not exist. Returns false, changing
+    // nothing, if the file cannot be read or has another format version.
+    bool LoadReferencePoints(const char* path);
+
+    // While enabled, reference points that are added, updated or removed are
+    // recorded for GetChanges. Enabling reports every existing reference point
+    // as added.
+    void SetChangeTracking(bool enabled);
+
+    // Copies the reference points added and then those updated since the last
+    // call to changedOut, and the ids of those removed to removedOut. If
+    // either buffer is too small nothing is copied, the required counts are
+    // still written, the changes are kept, and false is returned.
+    bool GetChanges(
+        UnityXRReferencePoint* changedOut, size_t changedCapacity,
+        UnityXRTrackableId* removedOut, size_t removedCapacity,
+        size_t* addedCountOut, size_t* updatedCountOut, size_t* removedCountOut);
+
+    // Smooths the poses GetAllReferencePoints reports for reference points
+    // updated through UpdateReferencePoint, AddReferencePoint or
+    // SetReferencePoints, which arrive at the rate of the remoting link.
+    // Positions go through a one-euro filter and rotations are slerped by
+    // the same amount. Raycasts, saving and GetChanges use the latest poses.
+    void SetSmoothing(bool enabled, const ReferencePointSmoothingSettings& settings);
+
+    // Spatial queries over every reference point, attached ones included, at
+    // their latest poses. Each copies up to capacity of the reference points
+    // found to referencePointsOut and returns how many were found.
+    size_t FindReferencePointsInRadius(
+        const UnityXRVector3& center, float radius, UnityXRReferencePoint* referencePointsOut, size_t capacity);
+
+    // Finds the capacity reference points nearest to center, nearest first,
+    // ignoring those farther than maxDistance.
+    size_t FindNearestReferencePoints(
+        const UnityXRVector3& center, float maxDistance, UnityXRReferencePoint* referencePointsOut, size_t capacity);
+
+    // Finds the reference points on the positive side of every plane, as
+    // for TrackableGrid::FindInside.
+    size_t FindReferencePointsInside(
+        const UnityXRVector4* planes, size_t planeCount, UnityXRReferencePoint* referencePointsOut, size_t capacity);
+
+    // Size of the cells of the grid the spatial queries search, in meters.
+    // Queries visit fewer empty cells with larger cells, and test fewer
+    // reference points with smaller ones.
+    void SetSpatialIndexCellSize(float cellSize);
+
+    // Radius of the sphere raycasts hit around each reference point, in meters.
+    void SetHitRadius(float hitRadius);
+
+    // Incremented whenever a reference point is added, moved or removed.
+    // Attached reference points also move with their plane.
+    uint64_t GetVersion() const;
+
+    // Adds a hit for each reference point whose sphere the ray enters.
+    void Raycast(const Ray& ray, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
+    // Raycasts all rays under one lock, adding the hits of rays[i] to hitsOut[i].
+    void Raycast(const Ray* rays, size_t count, uint32_t hitFlags, RaycastHitCollector* hitsOut) const;
+
+    // Like Raycast, for a sphere of the given radius moving along ray.
+    void SphereCast(const Ray& ray, float radius, uint32_t hitFlags, RaycastHitCollector& hitsOut) const;
+
 private:
 
+    typedef std::chrono::steady_clock Clock;
+
+    struct PoseFilter
+    {
+        // The last two updates, for the velocity to predict with.
+        UnityXRVector3 position;
+        UnityXRVector3 previousPosition;
+        UnityXRVector4 rotation;
+        Clock::time_point updateTime;
+        Clock::time_point previousUpdateTime;
+        bool hasPreviousUpdate;
+
+        // Output of the filter at filterTime.
+        UnityXRVector3 filteredPosition;
+        UnityXRVector4 filteredRotation;
+        UnityXRVector3 filteredSpeed;
+        Clock::time_point filterTime;
+        bool isFiltered;
+    };
+
+    // Records an update of a reference point's pose for smoothing.
+    void AddPoseSampleLocked(const UnityXRTrackableId& referencePointId, const UnityXRPose& pose, Clock::time_point now);
+
+    // The smoothed pose of a reference point at time now.
+    UnityXRPose GetSmoothedPoseLocked(const UnityXRReferencePoint& referencePoint, Clock::time_point now);
+
+    struct AddCompletion
+    {
+        int requestId;
+        bool result;
+        UnityXRTrackableId deviceId;
+        UnityXRTrackingState trackingState;
+    };
+
+    // Applies the queued add answers and moves the attached reference points.
+    // Returns the device ids ApplyAddCompletionsLocked returns.
+    std::vector<UnityXRTrackableId> UpdateLocked();
+
+    // Records a change for GetChanges, merged with one not reported yet, and
+    // moves the reference point in the spatial index.
+    void MarkChangedLocked(const UnityXRTrackableId& referencePointId, ReferencePointChange change);
+
+    const UnityXRReferencePoint* FindReferencePointLocked(const UnityXRTrackableId& referencePointId) const;
+
+    // Updates, then runs find(idsOut) on the spatial index and copies what
+    // it found.
+    template<typename Find>
+    size_t FindReferencePoints(const Find& find, UnityXRReferencePoint* referencePointsOut, size_t capacity);
+
+    // Applies the queued answers to async adds. Returns the device ids of
+    // reference points removed before their add completed, which the device
+    // should remove too.
+    std::vector<UnityXRTrackableId> ApplyAddCompletionsLocked();
+
+    // Removes a reference point added through the async add handler. Returns
+    // false if it was not added that way.
+    bool RemoveAsyncAddedLocked(const UnityXRTrackableId& referencePointId, UnityXRTrackableId* deviceIdOut);
+
+    // The id a reference point was added with, for ids the device reports.
+    UnityXRTrackableId GetLocalIdLocked(const UnityXRTrackableId& trackableId) const;
+
+    // Moves the reference points attached to trackables that moved since the
+    // last call, in one pass that visits each attachee before what is attached
+    // to it, and drops those whose attachee is gone.
+    void UpdateAttachmentsLocked();
+
+    // Records that an unattached reference point moved or was removed, for
+    // the next UpdateAttachmentsLocked to move what is attached to it.
+    void MarkMovedLocked(const UnityXRTrackableId& referencePointId);
+
+    // Finds a reference point, then a plane, with the given id.
+    bool FindAttacheeLocked(
+        const UnityXRTrackableId& attacheeId, AttacheeType* attacheeTypeOut,
+        UnityXRPose* poseOut, uint64_t* planeVersionOut) const;
+
+    // planeVersionOut is only written for planes.
+    bool TryGetAttacheePoseLocked(
+        const UnityXRTrackableId& attacheeId, AttacheeType attacheeType,
+        UnityXRPose* poseOut, uint64_t* planeVersionOut) const;
+
+    // The pose the next update moves an attachment to, following its chain
+    // of attachees. Returns false if one of them is gone.
+    bool TryGetCurrentPoseLocked(const AttachedReferencePoint& attachment, UnityXRPose* poseOut) const;
+
+    // Whether referencePointId is attached to ancestorId, directly or not.
+    bool IsAttachedToLocked(const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& ancestorId) const;
+
+    void AddToAttacheeLocked(
+        const UnityXRTrackableId& referencePointId, const UnityXRTrackableId& attacheeId,
+        AttacheeType attacheeType, uint64_t planeVersion);
+
+    void DetachLocked(const AttachedReferencePoint& attachment);
+
+    // Removes an attached reference point and everything attached to it.
+    void RemoveAttachmentLocked(const AttachedReferencePoint& attachment);
+
+    // Removes everything attached to a trackable, directly or not. Returns
+    // false if nothing was.
+    bool RemoveAttachmentsLocked(const UnityXRTrackableId& attacheeId);
+
+    // Casts a sphere of sweepRadius, 0 for a ray.
+    void RaycastLocked(const Ray& ray, float sweepRadius, RaycastHitCollector& hitsOut) const;
+
+    void AddHit(
+        const Ray& ray, float sweepRadius, const UnityXRReferencePoint& referencePoint, RaycastHitCollector& hitsOut) const;
+
     bool UNITY_INTERFACE_API TryAddReferencePoint(const UnityXRPose& referencePointPose, UnityXRTrackableId& outReferencePointId, UnityXRTrackingState& outTrackingState) final;
 
     bool UNITY_INTERFACE_API TryRemoveReferencePoint(const UnityXRTrackableId& referencePointId) final;
@@ -62,9 +318,58 @@ private:
 
     IdToReferencePointMap m_ReferencePoints;
 
+    // Local ids of async adds the device has not answered yet, by request id.
+    std::unordered_map<int, UnityXRTrackableId> m_PendingAdds;
+
+    int m_NextAddRequestId = 1;
+
+    // Device ids of async added reference points by local id, kInvalidId
+    // while the add is pending, and the reverse.
+    TrackableIdMap<UnityXRTrackableId> m_DeviceIds;
+
+    TrackableIdMap<UnityXRTrackableId> m_LocalIds;
+
     IdToAttachmentsMap m_Attachments;
 
-    std::mutex m_Mutex;
+    // Reverse index of m_Attachments, by the trackable they are attached to.
+    AttacheeToAttachmentsMap m_AttachmentsByAttachee;
+
+    // Attachees that moved or were removed since the last update. May hold
+    // duplicates.
+    std::vector<UnityXRTrackableId> m_MovedAttachees;
+
+    // PlaneProvider version m_Attachments was last updated at.
+    uint64_t m_AttachmentsPlaneVersion = 0;
+
+    float m_HitRadius = .05f;
+
+    uint64_t m_Version = 0;
+
+    bool m_IsTrackingChanges = false;
+
+    bool m_IsSmoothing = false;
+
+    ReferencePointSmoothingSettings m_SmoothingSettings;
+
+    // Filter state by reference point id, while smoothing. Erased when the
+    // reference point is removed or loaded.
+    TrackableIdMap<PoseFilter> m_PoseFilters;
+
+    // Positions of m_ReferencePoints and m_Attachments.
+    TrackableGrid m_SpatialIndex;
+
+    // Results of the last spatial query, kept to reuse its storage.
+    std::vector<UnityXRTrackableId> m_FoundIds;
+
+    // Changes not yet reported by GetChanges, by reference point id.
+    TrackableIdMap<ReferencePointChange> m_Changes;
+
+    mutable std::mutex m_Mutex;
+
+    // Answers to async adds, queued from any thread without waiting on m_Mutex.
+    std::vector<AddCompletion> m_AddCompletions;
+
+    std::mutex m_AddCompletionsMutex;
 
     IUnityXRReferencePointInterface* m_CInterface = nullptr;
 };
@@ -1,5 +1,8 @@
 #include <cstring>
 #include "SessionProvider.h"
+#include "PlaneEstimator.h"
+#include "MeshingProvider.h"
+#include "OcclusionRenderer.h"
 
 extern "C"
 {
@@ -29,7 +32,14 @@ UnityXRTrackingState UNITY_INTERFACE_API SessionProvider::GetTrackingState()
 
 void UNITY_INTERFACE_API SessionProvider::BeginFrame()
 {
+	if (PlaneEstimator* planeEstimator = PlaneEstimator::GetInstance())
+		planeEstimator->RequestUpdate();
 
+	if (MeshingProvider* meshingProvider = MeshingProvider::GetInstance())
+		meshingProvider->RequestUpdate();
+
+	if (OcclusionRenderer* occlusionRenderer = OcclusionRenderer::GetInstance())
+		occlusionRenderer->RequestUpdate();
 }
 
 void UNITY_INTERFACE_API SessionProvider::BeforeRender()
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "TrackableGrid.h"
+#include "UnityMath.h"
+
+// Cell coordinates take 21 bits each in a cell key.
+static const int64_t kMaxCellCoordinate = (1 << 20) - 1;
+
+static uint64_t GetCellKey(int64_t x, int64_t y, int64_t z)
+{
+    const uint64_t mask = (1 << 21) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << 42) | ((static_cast<uint64_t>(y) & mask) << 21) | (static_cast<uint64_t>(z) & mask);
+}
+
+static bool IsBorderCoordinate(int64_t coordinate)
+{
+    return coordinate <= -kMaxCellCoordinate || coordinate >= kMaxCellCoordinate;
+}
+
+typedef std::pair<float, UnityXRTrackableId> DistanceAndId;
+
+static inline bool CompareDistance(const DistanceAndId& a, const DistanceAndId& b)
+{
+    return a.first < b.first;
+}
+
+TrackableGrid::TrackableGrid(float cellSize)
+    : m_CellSize(cellSize)
+{}
+
+void TrackableGrid::SetCellSize(float cellSize)
+{
+    std::vector<Item> items;
+    items.reserve(m_Locations.size());
+    for (const auto& iter : m_Cells)
+        items.insert(items.end(), iter.second.items.begin(), iter.second.items.end());
+
+    Clear();
+    m_CellSize = cellSize;
+    for (const auto& item : items)
+        Set(item.id, item.position);
+}
+
+void TrackableGrid::Set(const UnityXRTrackableId& id, const UnityXRVector3& position)
+{
+    int64_t coordinates[3];
+    GetCellCoordinates(position, coordinates);
+    const uint64_t cellKey = GetCellKey(coordinates[0], coordinates[1], coordinates[2]);
+
+    const auto result = m_Locations.emplace(id, Location());
+    auto& location = result.first->second;
+    if (!result.second)
+    {
+        if (location.cellKey == cellKey)
+        {
+            m_Cells[cellKey].items[location.index].position = position;
+            return;
+        }
+
+        RemoveFromCell(location);
+    }
+
+    auto& cell = m_Cells[cellKey];
+    if (cell.items.empty())
+        std::copy(coordinates, coordinates + 3, cell.coordinates);
+
+    location.cellKey = cellKey;
+    location.index = static_cast<uint32_t>(cell.items.size());
+    cell.items.push_back(Item{id, position});
+}
+
+void TrackableGrid::Remove(const UnityXRTrackableId& id)
+{
+    const auto iter = m_Locations.find(id);
+    if (iter == m_Locations.end())
+        return;
+
+    RemoveFromCell(iter->second);
+    m_Locations.erase(iter);
+}
+
+void TrackableGrid::Clear()
+{
+    m_Cells.clear();
+    m_Locations.clear();
+}
+
+void TrackableGrid::FindInRadius(const UnityXRVector3& center, float radius, std::vector<UnityXRTrackableId>& idsOut) const
+{
+    if (m_Locations.empty() || !(radius >= 0.f))
+        return;
+
+    const float radiusSquared = radius * radius;
+    const auto addInRadius = [&](const Cell& cell)
+    {
+        for (const auto& item : cell.items)
+        {
+            if (LengthSquared(Sub(item.position, center)) <= radiusSquared)
+                idsOut.push_back(item.id);
+        }
+    };
+
+    int64_t minCoordinates[3];
+    int64_t maxCoordinates[3];
+    GetCellCoordinates(Sub(center, UnityXRVector3{radius, radius, radius}), minCoordinates);
+    GetCellCoordinates(Add(center, UnityXRVector3{radius, radius, radius}), maxCoordinates);
+
+    // A sphere spanning more cells than are occupied visits the occupied ones instead.
+    double numCells = 1.0;
+    for (int i = 0; i < 3; ++i)
+        numCells *= static_cast<double>(maxCoordinates[i] - minCoordinates[i] + 1);
+
+    if (numCells > static_cast<double>(m_Cells.size()))
+    {
+        for (const auto& iter : m_Cells)
+            addInRadius(iter.second);
+
+        return;
+    }
+
+    for (int64_t x = minCoordinates[0]; x <= maxCoordinates[0]; ++x)
+    {
+        for (int64_t y = minCoordinates[1]; y <= maxCoordinates[1]; ++y)
+        {
+            for (int64_t z = minCoordinates[2]; z <= maxCoordinates[2]; ++z)
+            {
+                if (const Cell* cell = FindCell(x, y, z))
+                    addInRadius(*cell);
+            }
+        }
+    }
+}
+
+void TrackableGrid::FindNearest(
+    const UnityXRVector3& center, size_t count, float maxDistance, std::vector<UnityXRTrackableId>& idsOut) const
+{
+    if (m_Locations.empty() || count == 0 || !(maxDistance >= 0.f))
+        return;
+
+    // The nearest count items seen so far, in a max-heap by distance.
+    const float maxDistanceSquared = maxDistance * maxDistance;
+    std::vector<DistanceAndId> nearest;
+    nearest.reserve(std::min(count, m_Locations.size()));
+    const auto addNearest = [&](const Cell& cell)
+    {
+        for (const auto& item : cell.items)
+        {
+            const float distanceSquared = LengthSquared(Sub(item.position, center));
+            if (distanceSquared > maxDistanceSquared)
+                continue;
+
+            if (nearest.size() < count)
+            {
+                nearest.push_back(DistanceAndId(distanceSquared, item.id));
+                std::push_heap(nearest.begin(), nearest.end(), CompareDistance);
+            }
+            else if (distanceSquared < nearest.front().first)
+            {
+                std::pop_heap(nearest.begin(), nearest.end(), CompareDistance);
+                nearest.back() = DistanceAndId(distanceSquared, item.id);
+                std::push_heap(nearest.begin(), nearest.end(), CompareDistance);
+            }
+        }
+    };
+
+    int64_t centerCoordinates[3];
+    GetCellCoordinates(center, centerCoordinates);
+    const bool isCenterInGrid =
+        !IsBorderCoordinate(centerCoordinates[0]) &&
+        !IsBorderCoordinate(centerCoordinates[1]) &&
+        !IsBorderCoordinate(centerCoordinates[2]);
+
+    // Visits shells of cells around the center's, each one cell thicker,
+    // until nothing outside them can be nearer than what was found. Shells
+    // with more cells than are occupied visit the occupied ones instead.
+    for (int64_t ring = 0;; ++ring)
+    {
+        const double side = static_cast<double>(2 * ring + 1);
+        const double numShellCells = ring == 0 ? 1.0 : side * side * side - (side - 2.0) * (side - 2.0) * (side - 2.0);
+        if (!isCenterInGrid || numShellCells > static_cast<double>(m_Cells.size()))
+        {
+            nearest.clear();
+            for (const auto& iter : m_Cells)
+                addNearest(iter.second);
+
+            break;
+        }
+
+        for (int64_t dx = -ring; dx <= ring; ++dx)
+        {
+            for (int64_t dy = -ring; dy <= ring; ++dy)
+            {
+                // Inside the shell only the two cells at its faces along z are on it.
+                const bool isOnShell = dx == -ring || dx == ring || dy == -ring || dy == ring;
+                const int64_t dzStep = isOnShell || ring == 0 ? 1 : 2 * ring;
+                for (int64_t dz = -ring; dz <= ring; dz += dzStep)
+                {
+                    if (const Cell* cell = FindCell(centerCoordinates[0] + dx, centerCoordinates[1] + dy, centerCoordinates[2] + dz))
+                        addNearest(*cell);
+                }
+            }
+        }
+
+        // Cells outside the shells visited are more than ring cells from the center.
+        const float reached = static_cast<float>(ring) * m_CellSize;
+        const float reachedSquared = reached * reached;
+        if (reachedSquared >= maxDistanceSquared || (nearest.size() == count && nearest.front().first <= reachedSquared))
+            break;
+    }
+
+    std::sort_heap(nearest.begin(), nearest.end(), CompareDistance);
+    for (const auto& item : nearest)
+        idsOut.push_back(item.second);
+}
+
+void TrackableGrid::FindInside(const UnityXRVector4* planes, size_t planeCount, std::vector<UnityXRTrackableId>& idsOut) const
+{
+    const auto isInside = [&](const UnityXRVector3& position)
+    {
+        for (size_t i = 0; i < planeCount; ++i)
+        {
+            const auto& plane = planes[i];
+            if (Dot(UnityXRVector3{plane.x, plane.y, plane.z}, position) + plane.w < 0.f)
+                return false;
+        }
+
+        return true;
+    };
+
+    for (const auto& iter : m_Cells)
+    {
+        const auto& cell = iter.second;
+
+        // A cell is skipped if its corner furthest along a plane's normal is
+        // behind it. Border cells also hold positions past their bounds.
+        const auto* coordinates = cell.coordinates;
+        if (!IsBorderCoordinate(coordinates[0]) && !IsBorderCoordinate(coordinates[1]) && !IsBorderCoordinate(coordinates[2]))
+        {
+            const UnityXRVector3 cellMin =
+            {
+                static_cast<float>(coordinates[0]) * m_CellSize,
+                static_cast<float>(coordinates[1]) * m_CellSize,
+                static_cast<float>(coordinates[2]) * m_CellSize
+            };
+
+            bool isOutside = false;
+            for (size_t i = 0; i < planeCount && !isOutside; ++i)
+            {
+                const auto& plane = planes[i];
+                const UnityXRVector3 corner =
+                {
+                    plane.x >= 0.f ? cellMin.x + m_CellSize : cellMin.x,
+                    plane.y >= 0.f ? cellMin.y + m_CellSize : cellMin.y,
+                    plane.z >= 0.f ? cellMin.z + m_CellSize : cellMin.z
+                };
+                isOutside = Dot(UnityXRVector3{plane.x, plane.y, plane.z}, corner) + plane.w < 0.f;
+            }
+
+            if (isOutside)
+                continue;
+        }
+
+        for (const auto& item : cell.items)
+        {
+            if (isInside(item.position))
+                idsOut.push_back(item.id);
+        }
+    }
+}
+
+void TrackableGrid::GetCellCoordinates(const UnityXRVector3& position, int64_t coordinatesOut[3]) const
+{
+    const float components[3] = { position.x, position.y, position.z };
+    for (int i = 0; i < 3; ++i)
+    {
+        // Also clamps infinities, and NaN to the upper border.
+        const float coordinate = std::floor(components[i] / m_CellSize);
+        coordinatesOut[i] = coordinate < static_cast<float>(kMaxCellCoordinate)
+            ? (coordinate > static_cast<float>(-kMaxCellCoordinate) ? static_cast<int64_t>(coordinate) : -kMaxCellCoordinate)
+            : kMaxCellCoordinate;
+    }
+}
+
+const TrackableGrid::Cell* TrackableGrid::FindCell(int64_t x, int64_t y, int64_t z) const
+{
+    if (std::abs(x) > kMaxCellCoordinate || std::abs(y) > kMaxCellCoordinate || std::abs(z) > kMaxCellCoordinate)
+        return nullptr;
+
+    const auto iter = m_Cells.find(GetCellKey(x, y, z));
+    return iter != m_Cells.end() ? &iter->second : nullptr;
+}
+
+void TrackableGrid::RemoveFromCell(const Location& location)
+{
+    const auto cellIter = m_Cells.find(location.cellKey);
+    auto& items = cellIter->second.items;
+    if (location.index + 1 != items.size())
+    {
+        items[location.index] = items.back();
+        m_Locations.find(items[location.index].id)->second.index = location.index;
+    }
+
+    items.pop_back();
+    if (items.empty())
+        m_Cells.erase(cellIter);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "UnityXRTypes.h"
+#include "TrackableIdMap.h"
+
+// Buckets trackable positions into cubic cells so that radius, nearest and
+// convex volume queries only visit the cells they overlap. Moving a trackable
+// within its cell only overwrites its position.
+class TrackableGrid
+{
+public:
+
+    explicit TrackableGrid(float cellSize = 1.f);
+
+    // Rebuckets every position.
+    void SetCellSize(float cellSize);
+
+    // Adds or moves a trackable.
+    void Set(const UnityXRTrackableId& id, const UnityXRVector3& position);
+
+    void Remove(const UnityXRTrackableId& id);
+
+    void Clear();
+
+    size_t GetSize() const { return m_Locations.size(); }
+
+    // Appends the ids of the trackables at most radius from center.
+    void FindInRadius(const UnityXRVector3& center, float radius, std::vector<UnityXRTrackableId>& idsOut) const;
+
+    // Appends the ids of the count trackables nearest to center, nearest
+    // first, ignoring those farther than maxDistance.
+    void FindNearest(
+        const UnityXRVector3& center, size_t count, float maxDistance, std::vector<UnityXRTrackableId>& idsOut) const;
+
+    // Appends the ids of the trackables on the positive side of every plane,
+    // given as a normal and distance like UnityEngine.Plane, so the planes of
+    // GeometryUtility.CalculateFrustumPlanes select a camera frustum.
+    void FindInside(const UnityXRVector4* planes, size_t planeCount, std::vector<UnityXRTrackableId>& idsOut) const;
+
+private:
+
+    struct Item
+    {
+        UnityXRTrackableId id;
+        UnityXRVector3 position;
+    };
+
+    struct Cell
+    {
+        int64_t coordinates[3];
+        std::vector<Item> items;
+    };
+
+    struct Location
+    {
+        uint64_t cellKey;
+        uint32_t index;
+    };
+
+    // Positions past the outermost cells are kept in them, so cell keys
+    // never alias.
+    void GetCellCoordinates(const UnityXRVector3& position, int64_t coordinatesOut[3]) const;
+
+    const Cell* FindCell(int64_t x, int64_t y, int64_t z) const;
+
+    void RemoveFromCell(const Location& location);
+
+    std::unordered_map<uint64_t, Cell> m_Cells;
+
+    TrackableIdMap<Location> m_Locations;
+
+    float m_CellSize;
+};
@@ -1,13 +1,19 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+
 #include "IUnityInterface.h"
 #include "UnityXRTrackable.h"
+#include "TrackableIdHelpers.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
     typedef UnityXRTrackableId(UNITY_INTERFACE_API * TrackableIdGenerator)();
 
-    static TrackableIdGenerator s_TrackableIdGenerator = nullptr;
+    static std::atomic<TrackableIdGenerator> s_TrackableIdGenerator(nullptr);
 
+    // Passing nullptr goes back to the native generator.
     void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setTrackableIdGenerator(TrackableIdGenerator generator)
     {
         s_TrackableIdGenerator = generator;
@@ -22,10 +28,37 @@ extern "C" {
 } // extern "C"
 #endif
 
+// Native ids are a random salt, picked once per plugin load, and a counter.
+// The salt keeps ids from different sessions, e.g. in saved reference
+// points, from colliding.
+static std::atomic<uint64_t> s_NextTrackableIdCounter(1);
+
+static uint64_t GenerateSessionSalt()
+{
+    std::random_device randomDevice;
+    uint64_t salt = (static_cast<uint64_t>(randomDevice()) << 32) ^ randomDevice();
+    salt ^= static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+    // splitmix64 finalizer, so a weak random_device still spreads over all bits.
+    salt ^= salt >> 30;
+    salt *= 0xbf58476d1ce4e5b9ull;
+    salt ^= salt >> 27;
+    salt *= 0x94d049bb133111ebull;
+    salt ^= salt >> 31;
+
+    // Never 0, so no id equals kInvalidId.
+    return salt != 0 ? salt : 1;
+}
+
 UnityXRTrackableId GenerateTrackableId()
 {
-    if (s_TrackableIdGenerator)
-        return s_TrackableIdGenerator();
+    if (TrackableIdGenerator generator = s_TrackableIdGenerator.load())
+        return generator();
+
+    static const uint64_t s_SessionSalt = GenerateSessionSalt();
 
-    return UnityXRTrackableId{};
+    UnityXRTrackableId trackableId;
+    trackableId.idPart[0] = s_SessionSalt;
+    trackableId.idPart[1] = s_NextTrackableIdCounter.fetch_add(1, std::memory_order_relaxed);
+    return trackableId;
 }
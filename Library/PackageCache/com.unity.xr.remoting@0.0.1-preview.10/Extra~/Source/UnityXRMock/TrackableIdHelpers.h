@@ -3,6 +3,25 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+
+// Mixes both halves of an id into 64 bits, each bit depending on every input
+// bit. Ids with equal or structured halves, e.g. GUIDs or a salt and a
+// counter, still spread evenly over a table.
+inline uint64_t HashTrackableId(const UnityXRTrackableId& trackableId)
+{
+    // The murmur3 finalizer, applied to the second half and then to both.
+    uint64_t hash = trackableId.idPart[1];
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+
+    hash ^= trackableId.idPart[0] + 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
 
 namespace std
 {
@@ -11,7 +30,7 @@ namespace std
     {
         std::size_t operator()(const UnityXRTrackableId& trackableId) const
         {
-            return trackableId.idPart[0] ^ trackableId.idPart[1];
+            return static_cast<std::size_t>(HashTrackableId(trackableId));
         }
     };
 }
@@ -0,0 +1,292 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "TrackableIdHelpers.h"
+
+// A hash map keyed by trackable id that stores its entries in one array and
+// resolves collisions by linear probing, so lookups and iteration touch
+// contiguous memory instead of following list nodes. Erased entries leave a
+// tombstone until the next rehash, so erasing while iterating is safe.
+//
+// Unlike std::unordered_map, inserting a new key may move every entry: references
+// and iterators are only valid until then. Erased values are reset to
+// T(), so T must be default constructible.
+template<typename T>
+class TrackableIdMap
+{
+public:
+
+    typedef std::pair<UnityXRTrackableId, T> value_type;
+
+    template<typename Value>
+    class Iterator
+    {
+    public:
+
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Value value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Value* pointer;
+        typedef Value& reference;
+
+        Iterator() = default;
+
+        Iterator(Value* slots, const uint8_t* states, size_t index, size_t capacity)
+            : m_Slots(slots), m_States(states), m_Index(index), m_Capacity(capacity)
+        {
+            SkipUnused();
+        }
+
+        // Lets an iterator convert to a const_iterator.
+        template<typename Other>
+        Iterator(const Iterator<Other>& other)
+            : m_Slots(other.m_Slots), m_States(other.m_States), m_Index(other.m_Index), m_Capacity(other.m_Capacity)
+        {}
+
+        Value& operator*() const { return m_Slots[m_Index]; }
+
+        Value* operator->() const { return &m_Slots[m_Index]; }
+
+        Iterator& operator++()
+        {
+            ++m_Index;
+            SkipUnused();
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const Iterator& other) const { return m_Index == other.m_Index; }
+
+        bool operator!=(const Iterator& other) const { return m_Index != other.m_Index; }
+
+    private:
+
+        template<typename Other>
+        friend class Iterator;
+
+        friend class TrackableIdMap;
+
+        void SkipUnused()
+        {
+            while (m_Index < m_Capacity && m_States[m_Index] != kUsed)
+                ++m_Index;
+        }
+
+        Value* m_Slots = nullptr;
+        const uint8_t* m_States = nullptr;
+        size_t m_Index = 0;
+        size_t m_Capacity = 0;
+    };
+
+    typedef Iterator<value_type> iterator;
+
+    typedef Iterator<const value_type> const_iterator;
+
+    size_t size() const { return m_Size; }
+
+    bool empty() const { return m_Size == 0; }
+
+    iterator begin() { return iterator(m_Slots.data(), m_States.data(), 0, m_States.size()); }
+
+    iterator end() { return iterator(m_Slots.data(), m_States.data(), m_States.size(), m_States.size()); }
+
+    const_iterator begin() const { return const_iterator(m_Slots.data(), m_States.data(), 0, m_States.size()); }
+
+    const_iterator end() const { return const_iterator(m_Slots.data(), m_States.data(), m_States.size(), m_States.size()); }
+
+    void clear()
+    {
+        m_Slots.clear();
+        m_States.clear();
+        m_Size = 0;
+        m_NumTombstones = 0;
+    }
+
+    // Makes room for count entries without rehashing.
+    void reserve(size_t count)
+    {
+        if (count + m_NumTombstones > MaxLoad(m_States.size()))
+            Rehash(count);
+    }
+
+    iterator find(const UnityXRTrackableId& key)
+    {
+        return iterator(m_Slots.data(), m_States.data(), FindIndex(key), m_States.size());
+    }
+
+    const_iterator find(const UnityXRTrackableId& key) const
+    {
+        return const_iterator(m_Slots.data(), m_States.data(), FindIndex(key), m_States.size());
+    }
+
+    size_t count(const UnityXRTrackableId& key) const { return FindIndex(key) != m_States.size() ? 1 : 0; }
+
+    std::pair<iterator, bool> emplace(const UnityXRTrackableId& key, const T& value)
+    {
+        auto result = Insert(key);
+        if (result.second)
+            result.first->second = value;
+
+        return result;
+    }
+
+    std::pair<iterator, bool> emplace(const UnityXRTrackableId& key, T&& value)
+    {
+        auto result = Insert(key);
+        if (result.second)
+            result.first->second = std::move(value);
+
+        return result;
+    }
+
+    T& operator[](const UnityXRTrackableId& key) { return Insert(key).first->second; }
+
+    size_t erase(const UnityXRTrackableId& key)
+    {
+        const size_t index = FindIndex(key);
+        if (index == m_States.size())
+            return 0;
+
+        EraseIndex(index);
+        return 1;
+    }
+
+    // Returns the iterator following position.
+    iterator erase(const_iterator position)
+    {
+        EraseIndex(position.m_Index);
+        return iterator(m_Slots.data(), m_States.data(), position.m_Index + 1, m_States.size());
+    }
+
+private:
+
+    enum : uint8_t
+    {
+        kEmpty,
+        kUsed,
+        kErased
+    };
+
+    static const size_t kMinCapacity = 16;
+
+    // Up to 3/4 of the slots may be used or erased before rehashing.
+    static size_t MaxLoad(size_t capacity) { return capacity - capacity / 4; }
+
+    size_t FindIndex(const UnityXRTrackableId& key) const
+    {
+        const size_t capacity = m_States.size();
+        if (m_Size == 0)
+            return capacity;
+
+        const size_t mask = capacity - 1;
+        for (size_t index = static_cast<size_t>(HashTrackableId(key)) & mask;; index = (index + 1) & mask)
+        {
+            if (m_States[index] == kEmpty)
+                return capacity;
+
+            if (m_States[index] == kUsed && m_Slots[index].first == key)
+                return index;
+        }
+    }
+
+    std::pair<iterator, bool> Insert(const UnityXRTrackableId& key)
+    {
+        if (m_States.empty())
+            Rehash(1);
+
+        // Probes until the key or an empty slot is found, remembering the
+        // first erased slot on the way to reuse it.
+        size_t capacity = m_States.size();
+        size_t mask = capacity - 1;
+        size_t erasedIndex = capacity;
+        size_t index = static_cast<size_t>(HashTrackableId(key)) & mask;
+        for (; m_States[index] != kEmpty; index = (index + 1) & mask)
+        {
+            if (m_States[index] == kUsed)
+            {
+                if (m_Slots[index].first == key)
+                    return std::make_pair(iterator(m_Slots.data(), m_States.data(), index, capacity), false);
+            }
+            else if (erasedIndex == capacity)
+            {
+                erasedIndex = index;
+            }
+        }
+
+        if (erasedIndex != capacity)
+        {
+            index = erasedIndex;
+            --m_NumTombstones;
+        }
+        else if (m_Size + m_NumTombstones + 1 > MaxLoad(capacity))
+        {
+            // Only a new key rehashes, so looking up an existing one with
+            // operator[] never moves the entries.
+            Rehash(m_Size + 1);
+            capacity = m_States.size();
+            mask = capacity - 1;
+            index = static_cast<size_t>(HashTrackableId(key)) & mask;
+            while (m_States[index] != kEmpty)
+                index = (index + 1) & mask;
+        }
+
+        m_States[index] = kUsed;
+        m_Slots[index].first = key;
+        ++m_Size;
+        return std::make_pair(iterator(m_Slots.data(), m_States.data(), index, capacity), true);
+    }
+
+    void EraseIndex(size_t index)
+    {
+        m_States[index] = kErased;
+        m_Slots[index].second = T();
+        --m_Size;
+        ++m_NumTombstones;
+    }
+
+    // Reallocates with room for count entries, dropping tombstones.
+    void Rehash(size_t count)
+    {
+        size_t capacity = kMinCapacity;
+        while (MaxLoad(capacity) < count)
+            capacity *= 2;
+
+        std::vector<value_type> slots(capacity);
+        std::vector<uint8_t> states(capacity, kEmpty);
+        const size_t mask = capacity - 1;
+        for (size_t i = 0; i < m_States.size(); ++i)
+        {
+            if (m_States[i] != kUsed)
+                continue;
+
+            size_t index = static_cast<size_t>(HashTrackableId(m_Slots[i].first)) & mask;
+            while (states[index] == kUsed)
+                index = (index + 1) & mask;
+
+            states[index] = kUsed;
+            slots[index] = std::move(m_Slots[i]);
+        }
+
+        m_Slots.swap(slots);
+        m_States.swap(states);
+        m_NumTombstones = 0;
+    }
+
+    std::vector<value_type> m_Slots;
+
+    std::vector<uint8_t> m_States;
+
+    size_t m_Size = 0;
+
+    size_t m_NumTombstones = 0;
+};
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <atomic>
+
+#include "WorkerPool.h"
+#include "IUnityInterface.h"
+
+// The pool and queue index of the worker running on this thread, if any.
+static thread_local const WorkerPool* s_CurrentPool = nullptr;
+
+static thread_local size_t s_CurrentQueue = 0;
+
+struct WorkerPool::Batch
+{
+    Batch(const RangeJob& job, size_t count, size_t grainSize, size_t numRanges)
+        : job(job), count(count), grainSize(grainSize), numRanges(numRanges)
+    {}
+
+    const RangeJob& job;
+    const size_t count;
+    const size_t grainSize;
+    const size_t numRanges;
+
+    std::atomic<size_t> nextRange{0};
+
+    // Workers running ranges of this batch. Only incremented while the batch
+    // is linked, and decremented under mutex.
+    std::atomic<size_t> numHelpers{0};
+
+    Batch* next = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+extern "C"
+{
+    // Resizes the pool to count workers, or the default number if count <= 0,
+    // at most WorkerPool::kMaxThreads. Safe while native work is running.
+    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityXRMock_setWorkerThreadCount(int count)
+    {
+        if (WorkerPool* pool = WorkerPool::GetInstance())
+            pool->SetNumThreads(count > 0 ? static_cast<size_t>(count) : 0);
+    }
+}
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+    SetNumThreads(numThreads);
+}
+
+WorkerPool::~WorkerPool()
+{
+    std::lock_guard<std::mutex> resizeLock(m_ResizeMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+    }
+    m_Condition.notify_all();
+
+    for (size_t i = 0; i < m_NumThreads.load(); ++i)
+        m_Threads[i].join();
+}
+
+void WorkerPool::SetNumThreads(size_t numThreads)
+{
+    if (numThreads == 0)
+    {
+        const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        numThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    numThreads = std::min(numThreads, kMaxThreads);
+
+    std::lock_guard<std::mutex> resizeLock(m_ResizeMutex);
+    const size_t oldNumThreads = m_NumThreads.load();
+    if (numThreads == oldNumThreads)
+        return;
+
+    // Created before they are counted, so a counted queue always exists.
+    for (size_t i = m_NumQueues.load(); i < numThreads; ++i)
+        m_Queues[i].reset(new Queue());
+
+    if (numThreads > m_NumQueues.load())
+        m_NumQueues = numThreads;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_NumThreads = numThreads;
+    }
+    m_Condition.notify_all();
+
+    for (size_t i = numThreads; i < oldNumThreads; ++i)
+        m_Threads[i].join();
+
+    for (size_t i = oldNumThreads; i < numThreads; ++i)
+        m_Threads[i] = std::thread(&WorkerPool::WorkerLoop, this, i);
+}
+
+void WorkerPool::Enqueue(Job job)
+{
+    // Counted before it is pushed, so the count never drops below zero when a
+    // worker pops the job straight away.
+    ++m_NumQueued;
+
+    const size_t index = s_CurrentPool == this ? s_CurrentQueue : m_NextQueue++ % m_NumThreads.load();
+    {
+        std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+        m_Queues[index]->jobs.push_back(std::move(job));
+    }
+
+    // Taking the lock orders the push against a worker about to sleep.
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+    }
+    m_Condition.notify_one();
+}
+
+bool WorkerPool::TryPop(size_t index, Job& jobOut)
+{
+    {
+        Queue& queue = *m_Queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            jobOut = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            --m_NumQueued;
+            return true;
+        }
+    }
+
+    const size_t numQueues = m_NumQueues.load();
+    for (size_t i = 1; i < numQueues; ++i)
+    {
+        Queue& victim = *m_Queues[(index + i) % numQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            jobOut = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            --m_NumQueued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::WorkerLoop(size_t index)
+{
+    s_CurrentPool = this;
+    s_CurrentQueue = index;
+
+    for (;;)
+    {
+        // A worker let go may have been woken for a job it leaves behind, so
+        // it hands the wake-up on to the others.
+        if (index >= m_NumThreads.load())
+        {
+            m_Condition.notify_all();
+            return;
+        }
+
+        // A ParallelFor caller is blocked on its batch, so batches go first.
+        if (TryHelp())
+            continue;
+
+        Job job;
+        if (!TryPop(index, job))
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this, index]
+            {
+                return m_Quit || index >= m_NumThreads.load() || m_NumQueued.load() > 0 || FindOpenBatchLocked() != nullptr;
+            });
+
+            // Drain what is queued before quitting; jobs may own resources
+            // that are only released when they run.
+            if (m_Quit && m_NumQueued.load() == 0 && FindOpenBatchLocked() == nullptr)
+                return;
+
+            continue;
+        }
+
+        job();
+    }
+}
+
+bool WorkerPool::TryHelp()
+{
+    Batch* batch;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        batch = FindOpenBatchLocked();
+        if (batch == nullptr)
+            return false;
+
+        ++batch->numHelpers;
+    }
+
+    RunRanges(*batch);
+
+    // The caller returns, and the batch goes away, as soon as it sees the
+    // count drop, so nothing touches the batch after notifying under its lock.
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    if (--batch->numHelpers == 0)
+        batch->done.notify_all();
+
+    return true;
+}
+
+WorkerPool::Batch* WorkerPool::FindOpenBatchLocked() const
+{
+    for (Batch* batch = m_Batches; batch != nullptr; batch = batch->next)
+    {
+        if (batch->nextRange.load() < batch->numRanges)
+            return batch;
+    }
+
+    return nullptr;
+}
+
+void WorkerPool::RunRanges(Batch& batch)
+{
+    for (;;)
+    {
+        const size_t range = batch.nextRange.fetch_add(1);
+        if (range >= batch.numRanges)
+            return;
+
+        const size_t begin = range * batch.grainSize;
+        batch.job(begin, std::min(begin + batch.grainSize, batch.count));
+    }
+}
+
+void WorkerPool::ParallelFor(size_t count, size_t grainSize, const RangeJob& job)
+{
+    if (count == 0)
+        return;
+
+    grainSize = std::max<size_t>(grainSize, 1);
+    const size_t numRanges = (count + grainSize - 1) / grainSize;
+    if (numRanges == 1 || GetNumThreads() == 0)
+    {
+        job(0, count);
+        return;
+    }
+
+    Batch batch(job, count, grainSize, numRanges);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        batch.next = m_Batches;
+        m_Batches = &batch;
+    }
+
+    const size_t numHelpers = std::min(GetNumThreads(), numRanges - 1);
+    for (size_t i = 0; i < numHelpers; ++i)
+        m_Condition.notify_one();
+
+    RunRanges(batch);
+
+    // Once unlinked no worker can start helping, so the ranges still running
+    // are all held by counted helpers.
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        Batch** link = &m_Batches;
+        while (*link != &batch)
+            link = &(*link)->next;
+
+        *link = batch.next;
+    }
+
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done.wait(lock, [&batch] { return batch.numHelpers.load() == 0; });
+}
+
+void RunAsync(WorkerPool::Job job)
+{
+    if (WorkerPool* pool = WorkerPool::GetInstance())
+        pool->Enqueue(std::move(job));
+    else
+        job();
+}
+
+void RunParallelFor(size_t count, size_t grainSize, const WorkerPool::RangeJob& job)
+{
+    if (WorkerPool* pool = WorkerPool::GetInstance())
+        pool->ParallelFor(count, grainSize, job);
+    else if (count > 0)
+        job(0, count);
+}
+
+size_t GetParallelism()
+{
+    if (WorkerPool* pool = WorkerPool::GetInstance())
+        return pool->GetNumThreads() + 1;
+
+    return 1;
+}
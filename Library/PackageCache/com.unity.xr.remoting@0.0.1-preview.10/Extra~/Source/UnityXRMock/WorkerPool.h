@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Singleton.h"
+
+// A set of native worker threads for work that should not run on Unity's
+// threads, e.g. depth image back-projection. Each worker has its own
+// queue: jobs enqueued by a worker go to the back of its queue and it runs
+// them newest first, while idle workers steal the oldest jobs from the others.
+class WorkerPool : public Singleton<WorkerPool>
+{
+public:
+
+    typedef std::function<void()> Job;
+
+    typedef std::function<void(size_t begin, size_t end)> RangeJob;
+
+    static const size_t kMaxThreads = 64;
+
+    // numThreads == 0 uses one thread less than the number of hardware threads.
+    explicit WorkerPool(size_t numThreads = 0);
+
+    ~WorkerPool();
+
+    // Grows or shrinks the pool in place, as for the constructor, while jobs
+    // keep running. Returns once the workers let go have finished their
+    // current job; what is queued for them is taken by the others.
+    void SetNumThreads(size_t numThreads);
+
+    void Enqueue(Job job);
+
+    // Splits [0, count) into ranges of at most grainSize elements and runs them
+    // on the workers and the calling thread. Returns once every range is done.
+    // Allocates nothing: idle workers take ranges straight from the caller's
+    // batch instead of from queued jobs.
+    void ParallelFor(size_t count, size_t grainSize, const RangeJob& job);
+
+    size_t GetNumThreads() const { return m_NumThreads.load(); }
+
+private:
+
+    struct Queue
+    {
+        std::deque<Job> jobs;
+        std::mutex mutex;
+    };
+
+    // A ParallelFor in progress, on its caller's stack.
+    struct Batch;
+
+    void WorkerLoop(size_t index);
+
+    bool TryPop(size_t index, Job& jobOut);
+
+    // Runs ranges of a batch with ranges left, if any.
+    bool TryHelp();
+
+    Batch* FindOpenBatchLocked() const;
+
+    static void RunRanges(Batch& batch);
+
+    // Workers at index m_NumThreads and up have been let go. Only touched
+    // under m_ResizeMutex.
+    std::thread m_Threads[kMaxThreads];
+
+    // Queues are kept when their worker is let go, so jobs left in them are
+    // still stolen and a worker enqueueing from another job never loses one.
+    std::unique_ptr<Queue> m_Queues[kMaxThreads];
+
+    std::atomic<size_t> m_NumThreads{0};
+
+    // Number of queues created, never shrinking.
+    std::atomic<size_t> m_NumQueues{0};
+
+    std::mutex m_ResizeMutex;
+
+    // Queue the next job from a thread outside the pool goes to.
+    std::atomic<size_t> m_NextQueue{0};
+
+    std::atomic<size_t> m_NumQueued{0};
+
+    // Batches of the ParallelFor calls in progress, newest first, linked
+    // through Batch::next. Guarded by m_Mutex.
+    Batch* m_Batches = nullptr;
+
+    // Idle workers sleep on m_Condition.
+    std::mutex m_Mutex;
+
+    std::condition_variable m_Condition;
+
+    bool m_Quit = false;
+};
+
+// Enqueues job on the WorkerPool, or runs it inline if there is no pool.
+void RunAsync(WorkerPool::Job job);
+
+// WorkerPool::ParallelFor, or a single inline call if there is no pool.
+void RunParallelFor(size_t count, size_t grainSize, const WorkerPool::RangeJob& job);
+
+// Number of threads RunParallelFor spreads work over, counting the caller.
+size_t GetParallelism();